@@ -0,0 +1,276 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Geometry pool benchmark. The same field of small meshes is drawn as one
+	buffer pair per mesh and from a shared geometry pool. Per frame the
+	table shows buffer binds, draw calls and wall time including
+	glFinish, so the pool should keep one bind however many meshes there
+	are. A churn pass then removes every third mesh, adds different meshes
+	into the freed ranges and draws with the stale handles still in the
+	list, which must draw exactly the live meshes.
+*/
+
+#define GRID_WIDTH 100
+#define BENCH_FRAMES 32
+#define MAX_DRAWS 1024
+
+GLfloat cube_vertices[] = {
+	-1.0, -1.0,  1.0, 0.0, 0.0,
+	 1.0, -1.0,  1.0, 1.0, 0.0,
+	 1.0,  1.0,  1.0, 1.0, 1.0,
+	-1.0,  1.0,  1.0, 0.0, 1.0,
+	-1.0, -1.0, -1.0, 1.0, 0.0,
+	 1.0, -1.0, -1.0, 0.0, 0.0,
+	 1.0,  1.0, -1.0, 0.0, 1.0,
+	-1.0,  1.0, -1.0, 1.0, 1.0
+};
+
+uint32_t cube_elements[] = {
+	0, 1, 2, 2, 3, 0,
+	1, 5, 6, 6, 2, 1,
+	5, 4, 7, 7, 6, 5,
+	4, 0, 3, 3, 7, 4,
+	3, 2, 6, 6, 7, 3,
+	4, 5, 1, 1, 0, 4
+};
+
+GLuint program, texture_id;
+GLint locations[DASH_SEMANTIC_COUNT];
+GLint uniform_mvp, uniform_mytexture;
+
+double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+void build_mesh(int i, dash_mesh_data *data) {
+
+	int v;
+	float *dst;
+
+	// Vertices are placed in the field up front, the pool has no transforms
+
+	data->vertices = (float*)malloc(sizeof(cube_vertices));
+	data->vertex_count = 8;
+	data->stride = 5;
+	data->texcoord = 3;
+	data->normal = -1;
+	data->color = -1;
+	data->indices = cube_elements;
+	data->index_count = sizeof(cube_elements) / sizeof(uint32_t);
+
+	for(v = 0; v < 8; v++) {
+		dst = data->vertices + v * 5;
+		memcpy(dst, cube_vertices + v * 5, sizeof(float) * 5);
+		dst[0] = dst[0] * 0.4f + (i % GRID_WIDTH - GRID_WIDTH / 2);
+		dst[1] = dst[1] * 0.4f;
+		dst[2] = dst[2] * 0.4f - i / GRID_WIDTH;
+	}
+
+}
+
+void begin_frame() {
+
+	mat4 mvp, projection, view;
+	vec3 eye = { 0.0f, 30.0f, 20.0f };
+	vec3 target = { 0.0f, 0.0f, -GRID_WIDTH / 2.0f };
+	vec3 axis = { 0.0f, 1.0f, 0.0f };
+
+	mat4_perspective(45.0f, 1.0f, 0.1f, 1000.0f, projection);
+	mat4_look_at(eye, target, axis, view);
+	mat4_multiply(projection, view, mvp);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, mvp);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glUniform1i(uniform_mytexture, 0);
+
+}
+
+double time_meshes(dash_mesh *meshes, int count) {
+
+	int i, f;
+	double start;
+
+	start = now();
+	for(f = 0; f < BENCH_FRAMES; f++) {
+		begin_frame();
+		for(i = 0; i < count; i++) {
+			dash_mesh_render(&meshes[i]);
+		}
+		dash_mesh_unbind();
+		glutSwapBuffers();
+	}
+	glFinish();
+
+	return (now() - start) * 1000.0 / BENCH_FRAMES;
+
+}
+
+double time_pool(dash_pool *pool, const int *handles, int count, dash_pool_stats *stats) {
+
+	int f;
+	double start;
+	dash_pool_stats before;
+
+	dash_pool_get_stats(pool, &before);
+	start = now();
+	for(f = 0; f < BENCH_FRAMES; f++) {
+		begin_frame();
+		dash_pool_draw(pool, handles, count);
+		dash_mesh_unbind();
+		glutSwapBuffers();
+	}
+	glFinish();
+
+	dash_pool_get_stats(pool, stats);
+	stats->binds = (stats->binds - before.binds) / BENCH_FRAMES;
+	stats->draw_calls = (stats->draw_calls - before.draw_calls) / BENCH_FRAMES;
+	stats->draws = (stats->draws - before.draws) / BENCH_FRAMES;
+
+	return (now() - start) * 1000.0 / BENCH_FRAMES;
+
+}
+
+void run_count(int count) {
+
+	int i, added, *handles;
+	double t;
+	dash_mesh_data *data;
+	dash_mesh *meshes;
+	dash_pool *pool;
+	dash_pool_stats stats;
+
+	added = (count + 2) / 3;
+	data = (dash_mesh_data*)malloc(sizeof(dash_mesh_data) * (count + added));
+	meshes = (dash_mesh*)calloc(count, sizeof(dash_mesh));
+	handles = (int*)malloc(sizeof(int) * (count + added));
+
+	for(i = 0; i < count; i++) {
+		build_mesh(i, &data[i]);
+		dash_mesh_upload(&data[i], &meshes[i]);
+		dash_mesh_layout(&meshes[i], locations);
+	}
+
+	t = time_meshes(meshes, count);
+	printf("%-8s %6d %8d %8d %10.3f\n", "meshes", count, count, count, t);
+
+	pool = dash_pool_create(&data[0], (size_t)count * 8, (size_t)count * 36, MAX_DRAWS);
+	dash_pool_layout(pool, locations);
+	for(i = 0; i < count; i++) {
+		handles[i] = dash_pool_add(pool, &data[i]);
+	}
+
+	t = time_pool(pool, handles, count, &stats);
+	printf("%-8s %6d %8ld %8ld %10.3f\n", "pool", count, stats.binds, stats.draw_calls, t);
+
+	// Freed ranges and slots are reused by meshes placed past the field.
+	// The removed handles left in the list must be skipped rather than
+	// drawing or removing whatever now occupies their slot
+
+	for(i = 0; i < count; i += 3) {
+		dash_pool_remove(pool, handles[i]);
+	}
+	for(i = 0; i < added; i++) {
+		build_mesh(count + i, &data[count + i]);
+		handles[count + i] = dash_pool_add(pool, &data[count + i]);
+	}
+	dash_pool_remove(pool, handles[count - 1]);
+
+	t = time_pool(pool, handles, count + added, &stats);
+	printf("%-8s %6d %8ld %8ld %10.3f  %d meshes, largest free %zu vertices\n", "churn",
+		count, stats.binds, stats.draw_calls, t, stats.meshes, stats.largest_free_vertices);
+	if(stats.draws != stats.meshes) {
+		fprintf(stderr, "Churn drew %ld meshes per frame, %d are live\n",
+			stats.draws, stats.meshes);
+	}
+
+	dash_pool_destroy(pool);
+	for(i = 0; i < count; i++) {
+		dash_mesh_free(&meshes[i]);
+	}
+	for(i = 0; i < count + added; i++) {
+		free(data[i].vertices);
+	}
+	free(data);
+	free(meshes);
+	free(handles);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int c;
+	const int counts[] = { 100, 1000, 10000 };
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2, 0);
+	glutInitDisplayMode(GLUT_RGBA|GLUT_DOUBLE|GLUT_DEPTH);
+	glutInitWindowSize(640, 640);
+	glutCreateWindow("Pool Benchmark");
+
+	GLenum glew_status = glewInit();
+	if(glew_status != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	program = dash_create_program("shader/vertex.glsl", "shader/fragment.glsl");
+	if(!program) {
+		return 1;
+	}
+
+	locations[DASH_POSITION] = glGetAttribLocation(program, "coord3d");
+	locations[DASH_TEXCOORD] = glGetAttribLocation(program, "texcoord");
+	locations[DASH_COLOR] = -1;
+	uniform_mvp = glGetUniformLocation(program, "mvp");
+	uniform_mytexture = glGetUniformLocation(program, "mytexture");
+
+	texture_id = dash_texture_load("texture.png");
+	glClearColor(1.0, 1.0, 1.0, 1.0);
+	glEnable(GL_DEPTH_TEST);
+
+	printf("renderer: %s\n", glGetString(GL_RENDERER));
+	printf("%-8s %6s %8s %8s %10s\n", "path", "meshes", "binds", "draws", "frame ms");
+
+	for(c = 0; c < 3; c++) {
+		run_count(counts[c]);
+	}
+
+	glDeleteProgram(program);
+	glDeleteTextures(1, &texture_id);
+	return 0;
+
+}
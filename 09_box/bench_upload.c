@@ -0,0 +1,235 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Texture upload benchmark. Every strategy uploads the same frames into a
+	texture of each size and format. "stall" is the time the main thread
+	spends inside the upload calls, MB/s includes the glFinish at the end so
+	deferred driver copies are counted too.
+*/
+
+#define ITERATIONS 32
+
+enum {
+	STRATEGY_TEXIMAGE,
+	STRATEGY_SUBIMAGE,
+	STRATEGY_PBO,
+	STRATEGY_PBO_DOUBLE,
+	STRATEGY_BGRA,
+	STRATEGY_COUNT
+};
+
+const char *strategy_names[STRATEGY_COUNT] = {
+	"glTexImage2D",
+	"storage+sub",
+	"pbo",
+	"pbo x2",
+	"bgra+sub"
+};
+
+double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+void swizzle_bgra(unsigned char *src, unsigned char *dst, int count) {
+
+	int i;
+
+	for(i = 0; i < count; i++) {
+		dst[i * 4 + 0] = src[i * 4 + 2];
+		dst[i * 4 + 1] = src[i * 4 + 1];
+		dst[i * 4 + 2] = src[i * 4 + 0];
+		dst[i * 4 + 3] = src[i * 4 + 3];
+	}
+
+}
+
+void fill_pbo(unsigned char *pixels, size_t bytes) {
+
+	unsigned char *map;
+
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	map = (unsigned char*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if(map != NULL) {
+		memcpy(map, pixels, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+}
+
+int run_strategy(int strategy, int size, GLenum format, double *mb_per_s, double *stall_ms) {
+
+	int i, bpp;
+	size_t n, bytes;
+	double start, stall, t;
+	unsigned char *pixels, *staging;
+	GLuint texture_id, pbo[2];
+	GLenum upload_format;
+
+	bpp = format == GL_RGB ? 3 : 4;
+	bytes = (size_t)size * size * bpp;
+	upload_format = strategy == STRATEGY_BGRA ? GL_BGRA : format;
+
+	if(strategy == STRATEGY_BGRA && format != GL_RGBA) {
+		return 0;
+	}
+	if((strategy == STRATEGY_PBO || strategy == STRATEGY_PBO_DOUBLE) && !GLEW_ARB_pixel_buffer_object) {
+		return 0;
+	}
+
+	pixels = (unsigned char*)malloc(bytes);
+	staging = (unsigned char*)malloc(bytes);
+	for(n = 0; n < bytes; n++) {
+		pixels[n] = (unsigned char)(n * 7);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	if(strategy != STRATEGY_TEXIMAGE) {
+		if(GLEW_ARB_texture_storage) {
+			glTexStorage2D(GL_TEXTURE_2D, 1, format == GL_RGB ? GL_RGB8 : GL_RGBA8, size, size);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, 0, format, size, size, 0, upload_format, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+
+	glGenBuffers(2, pbo);
+	for(i = 0; i < 2 && GLEW_ARB_pixel_buffer_object; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glFinish();
+
+	stall = 0.0;
+	start = now();
+
+	for(i = 0; i < ITERATIONS; i++) {
+
+		t = now();
+
+		switch(strategy) {
+			case STRATEGY_TEXIMAGE:
+				glTexImage2D(GL_TEXTURE_2D, 0, format, size, size, 0, format, GL_UNSIGNED_BYTE, pixels);
+			break;
+			case STRATEGY_SUBIMAGE:
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, format, GL_UNSIGNED_BYTE, pixels);
+			break;
+			case STRATEGY_PBO:
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[0]);
+				fill_pbo(pixels, bytes);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, format, GL_UNSIGNED_BYTE, 0);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			break;
+			case STRATEGY_PBO_DOUBLE:
+
+				// Upload the frame filled last iteration while filling the other
+
+				if(i > 0) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[(i + 1) & 1]);
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, format, GL_UNSIGNED_BYTE, 0);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i & 1]);
+				fill_pbo(pixels, bytes);
+				if(i == ITERATIONS - 1) {
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, format, GL_UNSIGNED_BYTE, 0);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			break;
+			case STRATEGY_BGRA:
+				swizzle_bgra(pixels, staging, size * size);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_BGRA, GL_UNSIGNED_BYTE, staging);
+			break;
+		}
+
+		stall += now() - t;
+
+	}
+
+	glFinish();
+	t = now() - start;
+
+	*mb_per_s = bytes * ITERATIONS / (1024.0 * 1024.0) / t;
+	*stall_ms = stall * 1000.0 / ITERATIONS;
+
+	glDeleteBuffers(2, pbo);
+	glDeleteTextures(1, &texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	free(pixels);
+	free(staging);
+
+	return 1;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int s, f, z;
+	double mb_per_s, stall_ms;
+	const int sizes[] = { 256, 512, 1024, 2048 };
+	const GLenum formats[] = { GL_RGB, GL_RGBA };
+	const char *format_names[] = { "rgb", "rgba" };
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2, 0);
+	glutInitDisplayMode(GLUT_RGBA|GLUT_DOUBLE);
+	glutInitWindowSize(64, 64);
+	glutCreateWindow("Upload Benchmark");
+
+	GLenum glew_status = glewInit();
+	if(glew_status != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	printf("renderer: %s\n", glGetString(GL_RENDERER));
+	printf("%-14s %-6s %6s %10s %10s\n", "strategy", "format", "size", "MB/s", "stall ms");
+
+	for(f = 0; f < 2; f++) {
+		for(z = 0; z < 4; z++) {
+			for(s = 0; s < STRATEGY_COUNT; s++) {
+				if(!run_strategy(s, sizes[z], formats[f], &mb_per_s, &stall_ms)) {
+					continue;
+				}
+				printf("%-14s %-6s %6d %10.1f %10.3f\n", strategy_names[s],
+					format_names[f], sizes[z], mb_per_s, stall_ms);
+			}
+		}
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,210 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <GL/glew.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Voxel storage benchmark. Worlds are filled at several ratios, either as
+	layered terrain or as random noise of four types, which is the worst
+	case for palettes and runs. Each world is measured against a dense
+	byte per voxel array holding the same voxels: memory, nanoseconds per
+	random lookup, and milliseconds to read every chunk into a dense
+	buffer the way the mesher does. No GL context is needed.
+*/
+
+#define CHUNKS_X 8
+#define CHUNKS_Y 4
+#define CHUNKS_Z 8
+#define SIZE_X (CHUNKS_X * DASH_CHUNK_SIZE)
+#define SIZE_Y (CHUNKS_Y * DASH_CHUNK_SIZE)
+#define SIZE_Z (CHUNKS_Z * DASH_CHUNK_SIZE)
+#define LOOKUPS (1 << 22)
+
+enum {
+	FILL_TERRAIN,
+	FILL_NOISE,
+	FILL_COUNT
+};
+
+const char *fill_names[FILL_COUNT] = {
+	"terrain",
+	"noise"
+};
+
+uint32_t seed = 12345;
+
+double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+uint32_t next_random() {
+
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 8;
+
+}
+
+void fill_dense(uint8_t *dense, int fill, float ratio) {
+
+	int x, y, z, h;
+
+	for(z = 0; z < SIZE_Z; z++) {
+		for(x = 0; x < SIZE_X; x++) {
+
+			// Terrain is stone under dirt under grass with a ragged surface
+
+			h = (int)(ratio * SIZE_Y) + (int)(next_random() % 5) - 2;
+			for(y = 0; y < SIZE_Y; y++) {
+				uint8_t *v = &dense[((size_t)z * SIZE_Y + y) * SIZE_X + x];
+				if(fill == FILL_NOISE) {
+					*v = next_random() % 1000 < ratio * 1000 ? 1 + next_random() % 4 : 0;
+				} else {
+					*v = y >= h ? 0 : (y == h - 1 ? 1 : (y >= h - 4 ? 2 : 3));
+				}
+			}
+
+		}
+	}
+
+}
+
+void copy_chunk(uint8_t *dense, int cx, int cy, int cz, uint8_t *chunk) {
+
+	int y, z;
+	uint8_t *row;
+
+	for(z = 0; z < DASH_CHUNK_SIZE; z++) {
+		for(y = 0; y < DASH_CHUNK_SIZE; y++) {
+			row = dense + ((size_t)(cz * DASH_CHUNK_SIZE + z) * SIZE_Y + cy * DASH_CHUNK_SIZE + y) * SIZE_X;
+			memcpy(chunk + (z * DASH_CHUNK_SIZE + y) * DASH_CHUNK_SIZE, row + cx * DASH_CHUNK_SIZE, DASH_CHUNK_SIZE);
+		}
+	}
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int i, f, r, cx, cy, cz;
+	uint32_t *lookups;
+	uint8_t *dense, *chunk;
+	unsigned long sum_dense, sum_packed;
+	double t, dense_get, packed_get, dense_read, packed_read;
+	dash_voxel_world *world;
+	dash_voxel_stats stats;
+	const float ratios[] = { 0.01f, 0.1f, 0.25f, 0.5f, 0.9f };
+
+	dense = (uint8_t*)malloc((size_t)SIZE_X * SIZE_Y * SIZE_Z);
+	chunk = (uint8_t*)malloc(DASH_CHUNK_VOXELS);
+	lookups = (uint32_t*)malloc(sizeof(uint32_t) * 3 * LOOKUPS);
+	for(i = 0; i < LOOKUPS; i++) {
+		lookups[i * 3 + 0] = next_random() % SIZE_X;
+		lookups[i * 3 + 1] = next_random() % SIZE_Y;
+		lookups[i * 3 + 2] = next_random() % SIZE_Z;
+	}
+
+	printf("%d x %d x %d voxels, dense storage %.1f MB\n", SIZE_X, SIZE_Y, SIZE_Z,
+		(double)SIZE_X * SIZE_Y * SIZE_Z / (1024.0 * 1024.0));
+	printf("%-8s %5s %9s %7s %5s %12s %12s %12s %12s\n", "fill", "ratio", "packed MB",
+		"uniform", "runs", "dense get ns", "packed ns", "dense read", "packed read");
+
+	for(f = 0; f < FILL_COUNT; f++) {
+		for(r = 0; r < sizeof(ratios) / sizeof(float); r++) {
+
+			fill_dense(dense, f, ratios[r]);
+			world = dash_voxel_create(CHUNKS_X, CHUNKS_Y, CHUNKS_Z);
+			for(cz = 0; cz < CHUNKS_Z; cz++) {
+				for(cy = 0; cy < CHUNKS_Y; cy++) {
+					for(cx = 0; cx < CHUNKS_X; cx++) {
+						copy_chunk(dense, cx, cy, cz, chunk);
+						dash_voxel_write_chunk(world, cx, cy, cz, chunk);
+					}
+				}
+			}
+
+			// Random access
+
+			sum_dense = 0;
+			t = now();
+			for(i = 0; i < LOOKUPS; i++) {
+				sum_dense += dense[((size_t)lookups[i * 3 + 2] * SIZE_Y + lookups[i * 3 + 1]) * SIZE_X + lookups[i * 3]];
+			}
+			dense_get = (now() - t) * 1e9 / LOOKUPS;
+
+			sum_packed = 0;
+			t = now();
+			for(i = 0; i < LOOKUPS; i++) {
+				sum_packed += dash_voxel_get(world, lookups[i * 3], lookups[i * 3 + 1], lookups[i * 3 + 2]);
+			}
+			packed_get = (now() - t) * 1e9 / LOOKUPS;
+
+			if(sum_dense != sum_packed) {
+				fprintf(stderr, "Lookup mismatch: %lu != %lu\n", sum_dense, sum_packed);
+				return 1;
+			}
+
+			// Bulk reads of every chunk, as the mesher does
+
+			sum_dense = 0;
+			t = now();
+			for(i = 0; i < CHUNKS_X * CHUNKS_Y * CHUNKS_Z; i++) {
+				copy_chunk(dense, i % CHUNKS_X, i / CHUNKS_X % CHUNKS_Y, i / (CHUNKS_X * CHUNKS_Y), chunk);
+				sum_dense += chunk[i % DASH_CHUNK_VOXELS];
+			}
+			dense_read = (now() - t) * 1000.0;
+
+			sum_packed = 0;
+			t = now();
+			for(i = 0; i < CHUNKS_X * CHUNKS_Y * CHUNKS_Z; i++) {
+				dash_voxel_read_chunk(world, i % CHUNKS_X, i / CHUNKS_X % CHUNKS_Y, i / (CHUNKS_X * CHUNKS_Y), chunk);
+				sum_packed += chunk[i % DASH_CHUNK_VOXELS];
+			}
+			packed_read = (now() - t) * 1000.0;
+
+			if(sum_dense != sum_packed) {
+				fprintf(stderr, "Chunk read mismatch\n");
+				return 1;
+			}
+
+			dash_voxel_get_stats(world, &stats);
+			printf("%-8s %5.2f %9.2f %7d %5d %12.2f %12.2f %9.2f ms %9.2f ms\n", fill_names[f], ratios[r],
+				stats.storage_bytes / (1024.0 * 1024.0), stats.uniform_chunks, stats.run_chunks,
+				dense_get, packed_get, dense_read, packed_read);
+
+			dash_voxel_destroy(world);
+
+		}
+	}
+
+	free(lookups);
+	free(chunk);
+	free(dense);
+	return 0;
+
+}
@@ -0,0 +1,331 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "lib/dashgl.h"
+
+/*
+	A million cubes, one per column of a 1000 x 1000 height field, each an 8
+	byte record. The renderer pulls records from a texture buffer where the
+	context allows it and falls back to instancing a unit cube otherwise.
+	Run with -instanced or -draw to force a fallback, or with -bench to time
+	every supported path at several cube counts and exit.
+*/
+
+#define WIDTH 640
+#define HEIGHT 480
+#define GRID 1000
+#define BENCH_FRAMES 32
+
+dash_cubes cubes;
+dash_cube *records;
+GLuint program, texture_id;
+GLint uniform_view_projection, uniform_mytexture;
+
+const char *layers[] = {
+	"texture.png",
+	"texture.png"
+};
+
+const char *mode_names[] = {
+	"auto",
+	"per draw",
+	"instanced",
+	"pulled"
+};
+
+int init_resources(int mode);
+int load_program();
+void build_records();
+void draw_scene(float seconds);
+void on_display();
+void on_idle();
+void run_benchmark();
+void free_resources();
+
+double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int i, mode, bench;
+
+	mode = DASH_CUBES_AUTO;
+	bench = 0;
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-draw") == 0) {
+			mode = DASH_CUBES_DRAW;
+		} else if(strcmp(argv[i], "-instanced") == 0) {
+			mode = DASH_CUBES_INSTANCED;
+		} else if(strcmp(argv[i], "-bench") == 0) {
+			bench = 1;
+		}
+	}
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2, 0);
+	glutInitDisplayMode(GLUT_RGBA|GLUT_ALPHA|GLUT_DOUBLE|GLUT_DEPTH);
+	glutInitWindowSize(WIDTH, HEIGHT);
+	glutCreateWindow("Pulled Cubes");
+
+	GLenum glew_status = glewInit();
+	if(glew_status != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	if(!GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error your gpu does not support OpenGL 2.0\n");
+		return 1;
+	}
+
+	if(!init_resources(mode)) {
+		free_resources();
+		return 1;
+	}
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
+	if(bench) {
+		run_benchmark();
+		free_resources();
+		return 0;
+	}
+
+	printf("%d cubes, %s, %d bytes per cube\n", GRID * GRID, mode_names[cubes.mode],
+		(int)sizeof(uint16_t) * 4);
+
+	glutDisplayFunc(on_display);
+	glutIdleFunc(on_idle);
+	glutMainLoop();
+
+	free_resources();
+	return 0;
+
+}
+
+int init_resources(int mode) {
+
+	glClearColor(0.6, 0.8, 1.0, 1.0);
+
+	if(!dash_cubes_create(&cubes, GRID * GRID, mode)) {
+		fprintf(stderr, "Cube mode %s is not supported\n", mode_names[mode]);
+		return 0;
+	}
+
+	texture_id = dash_texture_array_load(layers, 2);
+	if(!texture_id) {
+		return 0;
+	}
+
+	records = (dash_cube*)malloc(sizeof(dash_cube) * GRID * GRID);
+	build_records();
+	dash_cubes_update(&cubes, records, GRID * GRID);
+
+	if(load_program()) {
+		return 1;
+	}
+
+	// A driver can list every extension and still reject the pulling
+	// shader, the automatic mode then retries with an instanced unit cube
+
+	if(mode != DASH_CUBES_AUTO || cubes.mode != DASH_CUBES_PULL) {
+		return 0;
+	}
+
+	fprintf(stderr, "Falling back from pulled cubes\n");
+	dash_cubes_free(&cubes);
+	if(!dash_cubes_create(&cubes, GRID * GRID, DASH_CUBES_INSTANCED) &&
+		!dash_cubes_create(&cubes, GRID * GRID, DASH_CUBES_DRAW)) {
+		return 0;
+	}
+	dash_cubes_update(&cubes, records, GRID * GRID);
+
+	return load_program();
+
+}
+
+int load_program() {
+
+	const char *vertex;
+
+	vertex = "shader/vertex_cube.glsl";
+	if(cubes.mode == DASH_CUBES_PULL) {
+		vertex = "shader/vertex_pulled.glsl";
+	}
+
+	glDeleteProgram(program);
+	program = dash_create_program(vertex, "shader/fragment_array.glsl");
+	if(!program) {
+		return 0;
+	}
+
+	if(!dash_cubes_program(&cubes, program)) {
+		fprintf(stderr, "Could not bind cube attributes\n");
+		return 0;
+	}
+
+	uniform_view_projection = glGetUniformLocation(program, "view_projection");
+	uniform_mytexture = glGetUniformLocation(program, "mytexture");
+	if(uniform_view_projection == -1 || uniform_mytexture == -1) {
+		fprintf(stderr, "Could not bind cube uniforms\n");
+		return 0;
+	}
+
+	return 1;
+
+}
+
+void build_records() {
+
+	int x, z, h;
+	dash_cube *c;
+
+	// Rolling hills one cube thick, grass on the crests
+
+	for(z = 0; z < GRID; z++) {
+		for(x = 0; x < GRID; x++) {
+			h = 32 + (int)(12.0f * sinf(x * 0.03f) * cosf(z * 0.025f) + 6.0f * sinf((x + z) * 0.07f));
+			c = &records[z * GRID + x];
+			c->x = x;
+			c->y = h;
+			c->z = z;
+			c->size = 1;
+			c->layer = h > 36 ? 0 : 1;
+		}
+	}
+
+}
+
+void draw_scene(float seconds) {
+
+	mat4 view_projection, projection, view;
+	vec3 eye, target = { GRID / 2.0f, 32.0f, GRID / 2.0f };
+	vec3 axis = { 0.0f, 1.0f, 0.0f };
+
+	eye[0] = GRID / 2.0f + GRID * 0.6f * cosf(seconds * 0.1f);
+	eye[1] = 220.0f;
+	eye[2] = GRID / 2.0f + GRID * 0.6f * sinf(seconds * 0.1f);
+
+	mat4_perspective(45.0f, 1.0f*WIDTH/HEIGHT, 1.0f, 4000.0f, projection);
+	mat4_look_at(eye, target, axis, view);
+	mat4_multiply(projection, view, view_projection);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	glUniformMatrix4fv(uniform_view_projection, 1, GL_FALSE, view_projection);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+	glUniform1i(uniform_mytexture, 0);
+
+	dash_cubes_draw(&cubes);
+
+}
+
+void on_display() {
+
+	draw_scene(glutGet(GLUT_ELAPSED_TIME) / 1000.0f);
+	glutSwapBuffers();
+
+}
+
+void on_idle() {
+
+	glutPostRedisplay();
+
+}
+
+void run_benchmark() {
+
+	int i, c, m;
+	double start, t;
+	const int counts[] = { 10000, 100000, 1000000 };
+	const int modes[] = { DASH_CUBES_DRAW, DASH_CUBES_INSTANCED, DASH_CUBES_PULL };
+
+	// Per instance data for comparison: one cube here against a column
+	// major matrix per instance and a 24 vertex mesh of 20 byte vertices
+
+	printf("renderer: %s\n", glGetString(GL_RENDERER));
+	printf("bytes per cube: %d packed, %d as a matrix instance\n",
+		(int)sizeof(uint16_t) * 4, (int)sizeof(float) * 16);
+	printf("%-10s %8s %10s %12s\n", "path", "cubes", "MB", "frame ms");
+
+	for(m = 0; m < 3; m++) {
+
+		dash_cubes_free(&cubes);
+		if(!dash_cubes_create(&cubes, GRID * GRID, modes[m])) {
+			printf("%-10s unsupported\n", mode_names[modes[m]]);
+			continue;
+		}
+		if(!load_program()) {
+			continue;
+		}
+
+		for(c = 0; c < 3; c++) {
+
+			// One draw call per cube stops being useful long before a million
+
+			if(modes[m] == DASH_CUBES_DRAW && counts[c] > 100000) {
+				break;
+			}
+
+			dash_cubes_update(&cubes, records, counts[c]);
+			draw_scene(0.0f);
+			glFinish();
+
+			start = now();
+			for(i = 0; i < BENCH_FRAMES; i++) {
+				draw_scene(i / 60.0f);
+				glutSwapBuffers();
+			}
+			glFinish();
+			t = now() - start;
+
+			printf("%-10s %8d %10.2f %12.3f\n", mode_names[modes[m]], counts[c],
+				counts[c] * sizeof(uint16_t) * 4 / (1024.0 * 1024.0), t * 1000.0 / BENCH_FRAMES);
+
+		}
+
+	}
+
+}
+
+void free_resources() {
+
+	glDeleteProgram(program);
+	dash_cubes_free(&cubes);
+	glDeleteTextures(1, &texture_id);
+	free(records);
+
+}
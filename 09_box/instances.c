@@ -0,0 +1,450 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Instanced cube field. Every cube spins on its own axis, so the model
+	matrices are rebuilt and uploaded each frame. Run with -draw to force
+	one draw call per cube or -pseudo to force uniform array batches, or
+	with -bench to time every path at several cube counts and exit. The
+	benchmark reports CPU time spent building and submitting a frame and
+	wall time per frame including glFinish. With -static the cubes are
+	frozen and baked into a static batch, drawn as frustum culled chunks.
+*/
+
+#define WIDTH 640
+#define HEIGHT 480
+#define GRID 100
+#define BENCH_FRAMES 64
+
+GLfloat cube_vertices[] = {
+	// front
+	-1.0, -1.0,  1.0, 0.0, 0.0,
+	 1.0, -1.0,  1.0, 1.0, 0.0,
+	 1.0,  1.0,  1.0, 1.0, 1.0,
+	-1.0,  1.0,  1.0, 0.0, 1.0,
+	// top
+	-1.0,  1.0,  1.0, 0.0, 0.0,
+	 1.0,  1.0,  1.0, 1.0, 0.0,
+	 1.0,  1.0, -1.0, 1.0, 1.0,
+	-1.0,  1.0, -1.0, 0.0, 1.0,
+	// back
+	 1.0, -1.0, -1.0, 0.0, 0.0,
+	-1.0, -1.0, -1.0, 1.0, 0.0,
+	-1.0,  1.0, -1.0, 1.0, 1.0,
+	 1.0,  1.0, -1.0, 0.0, 1.0,
+	// bottom
+	-1.0, -1.0, -1.0, 0.0, 0.0,
+	 1.0, -1.0, -1.0, 1.0, 0.0,
+	 1.0, -1.0,  1.0, 1.0, 1.0,
+	-1.0, -1.0,  1.0, 0.0, 1.0,
+	// left
+	-1.0, -1.0, -1.0, 0.0, 0.0,
+	-1.0, -1.0,  1.0, 1.0, 0.0,
+	-1.0,  1.0,  1.0, 1.0, 1.0,
+	-1.0,  1.0, -1.0, 0.0, 1.0,
+	// right
+	 1.0, -1.0,  1.0, 0.0, 0.0,
+	 1.0, -1.0, -1.0, 1.0, 0.0,
+	 1.0,  1.0, -1.0, 1.0, 1.0,
+	 1.0,  1.0,  1.0, 0.0, 1.0
+};
+
+uint32_t cube_elements[] = {
+	0,  1,  2,  2,  3,  0,
+	4,  5,  6,  6,  7,  4,
+	8,  9, 10, 10, 11,  8,
+	12, 13, 14, 14, 15, 12,
+	16, 17, 18, 18, 19, 16,
+	20, 21, 22, 22, 23, 20
+};
+
+dash_mesh_data cube_data = {
+	cube_vertices, 24, 5, 3, -1, -1,
+	cube_elements, sizeof(cube_elements) / sizeof(uint32_t)
+};
+
+dash_mesh cube;
+dash_instances instances;
+dash_batch batch;
+dash_batch_item *items;
+int static_field, chunks_drawn;
+GLuint program, texture_id;
+GLint locations[DASH_SEMANTIC_COUNT];
+GLint uniform_view_projection, uniform_mytexture;
+float *models;
+int cube_count = GRID * GRID;
+
+const char *mode_names[] = {
+	"auto",
+	"per draw",
+	"instanced",
+	"pseudo"
+};
+
+int init_resources(int mode);
+int load_program();
+int build_static(int count);
+void update_models(float seconds, int count);
+void draw_scene();
+void on_display();
+void on_idle();
+void run_benchmark();
+void free_resources();
+
+double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	int i, mode, bench;
+
+	mode = DASH_INSTANCE_AUTO;
+	bench = 0;
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-draw") == 0) {
+			mode = DASH_INSTANCE_DRAW;
+		} else if(strcmp(argv[i], "-pseudo") == 0) {
+			mode = DASH_INSTANCE_PSEUDO;
+		} else if(strcmp(argv[i], "-bench") == 0) {
+			bench = 1;
+		} else if(strcmp(argv[i], "-static") == 0) {
+			static_field = 1;
+		}
+	}
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2, 0);
+	glutInitDisplayMode(GLUT_RGBA|GLUT_ALPHA|GLUT_DOUBLE|GLUT_DEPTH);
+	glutInitWindowSize(WIDTH, HEIGHT);
+	glutCreateWindow("Instanced Cubes");
+
+	GLenum glew_status = glewInit();
+	if(glew_status != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	if(!GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error your gpu does not support OpenGL 2.0\n");
+		return 1;
+	}
+
+	if(!init_resources(mode)) {
+		free_resources();
+		return 1;
+	}
+
+	glEnable(GL_DEPTH_TEST);
+
+	if(bench) {
+		run_benchmark();
+		free_resources();
+		return 0;
+	}
+
+	if(static_field) {
+		printf("%d cubes, static batch of %d chunks\n", cube_count, batch.chunk_count);
+	} else {
+		printf("%d cubes, %s\n", cube_count, mode_names[instances.mode]);
+	}
+
+	glutDisplayFunc(on_display);
+	glutIdleFunc(on_idle);
+	glutMainLoop();
+
+	free_resources();
+	return 0;
+
+}
+
+int init_resources(int mode) {
+
+	glClearColor(1.0, 1.0, 1.0, 1.0);
+
+	dash_mesh_upload(&cube_data, &cube);
+
+	models = (float*)malloc(sizeof(float) * 16 * GRID * GRID);
+	items = (dash_batch_item*)malloc(sizeof(dash_batch_item) * GRID * GRID);
+	if(static_field && !build_static(cube_count)) {
+		return 0;
+	}
+	if(!static_field && !dash_instances_create(&instances, &cube_data, GRID * GRID, mode)) {
+		fprintf(stderr, "Instancing mode %s is not supported\n", mode_names[mode]);
+		return 0;
+	}
+
+	texture_id = dash_texture_acquire("texture.png");
+	if(!texture_id) {
+		return 0;
+	}
+
+	return load_program();
+
+}
+
+int load_program() {
+
+	const char *vertex;
+
+	vertex = "shader/vertex_instanced.glsl";
+	if(static_field) {
+		vertex = "shader/vertex.glsl";
+	} else if(instances.mode == DASH_INSTANCE_PSEUDO) {
+		vertex = "shader/vertex_pseudo.glsl";
+	}
+
+	glDeleteProgram(program);
+	program = dash_create_program(vertex, "shader/fragment.glsl");
+	if(!program) {
+		return 0;
+	}
+
+	locations[DASH_POSITION] = glGetAttribLocation(program, "coord3d");
+	locations[DASH_TEXCOORD] = glGetAttribLocation(program, "texcoord");
+	locations[DASH_COLOR] = -1;
+	if(locations[DASH_POSITION] == -1 || (!static_field && !dash_instances_program(&instances, program))) {
+		fprintf(stderr, "Could not bind instanced attributes\n");
+		return 0;
+	}
+
+	// The baked batch is already in world space, its mvp is the view projection
+
+	if(static_field) {
+		dash_batch_layout(&batch, locations);
+	}
+
+	uniform_view_projection = glGetUniformLocation(program, static_field ? "mvp" : "view_projection");
+	uniform_mytexture = glGetUniformLocation(program, "mytexture");
+	if(uniform_view_projection == -1 || uniform_mytexture == -1) {
+		fprintf(stderr, "Could not bind instanced uniforms\n");
+		return 0;
+	}
+
+	return 1;
+
+}
+
+int build_static(int count) {
+
+	int i;
+
+	update_models(0.0f, count);
+	for(i = 0; i < count; i++) {
+		items[i].mesh = &cube_data;
+		memcpy(items[i].model, models + i * 16, sizeof(mat4));
+	}
+
+	dash_batch_free(&batch);
+	return dash_batch_build(items, count, &batch);
+
+}
+
+void update_models(float seconds, int count) {
+
+	int i;
+	float *m, rad;
+	mat4 pos, rot;
+	vec3 t, r;
+
+	for(i = 0; i < count; i++) {
+
+		m = models + i * 16;
+		rad = seconds + i * 0.37f;
+
+		t[0] = (i % GRID - GRID / 2) * 3.0f;
+		t[1] = 0.0f;
+		t[2] = -(i / GRID) * 3.0f;
+		r[0] = rad * 0.5f;
+		r[1] = rad;
+		r[2] = rad * 0.25f;
+
+		mat4_translate(t, pos);
+		mat4_rotate(r, rot);
+		mat4_multiply(pos, rot, m);
+
+	}
+
+	if(!static_field) {
+		dash_instances_update(&instances, models, count);
+	}
+
+}
+
+void draw_scene() {
+
+	mat4 view_projection, projection, view;
+	vec3 eye = { 0.0f, 40.0f, 30.0f };
+	vec3 target = { 0.0f, 0.0f, -GRID * 1.5f };
+	vec3 axis = { 0.0f, 1.0f, 0.0f };
+
+	mat4_perspective(45.0f, 1.0f*WIDTH/HEIGHT, 0.1f, 1000.0f, projection);
+	mat4_look_at(eye, target, axis, view);
+	mat4_multiply(projection, view, view_projection);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	glUniformMatrix4fv(uniform_view_projection, 1, GL_FALSE, view_projection);
+
+	glActiveTexture(GL_TEXTURE0);
+	dash_texture_bind(texture_id);
+	glUniform1i(uniform_mytexture, 0);
+
+	if(static_field) {
+		chunks_drawn = dash_batch_draw(&batch, view_projection);
+		dash_mesh_unbind();
+	} else {
+		dash_instances_draw(&instances, &cube, locations);
+	}
+
+}
+
+void on_display() {
+
+	draw_scene();
+	glutSwapBuffers();
+
+}
+
+void on_idle() {
+
+	if(!static_field) {
+		update_models(glutGet(GLUT_ELAPSED_TIME) / 1000.0f, cube_count);
+	}
+	glutPostRedisplay();
+
+}
+
+void run_benchmark() {
+
+	int i, c, m;
+	double start, submit, t;
+	dash_ring_stats ring_stats;
+	const int counts[] = { 1000, 5000, 10000 };
+	const int modes[] = { DASH_INSTANCE_DRAW, DASH_INSTANCE_PSEUDO, DASH_INSTANCE_HARDWARE };
+
+	printf("renderer: %s\n", glGetString(GL_RENDERER));
+	printf("%-10s %6s %12s %12s\n", "path", "cubes", "submit ms", "frame ms");
+
+	static_field = 0;
+	for(m = 0; m < 3; m++) {
+
+		dash_instances_free(&instances);
+		if(!dash_instances_create(&instances, &cube_data, GRID * GRID, modes[m])) {
+			printf("%-10s unsupported\n", mode_names[modes[m]]);
+			continue;
+		}
+		if(!load_program()) {
+			continue;
+		}
+
+		for(c = 0; c < 3; c++) {
+
+			update_models(0.0f, counts[c]);
+			draw_scene();
+			glFinish();
+
+			submit = 0.0;
+			start = now();
+			for(i = 0; i < BENCH_FRAMES; i++) {
+				t = now();
+				update_models(i / 60.0f, counts[c]);
+				draw_scene();
+				submit += now() - t;
+				glutSwapBuffers();
+			}
+			glFinish();
+			t = now() - start;
+
+			printf("%-10s %6d %12.3f %12.3f\n", mode_names[modes[m]], counts[c],
+				submit * 1000.0 / BENCH_FRAMES, t * 1000.0 / BENCH_FRAMES);
+
+		}
+
+		if(instances.ring != NULL) {
+			dash_ring_get_stats(instances.ring, &ring_stats);
+			printf("%-10s streamed %.1f MB in %ld frames, %ld stalls (%.3f ms)\n", "",
+				ring_stats.bytes_streamed / (1024.0 * 1024.0), ring_stats.frames,
+				ring_stats.stalls, ring_stats.stall_ms);
+		}
+
+	}
+
+	// Static batches are built once, frames only cull and draw chunks
+
+	static_field = 1;
+	if(!load_program()) {
+		return;
+	}
+
+	for(c = 0; c < 3; c++) {
+
+		if(!build_static(counts[c])) {
+			printf("%-10s unsupported\n", "static");
+			return;
+		}
+		dash_batch_layout(&batch, locations);
+		draw_scene();
+		glFinish();
+
+		submit = 0.0;
+		start = now();
+		for(i = 0; i < BENCH_FRAMES; i++) {
+			t = now();
+			draw_scene();
+			submit += now() - t;
+			glutSwapBuffers();
+		}
+		glFinish();
+		t = now() - start;
+
+		printf("%-10s %6d %12.3f %12.3f  %d of %d chunks drawn\n", "static", counts[c],
+			submit * 1000.0 / BENCH_FRAMES, t * 1000.0 / BENCH_FRAMES,
+			chunks_drawn, batch.chunk_count);
+
+	}
+
+}
+
+void free_resources() {
+
+	glDeleteProgram(program);
+	dash_instances_free(&instances);
+	dash_batch_free(&batch);
+	dash_mesh_free(&cube);
+	dash_texture_release(texture_id);
+	free(models);
+	free(items);
+
+}
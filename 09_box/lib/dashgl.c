@@ -21,7 +21,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <GL/glew.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dashgl.h"
 
 /******************************************************************************/
@@ -176,134 +181,789 @@ GLuint dash_create_program(const char *vertex, const char *fragment) {
 
 }
 
+int dash_has_extension(const char *name) {
 
+	const char *list, *found;
+	size_t len;
 
+	list = (const char*)glGetString(GL_EXTENSIONS);
+	if(list == NULL) {
+		return 0;
+	}
 
-GLuint dash_texture_load(const char *filename) {
+	// Match whole tokens so a name is not found inside a longer one
+
+	len = strlen(name);
+	found = strstr(list, name);
+	while(found != NULL) {
+		if((found == list || found[-1] == ' ') && (found[len] == ' ' || found[len] == '\0')) {
+			return 1;
+		}
+		found = strstr(found + len, name);
+	}
+
+	return 0;
+
+}
+
+/******************************************************************************/
+/** Texture Utils                                                            **/
+/******************************************************************************/
+
+static int png_decode(FILE *fp, const char *filename, dash_image *img) {
 
-	FILE *fp;
-	
-	GLuint texture_id;
 	png_structp png_ptr;
-    png_infop info_ptr;
-	int width, height, bit_depth;
-	unsigned char *data;
-	int color_type, num_passes, y, x, i;
-	char header[8];
+	png_infop info_ptr;
+	int y, stride;
 	png_bytep *rows;
 
-	fp = fopen(filename, "rb");
-	if(fp == NULL) {
-		fprintf(stderr, "Could not open %s for reading\n", filename);
-		exit(1);
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if(png_ptr == NULL) {
+		return 0;
 	}
 
-	if(fread(header, 1, 8, fp) <= 0) {
-		fprintf(stderr, "Could not read png header\n");
-		exit(1);
+	info_ptr = png_create_info_struct(png_ptr);
+	if(info_ptr == NULL) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return 0;
 	}
 
-	if (png_sig_cmp(header, 0, 8)) {
-		fprintf(stderr, "%s is not a valid png file\n", filename);
-		exit(1);
-
+	rows = NULL;
+	if(setjmp(png_jmpbuf(png_ptr))) {
+		fprintf(stderr, "%s: png decode error\n", filename);
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(rows);
+		free(img->data);
+		img->data = NULL;
+		return 0;
 	}
 
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-    if (png_ptr == NULL) {
-        fclose(fp);
-        return;
-    }
-
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL) {
-        fclose(fp);
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        return;
-    }
-
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
-        return;
-    }
-
-    png_init_io(png_ptr, fp);
+	png_init_io(png_ptr, fp);
 	png_set_sig_bytes(png_ptr, 8);
 	png_read_info(png_ptr, info_ptr);
 
-	width = png_get_image_width(png_ptr, info_ptr);
-	height = png_get_image_height(png_ptr, info_ptr);
-	
-	color_type = png_get_color_type(png_ptr, info_ptr);
-	bit_depth  = png_get_bit_depth(png_ptr, info_ptr);
-
-	num_passes = png_set_interlace_handling(png_ptr);
-	png_read_update_info(png_ptr, info_ptr);
+	img->width = png_get_image_width(png_ptr, info_ptr);
+	img->height = png_get_image_height(png_ptr, info_ptr);
 
-	switch(color_type) {
-		case 0:
-			printf("grayscale\n");
-			exit(1);
-		break;
+	switch(png_get_color_type(png_ptr, info_ptr)) {
 		case PNG_COLOR_TYPE_RGB:
-			bit_depth = GL_RGB;
-			color_type = 3;
-			data = (unsigned char*)malloc(3 * width * height);
-		break;
-		case 3:
-			printf("pallete look up table\n");
-			exit(1);
-		break;
-		case 4:
-			printf("grayscale with alpha\n");
-			exit(1);
+			img->channels = 3;
 		break;
 		case PNG_COLOR_TYPE_RGBA:
-			bit_depth = GL_RGBA;
-			color_type = 4;
-			data = (unsigned char*)malloc(4 * width * height);
+			img->channels = 4;
 		break;
+		default:
+			fprintf(stderr, "%s: only rgb and rgba png files are supported\n", filename);
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			return 0;
 	}
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
-        return;
-    }
-	
-	rows = (png_bytep*) malloc(sizeof(png_bytep) * height);
-	for (y = 0; y < height; y++) {
-		rows[y] = (png_byte*) malloc(png_get_rowbytes(png_ptr, info_ptr));
+	png_set_strip_16(png_ptr);
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	// Decode straight into the output buffer instead of one malloc per row
+
+	stride = img->width * img->channels;
+	img->data = (unsigned char*)malloc(stride * img->height);
+	rows = (png_bytep*)malloc(sizeof(png_bytep) * img->height);
+	for(y = 0; y < img->height; y++) {
+		rows[y] = img->data + y * stride;
 	}
-	
+
 	png_read_image(png_ptr, rows);
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	free(rows);
+
+	return 1;
+
+}
+
+/*
+	QOI images are read into one buffer and decoded straight into the output
+	pixels, and encoded into one worst case sized buffer that is written with
+	a single fwrite. See https://qoiformat.org/qoi-specification.pdf
+*/
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK 0xc0
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+#define QOI_PIXELS_MAX 400000000u
+#define QOI_HASH(p) ((p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) % 64)
+
+static uint32_t qoi_read32(const unsigned char *b) {
+
+	return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+
+}
+
+static void qoi_write32(unsigned char *b, uint32_t v) {
+
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+
+}
+
+static int qoi_decode(const unsigned char *bytes, size_t size, dash_image *img) {
+
+	int c, run, vg;
+	uint32_t w, h;
+	size_t i, n, pos, end;
+	unsigned char index[64][4];
+	unsigned char px[4] = { 0, 0, 0, 255 };
+	unsigned char b1, b2;
+
+	img->data = NULL;
+	if(size < QOI_HEADER_SIZE + QOI_PADDING_SIZE) {
+		return 0;
+	}
+
+	// The size limit is the one the reference decoder uses, so a corrupt
+	// header cannot ask for gigabytes
+
+	w = qoi_read32(bytes + 4);
+	h = qoi_read32(bytes + 8);
+	img->channels = bytes[12];
+	if(w == 0 || h == 0 || h >= QOI_PIXELS_MAX / w || (img->channels != 3 && img->channels != 4)) {
+		return 0;
+	}
+
+	img->width = w;
+	img->height = h;
+	n = (size_t)w * h;
+	img->data = (unsigned char*)malloc(n * img->channels);
+	if(img->data == NULL) {
+		return 0;
+	}
+	memset(index, 0, sizeof(index));
+
+	pos = QOI_HEADER_SIZE;
+	end = size - QOI_PADDING_SIZE;
+	run = 0;
+
+	for(i = 0; i < n; i++) {
+
+		if(run > 0) {
+			run--;
+		} else if(pos < end) {
+			b1 = bytes[pos++];
+			if(b1 == QOI_OP_RGB) {
+				px[0] = bytes[pos++];
+				px[1] = bytes[pos++];
+				px[2] = bytes[pos++];
+			} else if(b1 == QOI_OP_RGBA) {
+				px[0] = bytes[pos++];
+				px[1] = bytes[pos++];
+				px[2] = bytes[pos++];
+				px[3] = bytes[pos++];
+			} else if((b1 & QOI_MASK) == QOI_OP_INDEX) {
+				memcpy(px, index[b1], 4);
+			} else if((b1 & QOI_MASK) == QOI_OP_DIFF) {
+				px[0] += ((b1 >> 4) & 3) - 2;
+				px[1] += ((b1 >> 2) & 3) - 2;
+				px[2] += (b1 & 3) - 2;
+			} else if((b1 & QOI_MASK) == QOI_OP_LUMA) {
+				b2 = bytes[pos++];
+				vg = (b1 & 0x3f) - 32;
+				px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+				px[1] += vg;
+				px[2] += vg - 8 + (b2 & 0x0f);
+			} else {
+				run = b1 & 0x3f;
+			}
+			memcpy(index[QOI_HASH(px)], px, 4);
+		}
+
+		for(c = 0; c < img->channels; c++) {
+			img->data[i * img->channels + c] = px[c];
+		}
+
+	}
+
+	return 1;
+
+}
+
+static unsigned char *qoi_encode(dash_image *img, size_t *out_size) {
+
+	int c, run;
+	size_t i, n, pos;
+	unsigned char index[64][4];
+	unsigned char px[4] = { 0, 0, 0, 255 };
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	unsigned char *bytes;
+	signed char vr, vg, vb, vg_r, vg_b;
+	int h;
+
+	n = (size_t)img->width * img->height;
+	bytes = (unsigned char*)malloc(QOI_HEADER_SIZE + n * (img->channels + 1) + QOI_PADDING_SIZE);
+
+	memcpy(bytes, "qoif", 4);
+	qoi_write32(bytes + 4, img->width);
+	qoi_write32(bytes + 8, img->height);
+	bytes[12] = img->channels;
+	bytes[13] = 0;
+	pos = QOI_HEADER_SIZE;
+
+	memset(index, 0, sizeof(index));
+	run = 0;
+
+	for(i = 0; i < n; i++) {
+
+		for(c = 0; c < img->channels; c++) {
+			px[c] = img->data[i * img->channels + c];
+		}
+
+		if(memcmp(px, prev, 4) == 0) {
+			run++;
+			if(run == 62 || i == n - 1) {
+				bytes[pos++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+
+		if(run > 0) {
+			bytes[pos++] = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		h = QOI_HASH(px);
+		if(memcmp(index[h], px, 4) == 0) {
+			bytes[pos++] = QOI_OP_INDEX | h;
+		} else {
+			memcpy(index[h], px, 4);
+			if(px[3] == prev[3]) {
+				vr = px[0] - prev[0];
+				vg = px[1] - prev[1];
+				vb = px[2] - prev[2];
+				vg_r = vr - vg;
+				vg_b = vb - vg;
+				if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+					bytes[pos++] = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+				} else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+					bytes[pos++] = QOI_OP_LUMA | (vg + 32);
+					bytes[pos++] = ((vg_r + 8) << 4) | (vg_b + 8);
+				} else {
+					bytes[pos++] = QOI_OP_RGB;
+					bytes[pos++] = px[0];
+					bytes[pos++] = px[1];
+					bytes[pos++] = px[2];
+				}
+			} else {
+				bytes[pos++] = QOI_OP_RGBA;
+				bytes[pos++] = px[0];
+				bytes[pos++] = px[1];
+				bytes[pos++] = px[2];
+				bytes[pos++] = px[3];
+			}
+		}
+
+		memcpy(prev, px, 4);
+
+	}
+
+	memset(bytes + pos, 0, QOI_PADDING_SIZE - 1);
+	pos += QOI_PADDING_SIZE - 1;
+	bytes[pos++] = 1;
+
+	*out_size = pos;
+	return bytes;
+
+}
+
+int dash_image_load(const char *filename, dash_image *img) {
+
+	FILE *fp;
+	long size;
+	int ok;
+	unsigned char header[8];
+	unsigned char *bytes;
+
+	img->width = 0;
+	img->height = 0;
+	img->channels = 0;
+	img->data = NULL;
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL) {
+		fprintf(stderr, "Could not open %s for reading\n", filename);
+		return 0;
+	}
+
+	if(fread(header, 1, 8, fp) != 8) {
+		fprintf(stderr, "%s is not a valid image file\n", filename);
+		fclose(fp);
+		return 0;
+	}
+
+	// The format is picked from the magic bytes, not the file extension
+
+	if(memcmp(header, "qoif", 4) == 0) {
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		bytes = (unsigned char*)malloc(size);
+		ok = fread(bytes, size, 1, fp) == 1 && qoi_decode(bytes, size, img);
+		if(!ok) {
+			fprintf(stderr, "%s is not a valid qoi file\n", filename);
+			free(img->data);
+			img->data = NULL;
+		}
+		free(bytes);
+	} else if(png_sig_cmp(header, 0, 8) == 0) {
+		ok = png_decode(fp, filename, img);
+	} else {
+		fprintf(stderr, "%s is not a valid png or qoi file\n", filename);
+		ok = 0;
+	}
+
+	fclose(fp);
+	return ok;
+
+}
+
+void dash_image_free(dash_image *img) {
+
+	free(img->data);
+	img->data = NULL;
+
+}
+
+static int png_encode(FILE *fp, dash_image *img) {
+
+	int y;
+	png_structp png_ptr;
+	png_infop info_ptr;
+
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if(png_ptr == NULL) {
+		return 0;
+	}
+
+	info_ptr = png_create_info_struct(png_ptr);
+	if(info_ptr == NULL || setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return 0;
+	}
+
+	png_init_io(png_ptr, fp);
+	png_set_IHDR(png_ptr, info_ptr, img->width, img->height, 8,
+		img->channels == 4 ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+
+	for(y = 0; y < img->height; y++) {
+		png_write_row(png_ptr, img->data + y * img->width * img->channels);
+	}
+
+	png_write_end(png_ptr, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+
+	return 1;
+
+}
+
+int dash_image_save(const char *filename, dash_image *img) {
+
+	FILE *fp;
+	int ok;
+	size_t len, size;
+	unsigned char *bytes;
+
+	fp = fopen(filename, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Could not open %s for writing\n", filename);
+		return 0;
+	}
+
+	// Files named .png are written as png, anything else as qoi
+
+	len = strlen(filename);
+	if(len > 4 && strcmp(filename + len - 4, ".png") == 0) {
+		ok = png_encode(fp, img);
+	} else {
+		bytes = qoi_encode(img, &size);
+		ok = fwrite(bytes, size, 1, fp) == 1;
+		free(bytes);
+	}
+
 	fclose(fp);
+	if(!ok) {
+		fprintf(stderr, "Could not write %s\n", filename);
+	}
+
+	return ok;
+
+}
+
+typedef struct {
+	char *filename;
+	dash_image img;
+} capture_job;
+
+static void *capture_write(void *arg) {
+
+	capture_job *job = (capture_job*)arg;
+
+	dash_image_save(job->filename, &job->img);
+	dash_image_free(&job->img);
+	free(job->filename);
+	free(job);
+
+	return NULL;
+
+}
+
+int dash_capture(const char *filename, int threaded) {
+
+	int y, ok, stride;
+	GLint viewport[4];
+	pthread_t thread;
+	capture_job *job;
+	unsigned char *row;
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	job = (capture_job*)malloc(sizeof(capture_job));
+	job->filename = strdup(filename);
+	job->img.width = viewport[2];
+	job->img.height = viewport[3];
+	job->img.channels = 4;
+	job->img.data = (unsigned char*)malloc(viewport[2] * viewport[3] * 4);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3],
+		GL_RGBA, GL_UNSIGNED_BYTE, job->img.data);
+
+	// GL returns the bottom row first, images are stored top row first
+
+	stride = viewport[2] * 4;
+	row = (unsigned char*)malloc(stride);
+	for(y = 0; y < viewport[3] / 2; y++) {
+		memcpy(row, job->img.data + y * stride, stride);
+		memcpy(job->img.data + y * stride, job->img.data + (viewport[3] - 1 - y) * stride, stride);
+		memcpy(job->img.data + (viewport[3] - 1 - y) * stride, row, stride);
+	}
+	free(row);
+
+	if(threaded && pthread_create(&thread, NULL, capture_write, job) == 0) {
+		pthread_detach(thread);
+		return 1;
+	}
+
+	ok = dash_image_save(job->filename, &job->img);
+	dash_image_free(&job->img);
+	free(job->filename);
+	free(job);
+
+	return ok;
+
+}
+
+/******************************************************************************/
+/** Texture Formats                                                          **/
+/******************************************************************************/
+
+/*
+	Images are analyzed before upload and opaque images always drop alpha.
+	DASH_TEXTURE_REDUCE also turns gray images into luminance and white images
+	with alpha into alpha only; those sample as (0, 0, 0, a) or need a shader
+	that expects them, so they are opt-in. DASH_TEXTURE_PACK_16 additionally
+	allows RGB565, RGBA5551 (binary alpha) and RGBA4444. Every output row is
+	padded to a multiple of four bytes so the default GL_UNPACK_ALIGNMENT
+	always holds.
+*/
+
+static int row_stride(int width, int bytes) {
+
+	return (width * bytes + 3) & ~3;
+
+}
+
+static void analyze_image(dash_image *img, int *opaque, int *binary_alpha, int *gray, int *white) {
+
+	int i, n;
+	unsigned char *p;
+
+	*opaque = 1;
+	*binary_alpha = 1;
+	*gray = 1;
+	*white = 1;
+
+	n = img->width * img->height;
+	for(i = 0; i < n; i++) {
+		p = img->data + i * img->channels;
+		if(p[0] != p[1] || p[0] != p[2]) {
+			*gray = 0;
+			*white = 0;
+		} else if(p[0] != 255) {
+			*white = 0;
+		}
+		if(img->channels == 4 && p[3] != 255) {
+			*opaque = 0;
+			if(p[3] != 0) {
+				*binary_alpha = 0;
+			}
+		}
+	}
+
+	if(img->channels == 3) {
+		*white = 0;
+	}
+
+}
+
+static void premultiply_rgba(unsigned char *data, int count) {
+
+	int i, c, t;
 
 	i = 0;
-	for(y = 0; y < height; y++) {
-		memcpy((void*)&data[y*width*color_type], (void*)rows[y], width * color_type);
-		png_free(png_ptr, rows[y]);
+	#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+	for(; i + 4 <= count; i += 4) {
+		__m128i px = _mm_loadu_si128((__m128i*)(data + i * 4));
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+		__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+		__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), bias);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), bias);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		lo = _mm_packus_epi16(lo, hi);
+		lo = _mm_or_si128(_mm_andnot_si128(alpha_mask, lo), _mm_and_si128(alpha_mask, px));
+		_mm_storeu_si128((__m128i*)(data + i * 4), lo);
 	}
-	
-	png_free(png_ptr, rows);
-	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	#endif
+
+	for(; i < count; i++) {
+		for(c = 0; c < 3; c++) {
+			t = data[i * 4 + c] * data[i * 4 + 3] + 128;
+			data[i * 4 + c] = (t + (t >> 8)) >> 8;
+		}
+	}
+
+}
+
+static uint16_t pack_pixel(const unsigned char *p, GLenum type) {
+
+	switch(type) {
+		case GL_UNSIGNED_SHORT_5_6_5:
+			return ((p[0] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[2] >> 3);
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+			return ((p[0] >> 3) << 11) | ((p[1] >> 3) << 6) | ((p[2] >> 3) << 1) | (p[3] >> 7);
+		default:
+			return ((p[0] >> 4) << 12) | ((p[1] >> 4) << 8) | ((p[2] >> 4) << 4) | (p[3] >> 4);
+	}
+
+}
+
+#ifdef __SSE2__
+static __m128i pack_sse2(__m128i px, GLenum type) {
+
+	__m128i v;
+	const __m128i m1 = _mm_set1_epi32(0x01);
+	const __m128i m4 = _mm_set1_epi32(0x0f);
+	const __m128i m5 = _mm_set1_epi32(0x1f);
+	const __m128i m6 = _mm_set1_epi32(0x3f);
+
+	switch(type) {
+		case GL_UNSIGNED_SHORT_5_6_5:
+			v = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 3), m5), 11);
+			v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 10), m6), 5));
+			v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(px, 19), m5));
+		break;
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+			v = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 3), m5), 11);
+			v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 11), m5), 6));
+			v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 19), m5), 1));
+			v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(px, 31), m1));
+		break;
+		default:
+			v = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 4), m4), 12);
+			v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 12), m4), 8));
+			v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 20), m4), 4));
+			v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(px, 28), m4));
+		break;
+	}
+
+	// Sign extend the low halves so the saturating pack keeps the bits as is
+
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+
+}
+#endif
+
+static void pack_row(const unsigned char *src, int channels, uint16_t *dst, int width, GLenum type) {
+
+	int x;
+	unsigned char p[4];
+
+	x = 0;
+	#ifdef __SSE2__
+	if(channels == 4) {
+		for(; x + 8 <= width; x += 8) {
+			__m128i a = pack_sse2(_mm_loadu_si128((__m128i*)(src + x * 4)), type);
+			__m128i b = pack_sse2(_mm_loadu_si128((__m128i*)(src + x * 4 + 16)), type);
+			_mm_storeu_si128((__m128i*)(dst + x), _mm_packs_epi32(a, b));
+		}
+	}
+	#endif
+
+	for(; x < width; x++) {
+		p[0] = src[x * channels];
+		p[1] = src[x * channels + 1];
+		p[2] = src[x * channels + 2];
+		p[3] = channels == 4 ? src[x * channels + 3] : 255;
+		dst[x] = pack_pixel(p, type);
+	}
+
+}
+
+int dash_image_convert(dash_image *img, int flags, dash_texture_data *out) {
+
+	int x, y, bytes, opaque, binary_alpha, gray, white;
+	unsigned char *src, *dst;
 
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D,
-        0,
-        bit_depth,
-        width,
-        height,
-        0,
-        bit_depth,
-        GL_UNSIGNED_BYTE,
-        data
-    );
-	free(data);
+	analyze_image(img, &opaque, &binary_alpha, &gray, &white);
+
+	if(img->channels == 4 && !opaque && (flags & DASH_TEXTURE_PREMULTIPLY)) {
+		premultiply_rgba(img->data, img->width * img->height);
+		white = 0;
+	}
+
+	if(!(flags & DASH_TEXTURE_REDUCE)) {
+		gray = 0;
+		white = 0;
+	}
+
+	out->type = GL_UNSIGNED_BYTE;
+	if(white && !opaque) {
+		out->format = GL_ALPHA;
+		bytes = 1;
+	} else if(gray) {
+		out->format = opaque ? GL_LUMINANCE : GL_LUMINANCE_ALPHA;
+		bytes = opaque ? 1 : 2;
+	} else if(flags & DASH_TEXTURE_PACK_16) {
+		out->format = opaque ? GL_RGB : GL_RGBA;
+		out->type = opaque ? GL_UNSIGNED_SHORT_5_6_5 :
+			(binary_alpha ? GL_UNSIGNED_SHORT_5_5_5_1 : GL_UNSIGNED_SHORT_4_4_4_4);
+		bytes = 2;
+	} else {
+		out->format = opaque ? GL_RGB : GL_RGBA;
+		bytes = opaque ? 3 : 4;
+	}
+
+	out->width = img->width;
+	out->height = img->height;
+	out->stride = row_stride(img->width, bytes);
+	out->data = (unsigned char*)malloc(out->stride * img->height);
+
+	for(y = 0; y < img->height; y++) {
+
+		src = img->data + y * img->width * img->channels;
+		dst = out->data + y * out->stride;
+
+		if(out->type != GL_UNSIGNED_BYTE) {
+			pack_row(src, img->channels, (uint16_t*)dst, img->width, out->type);
+		} else if(bytes == img->channels) {
+			memcpy(dst, src, img->width * bytes);
+		} else if(out->format == GL_ALPHA) {
+			for(x = 0; x < img->width; x++) {
+				dst[x] = src[x * 4 + 3];
+			}
+		} else {
+			// Keep channel 0 for luminance, channel 3 for its alpha
+
+			for(x = 0; x < img->width * bytes; x++) {
+				dst[x] = src[(x / bytes) * img->channels + (bytes == 2 ? (x & 1) * 3 : (x % bytes))];
+			}
+		}
+
+		memset(dst + img->width * bytes, 0, out->stride - img->width * bytes);
+
+	}
+
+	return 1;
+
+}
+
+GLuint dash_texture_create_data(dash_texture_data *data) {
+
+	GLuint texture_id;
+
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D,
+		0,
+		data->format,
+		data->width,
+		data->height,
+		0,
+		data->format,
+		data->type,
+		data->data
+	);
+
+	return texture_id;
+
+}
+
+GLuint dash_texture_create(dash_image *img) {
+
+	GLuint texture_id;
+	dash_texture_data data;
+
+	dash_image_convert(img, 0, &data);
+	texture_id = dash_texture_create_data(&data);
+	free(data.data);
+
+	return texture_id;
+
+}
+
+GLuint dash_texture_load_options(const char *filename, int flags) {
+
+	dash_image img;
+	dash_texture_data data;
+	GLuint texture_id;
+
+	if(!dash_image_load(filename, &img)) {
+		return 0;
+	}
+
+	dash_image_convert(&img, flags, &data);
+	texture_id = dash_texture_create_data(&data);
+	free(data.data);
+	dash_image_free(&img);
+
+	return texture_id;
+
+}
+
+GLuint dash_texture_load(const char *filename) {
+
+	dash_image img;
+	GLuint texture_id;
+
+	if(!dash_image_load(filename, &img)) {
+		exit(1);
+	}
+
+	texture_id = dash_texture_create(&img);
+	dash_image_free(&img);
 
 	return texture_id;
 
@@ -553,6 +1213,47 @@ void mat4_perspective(float y_fov, float aspect, float n, float f, mat4 m) {
 
 }
 
+void mat4_frustum_planes(mat4 m, float *planes) {
+
+	int k;
+
+	// Planes from the rows of the projection (Gribb and Hartmann), left,
+	// right, bottom, top, near and far as (a, b, c, d) with inward normals
+
+	for(k = 0; k < 3; k++) {
+		planes[k * 8 + 0] = m[M_30] + m[k];
+		planes[k * 8 + 1] = m[M_31] + m[4 + k];
+		planes[k * 8 + 2] = m[M_32] + m[8 + k];
+		planes[k * 8 + 3] = m[M_33] + m[12 + k];
+		planes[k * 8 + 4] = m[M_30] - m[k];
+		planes[k * 8 + 5] = m[M_31] - m[4 + k];
+		planes[k * 8 + 6] = m[M_32] - m[8 + k];
+		planes[k * 8 + 7] = m[M_33] - m[12 + k];
+	}
+
+}
+
+int mat4_frustum_box(float *planes, vec3 min, vec3 max) {
+
+	int k;
+	float *p;
+
+	// Only the box corner furthest along each normal needs testing
+
+	for(k = 0; k < 6; k++) {
+		p = planes + k * 4;
+		if(p[0] * (p[0] > 0.0f ? max[0] : min[0])
+			+ p[1] * (p[1] > 0.0f ? max[1] : min[1])
+			+ p[2] * (p[2] > 0.0f ? max[2] : min[2])
+			+ p[3] < 0.0f) {
+			return 0;
+		}
+	}
+
+	return 1;
+
+}
+
 /******************************************************************************/
 /** End Program	                                                             **/
 /******************************************************************************/
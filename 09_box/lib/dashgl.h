@@ -19,12 +19,8 @@
 #ifndef DASHGL_UTILS
 #define DASHGL_UTILS
 
-	/**********************************************************************/
-	/** Typedef                                                          **/	
-	/**********************************************************************/
-
-	typedef float mat4[16];
-	typedef float vec3[3];
+#include <stddef.h>
+#include <stdint.h>
 
 	/**********************************************************************/
 	/** Constants                                                        **/	
@@ -47,6 +43,261 @@
 	#define M_23 14
 	#define M_33 15
 
+	#define DASH_TEXTURE_PREMULTIPLY 1
+	#define DASH_TEXTURE_PACK_16 2
+	#define DASH_TEXTURE_REDUCE 4
+
+	#define DASH_POSITION 0
+	#define DASH_TEXCOORD 1
+	#define DASH_COLOR 2
+	#define DASH_SEMANTIC_COUNT 3
+
+	#define DASH_MESH_COMPRESS 1
+	#define DASH_MESH_OPTIMIZE 2
+	#define DASH_VERTEX_CACHE_SIZE 16
+	#define DASH_LOD_MAX 8
+	#define DASH_INSTANCE_AUTO 0
+	#define DASH_INSTANCE_DRAW 1
+	#define DASH_INSTANCE_HARDWARE 2
+	#define DASH_INSTANCE_PSEUDO 3
+	#define DASH_PSEUDO_BATCH 24
+	#define DASH_CUBES_AUTO 0
+	#define DASH_CUBES_DRAW 1
+	#define DASH_CUBES_INSTANCED 2
+	#define DASH_CUBES_PULL 3
+	#define DASH_CUBES_UNIT 1
+	#define DASH_BATCH_CHUNK_VERTICES 16384
+	#define DASH_CHUNK_SIZE 32
+	#define DASH_CHUNK_VOXELS (DASH_CHUNK_SIZE * DASH_CHUNK_SIZE * DASH_CHUNK_SIZE)
+	#define DASH_VOXEL_QUAD_RUN 16384
+	#define DASH_REGION_SIZE 16
+	#define DASH_STREAM_UPLOADS 8
+
+	/**********************************************************************/
+	/** Typedef                                                          **/	
+	/**********************************************************************/
+
+	typedef float mat4[16];
+	typedef float vec3[3];
+
+	typedef struct {
+		int width;
+		int height;
+		int channels;
+		unsigned char *data;
+	} dash_image;
+
+	typedef struct {
+		GLenum format;
+		GLenum type;
+		int width;
+		int height;
+		int stride;
+		unsigned char *data;
+	} dash_texture_data;
+
+	typedef struct {
+		double seconds;
+		double megapixels_per_second;
+		double psnr;
+	} dash_compress_stats;
+
+	typedef struct {
+		float u0;
+		float v0;
+		float u1;
+		float v1;
+	} dash_uv_rect;
+
+	typedef struct {
+		GLuint texture_id;
+		int width;
+		int height;
+		int count;
+		dash_uv_rect *rects;
+	} dash_atlas;
+
+	typedef struct {
+		long frames_shown;
+		long frames_dropped;
+		long frames_late;
+		double avg_latency_ms;
+		double max_latency_ms;
+	} dash_stream_stats;
+
+	typedef struct dash_stream dash_stream;
+
+	typedef struct {
+		uint64_t bytes_streamed;
+		long frames;
+		long stalls;
+		long overflows;
+		double stall_ms;
+	} dash_ring_stats;
+
+	typedef struct dash_ring dash_ring;
+
+	typedef struct {
+		int meshes;
+		size_t vertices_used;
+		size_t indices_used;
+		size_t largest_free_vertices;
+		size_t largest_free_indices;
+		long binds;
+		long draw_calls;
+		long draws;
+	} dash_pool_stats;
+
+	typedef struct dash_pool dash_pool;
+
+	typedef struct {
+		int stride;
+		int position;
+		int texcoord;
+		int color;
+		int color_size;
+	} dash_vertex_source;
+
+	typedef struct {
+		GLint size;
+		GLenum type;
+		GLboolean normalized;
+		int offset;
+	} dash_vertex_attrib;
+
+	typedef struct {
+		int stride;
+		dash_vertex_attrib attribs[DASH_SEMANTIC_COUNT];
+		float scale[3];
+		float offset[3];
+	} dash_vertex_format;
+
+	typedef struct {
+		float *vertices;
+		size_t vertex_count;
+		int stride;
+		int texcoord;
+		int normal;
+		int color;
+		uint32_t *indices;
+		size_t index_count;
+	} dash_mesh_data;
+
+	typedef struct {
+		float acmr;
+		float atvr;
+	} dash_cache_stats;
+
+	typedef struct {
+		GLsizei index_count;
+		size_t index_offset;
+		size_t vertex_offset;
+		GLuint vao;
+	} dash_submesh;
+
+	typedef struct {
+		GLuint vbo;
+		GLuint ibo;
+		GLenum index_type;
+		GLsizei index_count;
+		GLsizei vertex_count;
+		int stride;
+		int texcoord;
+		int normal;
+		int color;
+		dash_submesh *submeshes;
+		int submesh_count;
+		GLint locations[DASH_SEMANTIC_COUNT];
+	} dash_mesh;
+
+	typedef struct {
+		size_t index_offset;
+		size_t index_count;
+		float error;
+	} dash_lod;
+
+	typedef struct {
+		GLuint ibo;
+		int count;
+		dash_lod levels[DASH_LOD_MAX];
+		uint32_t *indices;
+		size_t index_count;
+	} dash_lod_chain;
+
+	typedef struct {
+		int mode;
+		int capacity;
+		int count;
+		dash_ring *ring;
+		size_t offset;
+		float *models;
+		GLint model_location;
+		GLint instance_location;
+		int batch_size;
+		dash_mesh batch;
+	} dash_instances;
+
+	typedef struct {
+		uint16_t x;
+		uint16_t y;
+		uint16_t z;
+		uint8_t size;
+		uint8_t layer;
+	} dash_cube;
+
+	typedef struct {
+		int mode;
+		int capacity;
+		int count;
+		uint16_t *packed;
+		GLuint buffer;
+		GLuint texture;
+		GLuint corners;
+		dash_mesh cube;
+		GLint locations[DASH_SEMANTIC_COUNT];
+		GLint cube_location;
+		GLint sampler_location;
+	} dash_cubes;
+
+	typedef struct {
+		const dash_mesh_data *mesh;
+		mat4 model;
+	} dash_batch_item;
+
+	typedef struct {
+		dash_mesh mesh;
+		float min[3];
+		float max[3];
+	} dash_batch_chunk;
+
+	typedef struct {
+		dash_batch_chunk *chunks;
+		int chunk_count;
+	} dash_batch;
+
+	typedef struct {
+		long quads;
+		long chunks_meshed;
+		double mesh_ms;
+		size_t storage_bytes;
+		int uniform_chunks;
+		int run_chunks;
+	} dash_voxel_stats;
+
+	typedef struct dash_voxel_world dash_voxel_world;
+
+	typedef struct {
+		int resident;
+		int queued;
+		long quads;
+		long loaded;
+		long evicted;
+		size_t bytes;
+		double update_ms;
+	} dash_voxel_stream_stats;
+
+	typedef struct dash_voxel_stream dash_voxel_stream;
+
 	/**********************************************************************/
 	/** Shader Utilities                                                 **/	
 	/**********************************************************************/
@@ -54,7 +305,209 @@
 	GLuint dash_create_shader(const char *filename, GLenum type);
 	void dash_print_log(GLuint object);
 	GLuint dash_create_program(const char *vertex, const char *fragment);
+	int dash_has_extension(const char *name);
+
+	/**********************************************************************/
+	/** Texture Utilities                                                **/	
+	/**********************************************************************/
+
+	int dash_image_load(const char *filename, dash_image *img);
+	void dash_image_free(dash_image *img);
+	int dash_image_save(const char *filename, dash_image *img);
+	int dash_capture(const char *filename, int threaded);
+	int dash_image_convert(dash_image *img, int flags, dash_texture_data *out);
+	GLuint dash_texture_create_data(dash_texture_data *data);
+	GLuint dash_texture_create(dash_image *img);
 	GLuint dash_texture_load(const char *filename);
+	GLuint dash_texture_load_options(const char *filename, int flags);
+
+	/**********************************************************************/
+	/** Texture Cache                                                    **/	
+	/**********************************************************************/
+
+	GLuint dash_texture_acquire(const char *filename);
+	void dash_texture_release(GLuint texture_id);
+	void dash_texture_bind(GLuint texture_id);
+	void dash_texture_set_budget(size_t bytes);
+	size_t dash_texture_resident_bytes();
+	void dash_texture_cache_clear();
+
+	/**********************************************************************/
+	/** Baked Textures                                                   **/	
+	/**********************************************************************/
+
+	int dash_texture_bake(const char *src, const char *dst, GLenum format, dash_compress_stats *stats);
+	GLuint dash_texture_load_baked(const char *filename);
+
+	/**********************************************************************/
+	/** Texture Compression                                              **/	
+	/**********************************************************************/
+
+	size_t dash_compressed_size(GLenum format, int width, int height);
+	int dash_image_compress(dash_image *img, GLenum format, unsigned char *out, dash_compress_stats *stats);
+	GLenum dash_compressed_format(int channels);
+	int dash_compressed_supported(GLenum format);
+	GLuint dash_texture_load_compressed(const char *filename);
+
+	/**********************************************************************/
+	/** Texture Atlas                                                    **/	
+	/**********************************************************************/
+
+	int dash_atlas_build(const char **filenames, int count, int max_size, int padding, dash_atlas *atlas);
+	void dash_atlas_remap(dash_atlas *atlas, int index, float *vertices, int vertex_count, int stride, int uv_offset);
+	void dash_atlas_free(dash_atlas *atlas);
+
+	/**********************************************************************/
+	/** Texture Arrays                                                   **/	
+	/**********************************************************************/
+
+	GLuint dash_texture_array_load(const char **filenames, int count);
+
+	/**********************************************************************/
+	/** Texture Streams                                                  **/	
+	/**********************************************************************/
+
+	dash_stream *dash_stream_open(const char *pattern, int frame_count, float fps, int ring_size);
+	GLuint dash_stream_texture(dash_stream *s);
+	void dash_stream_update(dash_stream *s, double seconds);
+	void dash_stream_get_stats(dash_stream *s, dash_stream_stats *stats);
+	void dash_stream_close(dash_stream *s);
+
+	/**********************************************************************/
+	/** Vertex Formats                                                   **/	
+	/**********************************************************************/
+
+	unsigned char *dash_vertex_encode(const float *src, int count, dash_vertex_source *in, dash_vertex_format *fmt);
+	void dash_vertex_format_matrix(dash_vertex_format *fmt, mat4 m);
+	void dash_vertex_format_enable(dash_vertex_format *fmt, GLint *locations);
+	void dash_vertex_format_disable(dash_vertex_format *fmt, GLint *locations);
+
+	/**********************************************************************/
+	/** Mesh Loading                                                     **/	
+	/**********************************************************************/
+
+	int dash_mesh_load(const char *filename, dash_mesh_data *mesh);
+	void dash_mesh_data_free(dash_mesh_data *mesh);
+
+	/**********************************************************************/
+	/** Mesh Optimization                                                **/	
+	/**********************************************************************/
+
+	void dash_mesh_analyze(const uint32_t *indices, size_t index_count, size_t vertex_count, int cache_size, dash_cache_stats *stats);
+	void dash_mesh_optimize(dash_mesh_data *mesh, int cache_size);
+
+	/**********************************************************************/
+	/** Mesh Buffers                                                     **/	
+	/**********************************************************************/
+
+	GLenum dash_index_type(size_t vertex_count);
+	int dash_mesh_upload(const dash_mesh_data *data, dash_mesh *mesh);
+	void dash_mesh_draw(dash_mesh *mesh, GLint *locations);
+	void dash_mesh_layout(dash_mesh *mesh, GLint *locations);
+	void dash_mesh_bind(dash_mesh *mesh);
+	void dash_mesh_render(dash_mesh *mesh);
+	void dash_mesh_unbind();
+	void dash_mesh_free(dash_mesh *mesh);
+
+	/**********************************************************************/
+	/** Mesh LOD                                                         **/	
+	/**********************************************************************/
+
+	size_t dash_mesh_simplify(const dash_mesh_data *mesh, const uint32_t *indices, size_t index_count,
+		size_t target_index_count, float *error, uint32_t *out);
+	void dash_lod_build(const dash_mesh_data *mesh, int count, float ratio, dash_lod_chain *chain);
+	int dash_lod_upload(dash_lod_chain *chain, dash_mesh *mesh);
+	int dash_lod_select(dash_lod_chain *chain, mat4 projection, float viewport_height, float distance, float threshold);
+	void dash_lod_draw(dash_mesh *mesh, dash_lod_chain *chain, int level, GLint *locations);
+	void dash_lod_free(dash_lod_chain *chain);
+
+	/**********************************************************************/
+	/** Mesh Instancing                                                  **/	
+	/**********************************************************************/
+
+	int dash_instances_create(dash_instances *inst, const dash_mesh_data *data, int capacity, int mode);
+	int dash_instances_program(dash_instances *inst, GLuint program);
+	void dash_instances_update(dash_instances *inst, const float *models, int count);
+	void dash_instances_draw(dash_instances *inst, dash_mesh *mesh, GLint *locations);
+	void dash_instances_free(dash_instances *inst);
+
+	/**********************************************************************/
+	/** Cube Pulling                                                     **/	
+	/**********************************************************************/
+
+	int dash_cubes_create(dash_cubes *c, int capacity, int mode);
+	int dash_cubes_program(dash_cubes *c, GLuint program);
+	void dash_cubes_update(dash_cubes *c, const dash_cube *cubes, int count);
+	void dash_cubes_draw(dash_cubes *c);
+	void dash_cubes_free(dash_cubes *c);
+
+	/**********************************************************************/
+	/** Static Batching                                                  **/	
+	/**********************************************************************/
+
+	int dash_batch_build(const dash_batch_item *items, int count, dash_batch *batch);
+	void dash_batch_layout(dash_batch *batch, GLint *locations);
+	int dash_batch_draw(dash_batch *batch, mat4 view_projection);
+	void dash_batch_free(dash_batch *batch);
+
+	/**********************************************************************/
+	/** Mesh Cache                                                       **/	
+	/**********************************************************************/
+
+	int dash_mesh_write(const char *src, dash_mesh_data *mesh, const char *dst, int flags);
+	int dash_mesh_bake(const char *src, const char *dst, int flags);
+	int dash_mesh_load_baked(const char *filename, dash_mesh *mesh);
+	int dash_mesh_load_cached(const char *filename, dash_mesh *mesh);
+
+	/**********************************************************************/
+	/** Buffer Streaming                                                 **/	
+	/**********************************************************************/
+
+	dash_ring *dash_ring_create(GLenum target, size_t frame_bytes, int frames);
+	GLuint dash_ring_buffer(dash_ring *r);
+	void dash_ring_begin_frame(dash_ring *r);
+	void *dash_ring_alloc(dash_ring *r, size_t size, size_t align, size_t *offset);
+	void dash_ring_commit(dash_ring *r);
+	void dash_ring_get_stats(dash_ring *r, dash_ring_stats *stats);
+	void dash_ring_destroy(dash_ring *r);
+
+	/**********************************************************************/
+	/** Geometry Pool                                                    **/	
+	/**********************************************************************/
+
+	dash_pool *dash_pool_create(const dash_mesh_data *layout, size_t vertex_capacity, size_t index_capacity, int max_draws);
+	void dash_pool_layout(dash_pool *p, GLint *locations);
+	int dash_pool_add(dash_pool *p, const dash_mesh_data *data);
+	void dash_pool_remove(dash_pool *p, int handle);
+	void dash_pool_draw(dash_pool *p, const int *handles, int count);
+	void dash_pool_get_stats(dash_pool *p, dash_pool_stats *stats);
+	void dash_pool_destroy(dash_pool *p);
+
+	/**********************************************************************/
+	/** Voxel Meshing                                                    **/	
+	/**********************************************************************/
+
+	dash_voxel_world *dash_voxel_create(int chunks_x, int chunks_y, int chunks_z);
+	uint8_t dash_voxel_get(dash_voxel_world *w, int x, int y, int z);
+	void dash_voxel_set(dash_voxel_world *w, int x, int y, int z, uint8_t type);
+	void dash_voxel_read_chunk(dash_voxel_world *w, int cx, int cy, int cz, uint8_t *voxels);
+	void dash_voxel_write_chunk(dash_voxel_world *w, int cx, int cy, int cz, const uint8_t *voxels);
+	int dash_voxel_mesh(dash_voxel_world *w);
+	int dash_voxel_draw(dash_voxel_world *w, mat4 view_projection, GLint *locations, GLint layer_location);
+	void dash_voxel_get_stats(dash_voxel_world *w, dash_voxel_stats *stats);
+	void dash_voxel_destroy(dash_voxel_world *w);
+
+	/**********************************************************************/
+	/** Voxel Streaming                                                  **/	
+	/**********************************************************************/
+
+	int dash_region_write_chunk(const char *dir, int cx, int cy, int cz, const uint8_t *voxels);
+	int dash_region_read_chunk(const char *dir, int cx, int cy, int cz, uint8_t *voxels);
+	dash_voxel_stream *dash_voxel_stream_create(const char *dir, int chunks_y, int radius, size_t budget);
+	void dash_voxel_stream_update(dash_voxel_stream *s, vec3 eye);
+	int dash_voxel_stream_draw(dash_voxel_stream *s, mat4 view_projection, GLint *locations, GLint layer_location);
+	void dash_voxel_stream_get_stats(dash_voxel_stream *s, dash_voxel_stream_stats *stats);
+	void dash_voxel_stream_destroy(dash_voxel_stream *s);
 	
 	/**********************************************************************/
 	/** Vector3 Utilities                                                **/	
@@ -78,5 +531,7 @@
 	void mat4_rotate(vec3 r, mat4 m);
 	void mat4_look_at(vec3 eye, vec3 center, vec3 up, mat4 m);
 	void mat4_perspective(float y_fov, float aspect, float n, float f, mat4 m);
+	void mat4_frustum_planes(mat4 m, float *planes);
+	int mat4_frustum_box(float *planes, vec3 min, vec3 max);
 
 #endif
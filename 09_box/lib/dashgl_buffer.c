@@ -0,0 +1,652 @@
+/*
+    This file is part of Dash Graphics Library
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <GL/glew.h>
+#include "dashgl.h"
+
+/******************************************************************************/
+/** Buffer Streaming                                                         **/
+/******************************************************************************/
+
+/*
+	A ring of per frame regions for data rewritten every frame. With
+	ARB_buffer_storage and ARB_sync the whole ring is one persistently
+	mapped buffer: allocations hand out pointers straight into it, and each
+	region is fenced when the next frame begins, after the draws that read
+	it, so it is not written again until the GPU is done with it. Waiting on
+	that fence is counted as a stall. Without persistent mapping the
+	allocations go to a CPU copy of one region, the buffer is orphaned at
+	the start of every frame and dash_ring_commit pushes what was written
+	with glBufferSubData. There is no fence to wait on in that mode, so it
+	never reports stalls.
+*/
+
+struct dash_ring {
+	GLenum target;
+	GLuint buffer;
+	size_t region_bytes;
+	int region_count;
+	int region;
+	size_t head;
+	size_t committed;
+	int persistent;
+	unsigned char *mapping;
+	unsigned char *shadow;
+	GLsync *fences;
+	dash_ring_stats stats;
+};
+
+static double ring_now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+dash_ring *dash_ring_create(GLenum target, size_t frame_bytes, int frames) {
+
+	dash_ring *r;
+	GLbitfield flags;
+
+	r = (dash_ring*)calloc(1, sizeof(dash_ring));
+	r->target = target;
+	r->region_bytes = frame_bytes;
+	r->region_count = frames < 1 ? 1 : frames;
+	r->fences = (GLsync*)calloc(r->region_count, sizeof(GLsync));
+
+	glGenBuffers(1, &r->buffer);
+	glBindBuffer(target, r->buffer);
+
+	#ifndef GL_ES_VERSION_2_0
+	r->persistent = GLEW_ARB_buffer_storage && GLEW_ARB_sync;
+	if(r->persistent) {
+		flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, r->region_bytes * r->region_count, NULL, flags);
+		r->mapping = (unsigned char*)glMapBufferRange(target, 0,
+			r->region_bytes * r->region_count, flags);
+		if(r->mapping == NULL) {
+			// The storage is immutable now, so the fallback needs a new name
+			glDeleteBuffers(1, &r->buffer);
+			glGenBuffers(1, &r->buffer);
+			glBindBuffer(target, r->buffer);
+			r->persistent = 0;
+		}
+	}
+	#endif
+
+	if(!r->persistent) {
+		r->region_count = 1;
+		r->shadow = (unsigned char*)malloc(r->region_bytes);
+		glBufferData(target, r->region_bytes, NULL, GL_STREAM_DRAW);
+	}
+
+	glBindBuffer(target, 0);
+	return r;
+
+}
+
+GLuint dash_ring_buffer(dash_ring *r) {
+
+	return r->buffer;
+
+}
+
+void dash_ring_begin_frame(dash_ring *r) {
+
+	double start;
+	GLenum result;
+
+	dash_ring_commit(r);
+
+	#ifndef GL_ES_VERSION_2_0
+	if(r->persistent && r->head > 0) {
+		r->fences[r->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	#endif
+
+	r->stats.frames++;
+	r->head = 0;
+	r->committed = 0;
+
+	if(!r->persistent) {
+		glBindBuffer(r->target, r->buffer);
+		glBufferData(r->target, r->region_bytes, NULL, GL_STREAM_DRAW);
+		glBindBuffer(r->target, 0);
+		return;
+	}
+
+	// The region about to be reused was last written region_count frames
+	// ago; only block if the GPU has still not caught up with it
+
+	r->region = (r->region + 1) % r->region_count;
+	if(r->fences[r->region] == NULL) {
+		return;
+	}
+
+	result = glClientWaitSync(r->fences[r->region], 0, 0);
+	if(result == GL_TIMEOUT_EXPIRED) {
+		r->stats.stalls++;
+		start = ring_now();
+		do {
+			result = glClientWaitSync(r->fences[r->region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while(result == GL_TIMEOUT_EXPIRED);
+		r->stats.stall_ms += (ring_now() - start) * 1000.0;
+	}
+
+	glDeleteSync(r->fences[r->region]);
+	r->fences[r->region] = NULL;
+
+}
+
+void *dash_ring_alloc(dash_ring *r, size_t size, size_t align, size_t *offset) {
+
+	size_t start;
+
+	if(align == 0) {
+		align = 1;
+	}
+	start = (r->head + align - 1) / align * align;
+
+	if(start + size > r->region_bytes) {
+		r->stats.overflows++;
+		return NULL;
+	}
+
+	r->head = start + size;
+	r->stats.bytes_streamed += size;
+	*offset = r->region * r->region_bytes + start;
+
+	if(r->persistent) {
+		return r->mapping + *offset;
+	}
+	return r->shadow + start;
+
+}
+
+void dash_ring_commit(dash_ring *r) {
+
+	if(r->persistent || r->head == r->committed) {
+		return;
+	}
+
+	glBindBuffer(r->target, r->buffer);
+	glBufferSubData(r->target, r->committed, r->head - r->committed, r->shadow + r->committed);
+	glBindBuffer(r->target, 0);
+	r->committed = r->head;
+
+}
+
+void dash_ring_get_stats(dash_ring *r, dash_ring_stats *stats) {
+
+	*stats = r->stats;
+
+}
+
+void dash_ring_destroy(dash_ring *r) {
+
+	int i;
+
+	for(i = 0; i < r->region_count; i++) {
+		if(r->fences[i] != NULL) {
+			glDeleteSync(r->fences[i]);
+		}
+	}
+
+	if(r->persistent) {
+		glBindBuffer(r->target, r->buffer);
+		glUnmapBuffer(r->target);
+		glBindBuffer(r->target, 0);
+	}
+
+	glDeleteBuffers(1, &r->buffer);
+	free(r->shadow);
+	free(r->fences);
+	free(r);
+
+}
+
+/******************************************************************************/
+/** Geometry Pool                                                            **/
+/******************************************************************************/
+
+/*
+	Many meshes share one vertex buffer and one index buffer, so drawing any
+	number of them costs a single layout bind. Vertex and index ranges are
+	handed out first fit from free lists that merge neighbouring blocks on
+	release. A draw turns the requested meshes into DrawElementsIndirect
+	commands, streamed through a ring, and submits them with one
+	glMultiDrawElementsIndirect on GL 4.3 or ARB_multi_draw_indirect.
+	Otherwise it loops over glDrawElementsBaseVertex, and without base
+	vertex support the indices are rebased on upload so a plain
+	glDrawElements loop does the same job.
+
+	A handle is an entry slot in its low 20 bits and the slot's generation
+	above them. Removing a mesh bumps the generation, so its old handle
+	stays invalid after another mesh takes over the slot.
+*/
+
+#define POOL_MULTI_DRAW 0
+#define POOL_BASE_VERTEX 1
+#define POOL_REBASED 2
+#define POOL_SLOT_BITS 20
+#define POOL_SLOT_MASK ((1 << POOL_SLOT_BITS) - 1)
+#define POOL_GENERATION_MASK 0x7ff
+
+typedef struct {
+	size_t offset;
+	size_t size;
+} pool_block;
+
+typedef struct {
+	pool_block *blocks;
+	size_t count;
+	size_t cap;
+} pool_free_list;
+
+typedef struct {
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	uint32_t base_vertex;
+	uint32_t base_instance;
+} pool_command;
+
+typedef struct {
+	int used;
+	int generation;
+	size_t first_index;
+	size_t index_count;
+	size_t base_vertex;
+	size_t vertex_count;
+} pool_entry;
+
+struct dash_pool {
+	dash_mesh mesh;
+	int mode;
+	size_t vertex_capacity;
+	size_t index_capacity;
+	pool_free_list vertex_free;
+	pool_free_list index_free;
+	pool_entry *entries;
+	int entry_count;
+	int entry_cap;
+	dash_ring *commands;
+	int max_commands;
+	dash_pool_stats stats;
+};
+
+static void free_list_insert(pool_free_list *list, size_t at, size_t offset, size_t size) {
+
+	if(list->count == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 16;
+		list->blocks = (pool_block*)realloc(list->blocks, sizeof(pool_block) * list->cap);
+	}
+
+	memmove(list->blocks + at + 1, list->blocks + at, sizeof(pool_block) * (list->count - at));
+	list->blocks[at].offset = offset;
+	list->blocks[at].size = size;
+	list->count++;
+
+}
+
+static void free_list_remove(pool_free_list *list, size_t at) {
+
+	memmove(list->blocks + at, list->blocks + at + 1, sizeof(pool_block) * (list->count - at - 1));
+	list->count--;
+
+}
+
+static int free_list_alloc(pool_free_list *list, size_t size, size_t *offset) {
+
+	size_t i;
+
+	for(i = 0; i < list->count; i++) {
+		if(list->blocks[i].size < size) {
+			continue;
+		}
+		*offset = list->blocks[i].offset;
+		list->blocks[i].offset += size;
+		list->blocks[i].size -= size;
+		if(list->blocks[i].size == 0) {
+			free_list_remove(list, i);
+		}
+		return 1;
+	}
+
+	return 0;
+
+}
+
+static void free_list_release(pool_free_list *list, size_t offset, size_t size) {
+
+	size_t at;
+	pool_block *prev, *next;
+
+	// Blocks stay sorted by offset so neighbours can be merged
+
+	at = 0;
+	while(at < list->count && list->blocks[at].offset < offset) {
+		at++;
+	}
+
+	prev = at > 0 ? &list->blocks[at - 1] : NULL;
+	next = at < list->count ? &list->blocks[at] : NULL;
+
+	if(prev != NULL && prev->offset + prev->size == offset) {
+		prev->size += size;
+		if(next != NULL && prev->offset + prev->size == next->offset) {
+			prev->size += next->size;
+			free_list_remove(list, at);
+		}
+	} else if(next != NULL && offset + size == next->offset) {
+		next->offset = offset;
+		next->size += size;
+	} else {
+		free_list_insert(list, at, offset, size);
+	}
+
+}
+
+static size_t free_list_largest(pool_free_list *list) {
+
+	size_t i, largest = 0;
+
+	for(i = 0; i < list->count; i++) {
+		if(list->blocks[i].size > largest) {
+			largest = list->blocks[i].size;
+		}
+	}
+
+	return largest;
+
+}
+
+static int pool_mode() {
+
+	#ifdef GL_ES_VERSION_2_0
+	return POOL_REBASED;
+	#else
+	if(GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_draw_indirect)) {
+		return POOL_MULTI_DRAW;
+	} else if(GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex) {
+		return POOL_BASE_VERTEX;
+	}
+	return POOL_REBASED;
+	#endif
+
+}
+
+dash_pool *dash_pool_create(const dash_mesh_data *layout, size_t vertex_capacity, size_t index_capacity, int max_draws) {
+
+	dash_pool *p;
+
+	p = (dash_pool*)calloc(1, sizeof(dash_pool));
+	p->mode = pool_mode();
+	p->vertex_capacity = vertex_capacity;
+	p->index_capacity = index_capacity;
+	p->max_commands = max_draws;
+	free_list_insert(&p->vertex_free, 0, 0, vertex_capacity);
+	free_list_insert(&p->index_free, 0, 0, index_capacity);
+
+	p->mesh.stride = layout->stride;
+	p->mesh.texcoord = layout->texcoord;
+	p->mesh.normal = layout->normal;
+	p->mesh.color = layout->color;
+	p->mesh.index_type = GL_UNSIGNED_INT;
+	p->mesh.submesh_count = 1;
+	p->mesh.submeshes = (dash_submesh*)calloc(1, sizeof(dash_submesh));
+
+	dash_mesh_unbind();
+
+	glGenBuffers(1, &p->mesh.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, p->mesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * layout->stride * vertex_capacity, NULL, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &p->mesh.ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p->mesh.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * index_capacity, NULL, GL_STATIC_DRAW);
+
+	#ifndef GL_ES_VERSION_2_0
+	if(p->mode == POOL_MULTI_DRAW) {
+		p->commands = dash_ring_create(GL_DRAW_INDIRECT_BUFFER, sizeof(pool_command) * max_draws, 4);
+	}
+	#endif
+
+	return p;
+
+}
+
+void dash_pool_layout(dash_pool *p, GLint *locations) {
+
+	dash_mesh_layout(&p->mesh, locations);
+
+}
+
+int dash_pool_add(dash_pool *p, const dash_mesh_data *data) {
+
+	int handle;
+	size_t i, base_vertex, first_index;
+	uint32_t *rebased;
+	pool_entry *e;
+
+	if(data->stride != p->mesh.stride || data->texcoord != p->mesh.texcoord ||
+		data->normal != p->mesh.normal || data->color != p->mesh.color) {
+		fprintf(stderr, "Mesh layout does not match the geometry pool\n");
+		return -1;
+	}
+
+	if(!free_list_alloc(&p->vertex_free, data->vertex_count, &base_vertex)) {
+		return -1;
+	}
+	if(!free_list_alloc(&p->index_free, data->index_count, &first_index)) {
+		free_list_release(&p->vertex_free, base_vertex, data->vertex_count);
+		return -1;
+	}
+
+	for(handle = 0; handle < p->entry_count; handle++) {
+		if(!p->entries[handle].used) {
+			break;
+		}
+	}
+	if(handle == p->entry_count) {
+		if(handle > POOL_SLOT_MASK) {
+			free_list_release(&p->vertex_free, base_vertex, data->vertex_count);
+			free_list_release(&p->index_free, first_index, data->index_count);
+			return -1;
+		}
+		if(p->entry_count == p->entry_cap) {
+			p->entry_cap = p->entry_cap ? p->entry_cap * 2 : 64;
+			p->entries = (pool_entry*)realloc(p->entries, sizeof(pool_entry) * p->entry_cap);
+		}
+		p->entries[handle].generation = 0;
+		p->entry_count++;
+	}
+
+	e = &p->entries[handle];
+	e->used = 1;
+	e->base_vertex = base_vertex;
+	e->vertex_count = data->vertex_count;
+	e->first_index = first_index;
+	e->index_count = data->index_count;
+
+	dash_mesh_unbind();
+
+	glBindBuffer(GL_ARRAY_BUFFER, p->mesh.vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * p->mesh.stride * base_vertex,
+		sizeof(float) * p->mesh.stride * data->vertex_count, data->vertices);
+
+	rebased = data->indices;
+	if(p->mode == POOL_REBASED) {
+		rebased = (uint32_t*)malloc(sizeof(uint32_t) * data->index_count + 1);
+		for(i = 0; i < data->index_count; i++) {
+			rebased[i] = data->indices[i] + base_vertex;
+		}
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p->mesh.ibo);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * first_index,
+		sizeof(uint32_t) * data->index_count, rebased);
+
+	if(rebased != data->indices) {
+		free(rebased);
+	}
+
+	p->stats.meshes++;
+	p->stats.vertices_used += data->vertex_count;
+	p->stats.indices_used += data->index_count;
+
+	return handle | e->generation << POOL_SLOT_BITS;
+
+}
+
+static pool_entry *pool_entry_get(dash_pool *p, int handle) {
+
+	int slot;
+
+	slot = handle & POOL_SLOT_MASK;
+	if(handle < 0 || slot >= p->entry_count || !p->entries[slot].used ||
+		p->entries[slot].generation != handle >> POOL_SLOT_BITS) {
+		return NULL;
+	}
+
+	return &p->entries[slot];
+
+}
+
+void dash_pool_remove(dash_pool *p, int handle) {
+
+	pool_entry *e;
+
+	e = pool_entry_get(p, handle);
+	if(e == NULL) {
+		return;
+	}
+	free_list_release(&p->vertex_free, e->base_vertex, e->vertex_count);
+	free_list_release(&p->index_free, e->first_index, e->index_count);
+	e->used = 0;
+	e->generation = (e->generation + 1) & POOL_GENERATION_MASK;
+
+	p->stats.meshes--;
+	p->stats.vertices_used -= e->vertex_count;
+	p->stats.indices_used -= e->index_count;
+
+}
+
+void dash_pool_draw(dash_pool *p, const int *handles, int count) {
+
+	int i, n, k;
+	size_t offset;
+	pool_entry *e;
+	pool_command *cmd;
+
+	// Removed or out of range handles are skipped, their range may already
+	// belong to another mesh
+
+	dash_mesh_bind(&p->mesh);
+	p->stats.binds++;
+
+	#ifndef GL_ES_VERSION_2_0
+	if(p->mode == POOL_MULTI_DRAW) {
+
+		// Each submission is a ring frame, so the command region a
+		// previous multi draw may still be reading is left alone
+
+		while(count > 0) {
+			n = count < p->max_commands ? count : p->max_commands;
+			dash_ring_begin_frame(p->commands);
+			cmd = (pool_command*)dash_ring_alloc(p->commands, sizeof(pool_command) * n, 4, &offset);
+			k = 0;
+			for(i = 0; i < n; i++) {
+				e = pool_entry_get(p, handles[i]);
+				if(e == NULL) {
+					continue;
+				}
+				cmd[k].count = e->index_count;
+				cmd[k].instance_count = 1;
+				cmd[k].first_index = e->first_index;
+				cmd[k].base_vertex = e->base_vertex;
+				cmd[k].base_instance = 0;
+				k++;
+				p->stats.draws++;
+			}
+			dash_ring_commit(p->commands);
+			if(k > 0) {
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, dash_ring_buffer(p->commands));
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, k, 0);
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+				p->stats.draw_calls++;
+			}
+			handles += n;
+			count -= n;
+		}
+		return;
+
+	}
+	#endif
+
+	for(i = 0; i < count; i++) {
+		e = pool_entry_get(p, handles[i]);
+		if(e == NULL) {
+			continue;
+		}
+		p->stats.draw_calls++;
+		p->stats.draws++;
+		#ifndef GL_ES_VERSION_2_0
+		if(p->mode == POOL_BASE_VERTEX) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, e->index_count, GL_UNSIGNED_INT,
+				(void*)(e->first_index * sizeof(uint32_t)), e->base_vertex);
+			continue;
+		}
+		#endif
+		glDrawElements(GL_TRIANGLES, e->index_count, GL_UNSIGNED_INT,
+			(void*)(e->first_index * sizeof(uint32_t)));
+	}
+
+}
+
+void dash_pool_get_stats(dash_pool *p, dash_pool_stats *stats) {
+
+	*stats = p->stats;
+	stats->largest_free_vertices = free_list_largest(&p->vertex_free);
+	stats->largest_free_indices = free_list_largest(&p->index_free);
+
+}
+
+void dash_pool_destroy(dash_pool *p) {
+
+	if(p->commands != NULL) {
+		dash_ring_destroy(p->commands);
+	}
+	dash_mesh_free(&p->mesh);
+	free(p->vertex_free.blocks);
+	free(p->index_free.blocks);
+	free(p->entries);
+	free(p);
+
+}
+
+/******************************************************************************/
+/** End Program	                                                             **/
+/******************************************************************************/
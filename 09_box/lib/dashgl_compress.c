@@ -0,0 +1,769 @@
+/*
+    This file is part of Dash Graphics Library
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <GL/glew.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "dashgl.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+
+/******************************************************************************/
+/** Block Helpers                                                            **/
+/******************************************************************************/
+
+static void block_fetch(dash_image *img, int bx, int by, unsigned char *px) {
+
+	int x, y, sx, sy, c;
+	unsigned char *src;
+
+	// Edge blocks repeat the last row and column
+
+	for(y = 0; y < 4; y++) {
+		sy = by * 4 + y < img->height ? by * 4 + y : img->height - 1;
+		for(x = 0; x < 4; x++) {
+			sx = bx * 4 + x < img->width ? bx * 4 + x : img->width - 1;
+			src = img->data + (sy * img->width + sx) * img->channels;
+			for(c = 0; c < 3; c++) {
+				px[(y * 4 + x) * 4 + c] = src[c];
+			}
+			px[(y * 4 + x) * 4 + 3] = img->channels == 4 ? src[3] : 255;
+		}
+	}
+
+}
+
+static void block_bounds(const unsigned char *px, unsigned char *lo, unsigned char *hi) {
+
+	#ifdef __SSE2__
+	int v;
+	__m128i a = _mm_loadu_si128((const __m128i*)(px + 0));
+	__m128i b = _mm_loadu_si128((const __m128i*)(px + 16));
+	__m128i d = _mm_loadu_si128((const __m128i*)(px + 32));
+	__m128i e = _mm_loadu_si128((const __m128i*)(px + 48));
+	__m128i mn = _mm_min_epu8(_mm_min_epu8(a, b), _mm_min_epu8(d, e));
+	__m128i mx = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(d, e));
+
+	mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 8));
+	mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+	mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+	mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+
+	v = _mm_cvtsi128_si32(mn);
+	memcpy(lo, &v, 4);
+	v = _mm_cvtsi128_si32(mx);
+	memcpy(hi, &v, 4);
+	#else
+	int i, c;
+
+	for(c = 0; c < 4; c++) {
+		lo[c] = 255;
+		hi[c] = 0;
+	}
+	for(i = 0; i < 16; i++) {
+		for(c = 0; c < 4; c++) {
+			lo[c] = px[i * 4 + c] < lo[c] ? px[i * 4 + c] : lo[c];
+			hi[c] = px[i * 4 + c] > hi[c] ? px[i * 4 + c] : hi[c];
+		}
+	}
+	#endif
+
+}
+
+static int clamp255(int v) {
+
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+
+}
+
+/******************************************************************************/
+/** BC1 / BC3                                                                **/
+/******************************************************************************/
+
+static uint16_t rgb565(const unsigned char *c) {
+
+	return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+
+}
+
+static void rgb565_expand(uint16_t v, int *c) {
+
+	c[0] = (v >> 11) & 31;
+	c[1] = (v >> 5) & 63;
+	c[2] = v & 31;
+	c[0] = (c[0] << 3) | (c[0] >> 2);
+	c[1] = (c[1] << 2) | (c[1] >> 4);
+	c[2] = (c[2] << 3) | (c[2] >> 2);
+
+}
+
+static void bc1_palette(uint16_t c0, uint16_t c1, int pal[4][3]) {
+
+	int c;
+
+	rgb565_expand(c0, pal[0]);
+	rgb565_expand(c1, pal[1]);
+	for(c = 0; c < 3; c++) {
+		if(c0 > c1) {
+			pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+			pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+		} else {
+			pal[2][c] = (pal[0][c] + pal[1][c]) / 2;
+			pal[3][c] = 0;
+		}
+	}
+
+}
+
+static void bc1_encode(const unsigned char *px, unsigned char *out) {
+
+	int i, j, c, d, best, best_d, inset;
+	int pal[4][3];
+	unsigned char lo[4], hi[4];
+	uint16_t c0, c1, tmp;
+	uint32_t indices;
+
+	// Bounding box of the block, inset by 1/16 to reduce endpoint error
+
+	block_bounds(px, lo, hi);
+	for(c = 0; c < 3; c++) {
+		inset = (hi[c] - lo[c]) >> 4;
+		lo[c] += inset;
+		hi[c] -= inset;
+	}
+
+	c0 = rgb565(hi);
+	c1 = rgb565(lo);
+	if(c0 < c1) {
+		tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+
+	indices = 0;
+	if(c0 != c1) {
+		bc1_palette(c0, c1, pal);
+		for(i = 0; i < 16; i++) {
+			best = 0;
+			best_d = 0x7fffffff;
+			for(j = 0; j < 4; j++) {
+				d = 0;
+				for(c = 0; c < 3; c++) {
+					d += (px[i * 4 + c] - pal[j][c]) * (px[i * 4 + c] - pal[j][c]);
+				}
+				if(d < best_d) {
+					best_d = d;
+					best = j;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	out[4] = indices & 0xff;
+	out[5] = (indices >> 8) & 0xff;
+	out[6] = (indices >> 16) & 0xff;
+	out[7] = indices >> 24;
+
+}
+
+static void bc1_decode(const unsigned char *in, unsigned char *px) {
+
+	int i, c, idx;
+	int pal[4][3];
+	uint16_t c0, c1;
+	uint32_t indices;
+
+	c0 = in[0] | (in[1] << 8);
+	c1 = in[2] | (in[3] << 8);
+	indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+	bc1_palette(c0, c1, pal);
+
+	for(i = 0; i < 16; i++) {
+		idx = (indices >> (i * 2)) & 3;
+		for(c = 0; c < 3; c++) {
+			px[i * 4 + c] = pal[idx][c];
+		}
+		px[i * 4 + 3] = 255;
+	}
+
+}
+
+static void bc3_alpha_palette(int a0, int a1, int *pal) {
+
+	int k;
+
+	pal[0] = a0;
+	pal[1] = a1;
+	if(a0 > a1) {
+		for(k = 1; k < 7; k++) {
+			pal[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+		}
+	} else {
+		for(k = 1; k < 5; k++) {
+			pal[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+		}
+		pal[6] = 0;
+		pal[7] = 255;
+	}
+
+}
+
+static void bc3_encode(const unsigned char *px, unsigned char *out) {
+
+	int i, j, d, best, best_d;
+	int pal[8];
+	unsigned char lo[4], hi[4];
+	uint64_t indices;
+
+	block_bounds(px, lo, hi);
+	indices = 0;
+
+	if(hi[3] != lo[3]) {
+		bc3_alpha_palette(hi[3], lo[3], pal);
+		for(i = 0; i < 16; i++) {
+			best = 0;
+			best_d = 256;
+			for(j = 0; j < 8; j++) {
+				d = abs(px[i * 4 + 3] - pal[j]);
+				if(d < best_d) {
+					best_d = d;
+					best = j;
+				}
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+	}
+
+	out[0] = hi[3];
+	out[1] = lo[3];
+	for(i = 0; i < 6; i++) {
+		out[2 + i] = (indices >> (i * 8)) & 0xff;
+	}
+
+	bc1_encode(px, out + 8);
+
+}
+
+static void bc3_decode(const unsigned char *in, unsigned char *px) {
+
+	int i;
+	int pal[8];
+	uint64_t indices;
+
+	bc1_decode(in + 8, px);
+	bc3_alpha_palette(in[0], in[1], pal);
+
+	indices = 0;
+	for(i = 0; i < 6; i++) {
+		indices |= (uint64_t)in[2 + i] << (i * 8);
+	}
+
+	for(i = 0; i < 16; i++) {
+		px[i * 4 + 3] = pal[(indices >> (i * 3)) & 7];
+	}
+
+}
+
+/******************************************************************************/
+/** ETC2 RGB                                                                 **/
+/******************************************************************************/
+
+/*
+	Blocks are written in the individual and differential modes shared with
+	ETC1, which keeps them decodable as both GL_ETC1_RGB8_OES and
+	GL_COMPRESSED_RGB8_ETC2. Differential mode is only used when the deltas
+	stay in range, so an ETC2 decoder never sees a T, H or planar block.
+*/
+
+static const int etc_tables[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+	{ 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+static int etc_in_subblock(int flip, int sub, int x, int y) {
+
+	return flip ? (y >= 2) == sub : (x >= 2) == sub;
+
+}
+
+static int etc_fit_subblock(const unsigned char *px, int flip, int sub,
+	const int *base, int *table, uint32_t *msb, uint32_t *lsb) {
+
+	int t, x, y, m, c, d, v, err, best_m, best_d, best_err;
+	int mods[4];
+	uint32_t m_bits, l_bits, best_msb, best_lsb;
+
+	best_err = 0x7fffffff;
+	best_msb = 0;
+	best_lsb = 0;
+
+	for(t = 0; t < 8; t++) {
+
+		mods[0] = etc_tables[t][0];
+		mods[1] = etc_tables[t][1];
+		mods[2] = -etc_tables[t][0];
+		mods[3] = -etc_tables[t][1];
+
+		err = 0;
+		m_bits = 0;
+		l_bits = 0;
+
+		for(x = 0; x < 4; x++) {
+			for(y = 0; y < 4; y++) {
+				if(!etc_in_subblock(flip, sub, x, y)) {
+					continue;
+				}
+				best_m = 0;
+				best_d = 0x7fffffff;
+				for(m = 0; m < 4; m++) {
+					d = 0;
+					for(c = 0; c < 3; c++) {
+						v = clamp255(base[c] + mods[m]) - px[(y * 4 + x) * 4 + c];
+						d += v * v;
+					}
+					if(d < best_d) {
+						best_d = d;
+						best_m = m;
+					}
+				}
+				err += best_d;
+				m_bits |= (uint32_t)(best_m >> 1) << (x * 4 + y);
+				l_bits |= (uint32_t)(best_m & 1) << (x * 4 + y);
+			}
+		}
+
+		if(err < best_err) {
+			best_err = err;
+			*table = t;
+			best_msb = m_bits;
+			best_lsb = l_bits;
+		}
+
+	}
+
+	*msb |= best_msb;
+	*lsb |= best_lsb;
+	return best_err;
+
+}
+
+static void etc_encode(const unsigned char *px, unsigned char *out) {
+
+	int flip, sub, x, y, c, n, diff, err, best_err;
+	int avg[2][3], q[2][3], base[2][3], table[2];
+	uint32_t msb, lsb;
+	uint64_t block, best_block;
+
+	best_err = 0x7fffffff;
+	best_block = 0;
+
+	for(flip = 0; flip < 2; flip++) {
+
+		for(sub = 0; sub < 2; sub++) {
+			for(c = 0; c < 3; c++) {
+				n = 0;
+				for(y = 0; y < 4; y++) {
+					for(x = 0; x < 4; x++) {
+						if(etc_in_subblock(flip, sub, x, y)) {
+							n += px[(y * 4 + x) * 4 + c];
+						}
+					}
+				}
+				avg[sub][c] = (n + 4) / 8;
+			}
+		}
+
+		// Prefer differential mode (5 bit colors) when the delta fits
+
+		diff = 1;
+		for(c = 0; c < 3; c++) {
+			q[0][c] = (avg[0][c] * 31 + 127) / 255;
+			q[1][c] = (avg[1][c] * 31 + 127) / 255;
+			if(q[1][c] - q[0][c] < -4 || q[1][c] - q[0][c] > 3) {
+				diff = 0;
+			}
+		}
+
+		for(sub = 0; sub < 2; sub++) {
+			for(c = 0; c < 3; c++) {
+				if(diff) {
+					base[sub][c] = (q[sub][c] << 3) | (q[sub][c] >> 2);
+				} else {
+					q[sub][c] = (avg[sub][c] * 15 + 127) / 255;
+					base[sub][c] = (q[sub][c] << 4) | q[sub][c];
+				}
+			}
+		}
+
+		msb = 0;
+		lsb = 0;
+		err = etc_fit_subblock(px, flip, 0, base[0], &table[0], &msb, &lsb);
+		err += etc_fit_subblock(px, flip, 1, base[1], &table[1], &msb, &lsb);
+
+		if(err >= best_err) {
+			continue;
+		}
+
+		block = 0;
+		for(c = 0; c < 3; c++) {
+			if(diff) {
+				block |= (uint64_t)q[0][c] << (59 - c * 8);
+				block |= (uint64_t)((q[1][c] - q[0][c]) & 7) << (56 - c * 8);
+			} else {
+				block |= (uint64_t)q[0][c] << (60 - c * 8);
+				block |= (uint64_t)q[1][c] << (56 - c * 8);
+			}
+		}
+		block |= (uint64_t)table[0] << 37;
+		block |= (uint64_t)table[1] << 34;
+		block |= (uint64_t)diff << 33;
+		block |= (uint64_t)flip << 32;
+		block |= (uint64_t)msb << 16;
+		block |= lsb;
+
+		best_err = err;
+		best_block = block;
+
+	}
+
+	for(c = 0; c < 8; c++) {
+		out[c] = (best_block >> (56 - c * 8)) & 0xff;
+	}
+
+}
+
+static void etc_decode(const unsigned char *in, unsigned char *px) {
+
+	int x, y, c, sub, flip, diff, m, v;
+	int base[2][3], table[2];
+	uint64_t block;
+
+	block = 0;
+	for(c = 0; c < 8; c++) {
+		block = (block << 8) | in[c];
+	}
+
+	diff = (block >> 33) & 1;
+	flip = (block >> 32) & 1;
+	table[0] = (block >> 37) & 7;
+	table[1] = (block >> 34) & 7;
+
+	for(c = 0; c < 3; c++) {
+		if(diff) {
+			v = (block >> (59 - c * 8)) & 31;
+			base[0][c] = (v << 3) | (v >> 2);
+			m = (block >> (56 - c * 8)) & 7;
+			v += m >= 4 ? m - 8 : m;
+			base[1][c] = (v << 3) | (v >> 2);
+		} else {
+			v = (block >> (60 - c * 8)) & 15;
+			base[0][c] = (v << 4) | v;
+			v = (block >> (56 - c * 8)) & 15;
+			base[1][c] = (v << 4) | v;
+		}
+	}
+
+	for(x = 0; x < 4; x++) {
+		for(y = 0; y < 4; y++) {
+			sub = flip ? y >= 2 : x >= 2;
+			m = (((block >> (16 + x * 4 + y)) & 1) << 1) | ((block >> (x * 4 + y)) & 1);
+			v = m & 1 ? etc_tables[table[sub]][1] : etc_tables[table[sub]][0];
+			v = m & 2 ? -v : v;
+			for(c = 0; c < 3; c++) {
+				px[(y * 4 + x) * 4 + c] = clamp255(base[sub][c] + v);
+			}
+			px[(y * 4 + x) * 4 + 3] = 255;
+		}
+	}
+
+}
+
+/******************************************************************************/
+/** Compression                                                              **/
+/******************************************************************************/
+
+typedef struct {
+	dash_image *img;
+	GLenum format;
+	unsigned char *out;
+	int row_start;
+	int row_end;
+} compress_job;
+
+static int block_bytes(GLenum format) {
+
+	return format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8;
+
+}
+
+static void *compress_rows(void *arg) {
+
+	int bx, by, blocks_x, stride;
+	unsigned char px[64];
+	compress_job *job = (compress_job*)arg;
+
+	blocks_x = (job->img->width + 3) / 4;
+	stride = block_bytes(job->format);
+
+	for(by = job->row_start; by < job->row_end; by++) {
+		for(bx = 0; bx < blocks_x; bx++) {
+			block_fetch(job->img, bx, by, px);
+			unsigned char *out = job->out + (by * blocks_x + bx) * stride;
+			switch(job->format) {
+				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+					bc1_encode(px, out);
+				break;
+				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+					bc3_encode(px, out);
+				break;
+				default:
+					etc_encode(px, out);
+				break;
+			}
+		}
+	}
+
+	return NULL;
+
+}
+
+static double compress_psnr(dash_image *img, GLenum format, const unsigned char *blocks) {
+
+	int bx, by, x, y, c, sx, sy, channels, blocks_x, blocks_y, stride;
+	unsigned char px[64];
+	const unsigned char *in;
+	double d, sum, count;
+
+	blocks_x = (img->width + 3) / 4;
+	blocks_y = (img->height + 3) / 4;
+	stride = block_bytes(format);
+	channels = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 4 : 3;
+	sum = 0.0;
+	count = 0.0;
+
+	for(by = 0; by < blocks_y; by++) {
+		for(bx = 0; bx < blocks_x; bx++) {
+			in = blocks + (by * blocks_x + bx) * stride;
+			switch(format) {
+				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+					bc1_decode(in, px);
+				break;
+				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+					bc3_decode(in, px);
+				break;
+				default:
+					etc_decode(in, px);
+				break;
+			}
+			for(y = 0; y < 4; y++) {
+				sy = by * 4 + y;
+				for(x = 0; x < 4; x++) {
+					sx = bx * 4 + x;
+					if(sx >= img->width || sy >= img->height) {
+						continue;
+					}
+					for(c = 0; c < channels; c++) {
+						d = (c < img->channels ? img->data[(sy * img->width + sx) * img->channels + c] : 255);
+						d -= px[(y * 4 + x) * 4 + c];
+						sum += d * d;
+						count += 1.0;
+					}
+				}
+			}
+		}
+	}
+
+	if(sum == 0.0) {
+		return 99.0;
+	}
+
+	return 10.0 * log10(255.0 * 255.0 / (sum / count));
+
+}
+
+size_t dash_compressed_size(GLenum format, int width, int height) {
+
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+
+}
+
+int dash_image_compress(dash_image *img, GLenum format, unsigned char *out, dash_compress_stats *stats) {
+
+	int i, threads, blocks_y, per_thread;
+	struct timespec start, end;
+	int spawned[64];
+	pthread_t tids[64];
+	compress_job jobs[64];
+
+	switch(format) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_RGB8_ETC2:
+		case GL_ETC1_RGB8_OES:
+		break;
+		default:
+			fprintf(stderr, "Unsupported compressed format 0x%x\n", format);
+			return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	blocks_y = (img->height + 3) / 4;
+	threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	threads = threads < 1 ? 1 : (threads > 64 ? 64 : threads);
+	threads = threads > blocks_y ? blocks_y : threads;
+	per_thread = (blocks_y + threads - 1) / threads;
+
+	for(i = 0; i < threads; i++) {
+		jobs[i].img = img;
+		jobs[i].format = format;
+		jobs[i].out = out;
+		jobs[i].row_start = i * per_thread;
+		jobs[i].row_end = (i + 1) * per_thread < blocks_y ? (i + 1) * per_thread : blocks_y;
+		spawned[i] = i > 0 && pthread_create(&tids[i], NULL, compress_rows, &jobs[i]) == 0;
+	}
+
+	// The calling thread takes the first slice and any that failed to spawn
+
+	for(i = 0; i < threads; i++) {
+		if(!spawned[i]) {
+			compress_rows(&jobs[i]);
+		}
+	}
+
+	for(i = 0; i < threads; i++) {
+		if(spawned[i]) {
+			pthread_join(tids[i], NULL);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if(stats != NULL) {
+		stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		stats->megapixels_per_second = img->width * img->height / 1e6 / stats->seconds;
+		stats->psnr = compress_psnr(img, format, out);
+	}
+
+	return 1;
+
+}
+
+GLenum dash_compressed_format(int channels) {
+
+	#ifdef GL_ES_VERSION_2_0
+	if(channels != 3) {
+		return 0;
+	}
+	if(dash_has_extension("GL_OES_compressed_ETC1_RGB8_texture")) {
+		return GL_ETC1_RGB8_OES;
+	}
+	return 0;
+	#else
+	if(!dash_has_extension("GL_EXT_texture_compression_s3tc")) {
+		return 0;
+	}
+	return channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	#endif
+
+}
+
+int dash_compressed_supported(GLenum format) {
+
+	// ETC1 data is valid ETC2, so desktop drivers with ES3 compatibility
+	// take both
+
+	switch(format) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			return dash_has_extension("GL_EXT_texture_compression_s3tc");
+		case GL_ETC1_RGB8_OES:
+			#ifdef GL_ES_VERSION_2_0
+			return dash_has_extension("GL_OES_compressed_ETC1_RGB8_texture");
+			#endif
+		case GL_COMPRESSED_RGB8_ETC2:
+			return dash_has_extension("GL_ARB_ES3_compatibility");
+	}
+
+	return 0;
+
+}
+
+GLuint dash_texture_load_compressed(const char *filename) {
+
+	dash_image img;
+	GLenum format;
+	GLuint texture_id;
+	size_t size;
+	unsigned char *blocks;
+
+	if(!dash_image_load(filename, &img)) {
+		return 0;
+	}
+
+	format = dash_compressed_format(img.channels);
+	if(format == 0) {
+		texture_id = dash_texture_create(&img);
+		dash_image_free(&img);
+		return texture_id;
+	}
+
+	size = dash_compressed_size(format, img.width, img.height);
+	blocks = (unsigned char*)malloc(size);
+	dash_image_compress(&img, format, blocks, NULL);
+
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glCompressedTexImage2D(GL_TEXTURE_2D, 0, format, img.width, img.height, 0, size, blocks);
+
+	free(blocks);
+	dash_image_free(&img);
+
+	return texture_id;
+
+}
+
+/******************************************************************************/
+/** End Program	                                                             **/
+/******************************************************************************/
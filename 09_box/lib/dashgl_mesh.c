@@ -0,0 +1,3850 @@
+/*
+    This file is part of Dash Graphics Library
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <GL/glew.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "dashgl.h"
+
+/******************************************************************************/
+/** Vertex Formats                                                           **/
+/******************************************************************************/
+
+/*
+	Float vertices are packed into a compact interleaved layout. Positions
+	become normalized int16 relative to the mesh bounds, and the matrix from
+	dash_vertex_format_matrix maps them back, so it is folded into the model
+	matrix instead of changing the shaders. Texcoords in [0, 1] become unorm16,
+	others become half floats when the driver takes them, and colors become
+	unorm8x4. Every attribute starts on a four byte boundary.
+*/
+
+static uint16_t float_to_half(float f) {
+
+	uint32_t x, sign, mant;
+	int exp;
+
+	memcpy(&x, &f, 4);
+	sign = (x >> 16) & 0x8000;
+	exp = ((x >> 23) & 0xff) - 127 + 15;
+	mant = x & 0x7fffff;
+
+	if(((x >> 23) & 0xff) == 0xff) {
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	}
+	if(exp >= 31) {
+		return sign | 0x7c00;
+	}
+	if(exp <= 0) {
+		if(exp < -10) {
+			return sign;
+		}
+		mant |= 0x800000;
+		return sign | ((mant >> (14 - exp)) + ((mant >> (13 - exp)) & 1));
+	}
+
+	// Round to nearest, a carry out of the mantissa correctly bumps the exponent
+
+	return (sign | (exp << 10) | (mant >> 13)) + ((mant >> 12) & 1);
+
+}
+
+static int quantize(float v, float lo, float hi, int range) {
+
+	int q = (int)floorf(v * range + 0.5f);
+
+	if(v <= lo) {
+		return (int)(lo * range);
+	}
+	if(v >= hi) {
+		return (int)(hi * range);
+	}
+	return q;
+
+}
+
+static void format_add(dash_vertex_format *fmt, int semantic, GLint size, GLenum type, GLboolean normalized, int bytes) {
+
+	dash_vertex_attrib *attrib = &fmt->attribs[semantic];
+
+	attrib->size = size;
+	attrib->type = type;
+	attrib->normalized = normalized;
+	attrib->offset = fmt->stride;
+	fmt->stride += (bytes + 3) & ~3;
+
+}
+
+unsigned char *dash_vertex_encode(const float *src, int count, dash_vertex_source *in, dash_vertex_format *fmt) {
+
+	int i, c, unit_uv;
+	float lo[3], hi[3], v;
+	const float *vert;
+	unsigned char *out, *dst;
+	int16_t *pos;
+	uint16_t *uv;
+
+	memset(fmt, 0, sizeof(dash_vertex_format));
+	for(c = 0; c < 3; c++) {
+		fmt->scale[c] = 1.0f;
+	}
+
+	if(in->position >= 0) {
+
+		for(c = 0; c < 3; c++) {
+			lo[c] = src[in->position + c];
+			hi[c] = src[in->position + c];
+		}
+		for(i = 1; i < count; i++) {
+			for(c = 0; c < 3; c++) {
+				v = src[i * in->stride + in->position + c];
+				lo[c] = v < lo[c] ? v : lo[c];
+				hi[c] = v > hi[c] ? v : hi[c];
+			}
+		}
+		for(c = 0; c < 3; c++) {
+			fmt->offset[c] = (lo[c] + hi[c]) * 0.5f;
+			fmt->scale[c] = (hi[c] - lo[c]) * 0.5f;
+			if(fmt->scale[c] == 0.0f) {
+				fmt->scale[c] = 1.0f;
+			}
+		}
+
+		format_add(fmt, DASH_POSITION, 3, GL_SHORT, GL_TRUE, 6);
+
+	}
+
+	if(in->texcoord >= 0) {
+
+		unit_uv = 1;
+		for(i = 0; i < count && unit_uv; i++) {
+			for(c = 0; c < 2; c++) {
+				v = src[i * in->stride + in->texcoord + c];
+				if(v < 0.0f || v > 1.0f) {
+					unit_uv = 0;
+				}
+			}
+		}
+
+		if(unit_uv) {
+			format_add(fmt, DASH_TEXCOORD, 2, GL_UNSIGNED_SHORT, GL_TRUE, 4);
+		} else if(GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex) {
+			format_add(fmt, DASH_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, 4);
+		} else {
+			format_add(fmt, DASH_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 8);
+		}
+
+	}
+
+	if(in->color >= 0) {
+		format_add(fmt, DASH_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4);
+	}
+
+	out = (unsigned char*)calloc(count, fmt->stride);
+
+	for(i = 0; i < count; i++) {
+
+		vert = src + i * in->stride;
+		dst = out + i * fmt->stride;
+
+		if(in->position >= 0) {
+			pos = (int16_t*)(dst + fmt->attribs[DASH_POSITION].offset);
+			for(c = 0; c < 3; c++) {
+				v = (vert[in->position + c] - fmt->offset[c]) / fmt->scale[c];
+				pos[c] = quantize(v, -1.0f, 1.0f, 32767);
+			}
+		}
+
+		if(in->texcoord >= 0) {
+			uv = (uint16_t*)(dst + fmt->attribs[DASH_TEXCOORD].offset);
+			for(c = 0; c < 2; c++) {
+				v = vert[in->texcoord + c];
+				switch(fmt->attribs[DASH_TEXCOORD].type) {
+					case GL_UNSIGNED_SHORT:
+						uv[c] = quantize(v, 0.0f, 1.0f, 65535);
+					break;
+					case GL_HALF_FLOAT:
+						uv[c] = float_to_half(v);
+					break;
+					default:
+						((float*)uv)[c] = v;
+					break;
+				}
+			}
+		}
+
+		if(in->color >= 0) {
+			for(c = 0; c < 4; c++) {
+				v = c < in->color_size ? vert[in->color + c] : 1.0f;
+				dst[fmt->attribs[DASH_COLOR].offset + c] = quantize(v, 0.0f, 1.0f, 255);
+			}
+		}
+
+	}
+
+	return out;
+
+}
+
+void dash_vertex_format_matrix(dash_vertex_format *fmt, mat4 m) {
+
+	mat4_identity(m);
+	m[M_00] = fmt->scale[0];
+	m[M_11] = fmt->scale[1];
+	m[M_22] = fmt->scale[2];
+	m[M_03] = fmt->offset[0];
+	m[M_13] = fmt->offset[1];
+	m[M_23] = fmt->offset[2];
+
+}
+
+void dash_vertex_format_enable(dash_vertex_format *fmt, GLint *locations) {
+
+	int i;
+	dash_vertex_attrib *attrib;
+
+	for(i = 0; i < DASH_SEMANTIC_COUNT; i++) {
+		attrib = &fmt->attribs[i];
+		if(attrib->size == 0 || locations[i] < 0) {
+			continue;
+		}
+		glEnableVertexAttribArray(locations[i]);
+		glVertexAttribPointer(
+			locations[i],
+			attrib->size,
+			attrib->type,
+			attrib->normalized,
+			fmt->stride,
+			(void*)(intptr_t)attrib->offset
+		);
+	}
+
+}
+
+void dash_vertex_format_disable(dash_vertex_format *fmt, GLint *locations) {
+
+	int i;
+
+	for(i = 0; i < DASH_SEMANTIC_COUNT; i++) {
+		if(fmt->attribs[i].size != 0 && locations[i] >= 0) {
+			glDisableVertexAttribArray(locations[i]);
+		}
+	}
+
+}
+
+/******************************************************************************/
+/** Mesh Loading                                                             **/
+/******************************************************************************/
+
+/*
+	OBJ and binary PLY files are mapped read only. OBJ text is split into one
+	line range per core and each thread parses its own range; digits are
+	consumed eight at a time with SWAR arithmetic. Face corners that repeat the
+	same position, texcoord and normal are welded through an open addressing
+	hash, so the output is an interleaved vertex array plus 32-bit indices
+	ready for glBufferData. Vertices are laid out as position, then texcoord,
+	normal and color when present, matching dash_vertex_source.
+*/
+
+#define OBJ_RELATIVE (1 << 30)
+#define MAX_THREADS 64
+
+typedef struct {
+	const char *start;
+	const char *end;
+	float *positions;
+	float *texcoords;
+	float *normals;
+	int *corners;
+	size_t position_count;
+	size_t texcoord_count;
+	size_t normal_count;
+	size_t corner_count;
+	size_t position_cap;
+	size_t texcoord_cap;
+	size_t normal_cap;
+	size_t corner_cap;
+} obj_chunk;
+
+static void *grow(void *ptr, size_t *cap, size_t need, size_t elem) {
+
+	if(need <= *cap) {
+		return ptr;
+	}
+
+	*cap = *cap ? *cap * 2 : 1024;
+	while(*cap < need) {
+		*cap *= 2;
+	}
+
+	return realloc(ptr, *cap * elem);
+
+}
+
+static int thread_count() {
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : (int)n);
+
+}
+
+static int swar_is_eight_digits(uint64_t v) {
+
+	return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+		(((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+		0x3333333333333333ULL);
+
+}
+
+static uint32_t swar_parse_eight_digits(uint64_t v) {
+
+	const uint64_t mask = 0x000000FF000000FFULL;
+	const uint64_t mul1 = 0x000F424000000064ULL;
+	const uint64_t mul2 = 0x0000271000000001ULL;
+
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+
+	return (uint32_t)v;
+
+}
+
+static const char *parse_digits(const char *p, const char *end, uint64_t *mant, int *count) {
+
+	uint64_t chunk;
+
+	while(end - p >= 8) {
+		memcpy(&chunk, p, 8);
+		if(!swar_is_eight_digits(chunk) || *count > 10) {
+			break;
+		}
+		*mant = *mant * 100000000ULL + swar_parse_eight_digits(chunk);
+		*count += 8;
+		p += 8;
+	}
+
+	while(p < end && *p >= '0' && *p <= '9') {
+		if(*count < 19) {
+			*mant = *mant * 10 + (*p - '0');
+			(*count)++;
+		} else {
+			(*count)++;
+		}
+		p++;
+	}
+
+	return p;
+
+}
+
+static const char *parse_float(const char *p, const char *end, float *out) {
+
+	int neg, exp_neg, count, frac_count, exp;
+	uint64_t mant;
+	double v;
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	while(p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+
+	neg = 0;
+	if(p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		p++;
+	}
+
+	mant = 0;
+	count = 0;
+	p = parse_digits(p, end, &mant, &count);
+	exp = count > 19 ? count - 19 : 0;
+
+	if(p < end && *p == '.') {
+		p++;
+		frac_count = count;
+		p = parse_digits(p, end, &mant, &count);
+		frac_count = (count < 19 ? count : 19) - (frac_count < 19 ? frac_count : 19);
+		exp -= frac_count;
+	}
+
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		exp_neg = 0;
+		if(p < end && (*p == '-' || *p == '+')) {
+			exp_neg = *p == '-';
+			p++;
+		}
+		count = 0;
+		while(p < end && *p >= '0' && *p <= '9') {
+			count = count * 10 + (*p - '0');
+			p++;
+		}
+		exp += exp_neg ? -count : count;
+	}
+
+	v = (double)mant;
+	if(exp < 0 && exp >= -22) {
+		v /= pow10[-exp];
+	} else if(exp > 0 && exp <= 22) {
+		v *= pow10[exp];
+	} else if(exp != 0) {
+		v *= pow(10.0, exp);
+	}
+
+	*out = (float)(neg ? -v : v);
+	return p;
+
+}
+
+static const char *parse_int(const char *p, const char *end, int *out, int *found) {
+
+	int neg, v;
+
+	neg = 0;
+	if(p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+
+	v = 0;
+	*found = 0;
+	while(p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p - '0');
+		*found = 1;
+		p++;
+	}
+
+	*out = neg ? -v : v;
+	return p;
+
+}
+
+static int obj_resolve_local(int idx, size_t local_count) {
+
+	// Positive indices are global, negative ones are relative to this chunk
+
+	if(idx > 0) {
+		return idx - 1;
+	}
+	if(idx < 0) {
+		return OBJ_RELATIVE + (int)local_count + idx;
+	}
+	return -1;
+
+}
+
+static void *obj_parse_chunk(void *arg) {
+
+	int n, found, idx, corner[3], first[3], prev[3];
+	float *dst;
+	const char *p, *line_end;
+	obj_chunk *c = (obj_chunk*)arg;
+
+	p = c->start;
+	while(p < c->end) {
+
+		line_end = memchr(p, '\n', c->end - p);
+		line_end = line_end ? line_end : c->end;
+
+		while(p < line_end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+
+		if(line_end - p > 2 && p[0] == 'v' && p[1] == ' ') {
+			c->positions = (float*)grow(c->positions, &c->position_cap, c->position_count + 1, sizeof(float) * 3);
+			dst = c->positions + c->position_count++ * 3;
+			p = parse_float(p + 2, line_end, &dst[0]);
+			p = parse_float(p, line_end, &dst[1]);
+			parse_float(p, line_end, &dst[2]);
+		} else if(line_end - p > 3 && p[0] == 'v' && p[1] == 't' && p[2] == ' ') {
+			c->texcoords = (float*)grow(c->texcoords, &c->texcoord_cap, c->texcoord_count + 1, sizeof(float) * 2);
+			dst = c->texcoords + c->texcoord_count++ * 2;
+			p = parse_float(p + 3, line_end, &dst[0]);
+			parse_float(p, line_end, &dst[1]);
+		} else if(line_end - p > 3 && p[0] == 'v' && p[1] == 'n' && p[2] == ' ') {
+			c->normals = (float*)grow(c->normals, &c->normal_cap, c->normal_count + 1, sizeof(float) * 3);
+			dst = c->normals + c->normal_count++ * 3;
+			p = parse_float(p + 3, line_end, &dst[0]);
+			p = parse_float(p, line_end, &dst[1]);
+			parse_float(p, line_end, &dst[2]);
+		} else if(line_end - p > 2 && p[0] == 'f' && p[1] == ' ') {
+
+			// Polygons are triangulated as a fan around the first corner
+
+			p += 2;
+			n = 0;
+			while(p < line_end) {
+				while(p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+					p++;
+				}
+				if(p >= line_end) {
+					break;
+				}
+				p = parse_int(p, line_end, &idx, &found);
+				if(!found) {
+					break;
+				}
+				corner[0] = obj_resolve_local(idx, c->position_count);
+				corner[1] = -1;
+				corner[2] = -1;
+				if(p < line_end && *p == '/') {
+					p = parse_int(p + 1, line_end, &idx, &found);
+					corner[1] = found ? obj_resolve_local(idx, c->texcoord_count) : -1;
+					if(p < line_end && *p == '/') {
+						p = parse_int(p + 1, line_end, &idx, &found);
+						corner[2] = found ? obj_resolve_local(idx, c->normal_count) : -1;
+					}
+				}
+				if(n == 0) {
+					memcpy(first, corner, sizeof(corner));
+				} else if(n >= 2) {
+					c->corners = (int*)grow(c->corners, &c->corner_cap, c->corner_count + 3, sizeof(int) * 3);
+					memcpy(c->corners + c->corner_count++ * 3, first, sizeof(corner));
+					memcpy(c->corners + c->corner_count++ * 3, prev, sizeof(corner));
+					memcpy(c->corners + c->corner_count++ * 3, corner, sizeof(corner));
+				}
+				memcpy(prev, corner, sizeof(corner));
+				n++;
+			}
+
+		}
+
+		p = line_end + 1;
+
+	}
+
+	return NULL;
+
+}
+
+typedef struct {
+	uint32_t *keys;
+	uint32_t *values;
+	size_t mask;
+	size_t key_size;
+} weld_table;
+
+static uint32_t weld_hash(const uint32_t *key, size_t n) {
+
+	size_t i;
+	uint32_t h = 2166136261u;
+
+	for(i = 0; i < n; i++) {
+		h = (h ^ key[i]) * 16777619u;
+		h ^= h >> 15;
+	}
+
+	return h;
+
+}
+
+static void weld_init(weld_table *t, size_t count, size_t key_size) {
+
+	size_t size = 16;
+
+	while(size < count * 2) {
+		size *= 2;
+	}
+
+	t->mask = size - 1;
+	t->key_size = key_size;
+	t->keys = (uint32_t*)malloc(sizeof(uint32_t) * key_size * size);
+	t->values = (uint32_t*)malloc(sizeof(uint32_t) * size);
+	memset(t->values, 0xff, sizeof(uint32_t) * size);
+
+}
+
+static uint32_t weld_insert(weld_table *t, const uint32_t *key, uint32_t next) {
+
+	size_t slot = weld_hash(key, t->key_size) & t->mask;
+
+	while(t->values[slot] != 0xffffffffu) {
+		if(memcmp(t->keys + slot * t->key_size, key, sizeof(uint32_t) * t->key_size) == 0) {
+			return t->values[slot];
+		}
+		slot = (slot + 1) & t->mask;
+	}
+
+	memcpy(t->keys + slot * t->key_size, key, sizeof(uint32_t) * t->key_size);
+	t->values[slot] = next;
+	return next;
+
+}
+
+static void weld_free(weld_table *t) {
+
+	free(t->keys);
+	free(t->values);
+
+}
+
+static void mesh_layout(dash_mesh_data *mesh, int texcoord, int normal, int color) {
+
+	mesh->stride = 3;
+	mesh->texcoord = -1;
+	mesh->normal = -1;
+	mesh->color = -1;
+
+	if(texcoord) {
+		mesh->texcoord = mesh->stride;
+		mesh->stride += 2;
+	}
+	if(normal) {
+		mesh->normal = mesh->stride;
+		mesh->stride += 3;
+	}
+	if(color) {
+		mesh->color = mesh->stride;
+		mesh->stride += 4;
+	}
+
+}
+
+static int obj_global(int idx, size_t prefix, size_t total) {
+
+	if(idx >= OBJ_RELATIVE / 2) {
+		idx = idx - OBJ_RELATIVE + (int)prefix;
+	}
+
+	return idx >= 0 && (size_t)idx < total ? idx : -1;
+
+}
+
+static int mesh_load_obj(const char *data, size_t size, dash_mesh_data *mesh) {
+
+	int i, t, threads, c, v, valid, keys[3][3], *key;
+	size_t j, total[3], prefix[MAX_THREADS][3], corners;
+	const char *split;
+	float *positions, *texcoords, *normals, *dst;
+	pthread_t tids[MAX_THREADS];
+	obj_chunk chunks[MAX_THREADS];
+	weld_table table;
+	uint32_t index, next;
+
+	threads = thread_count();
+	if(size < 1 << 20) {
+		threads = 1;
+	}
+
+	memset(chunks, 0, sizeof(chunks));
+	split = data;
+	for(t = 0; t < threads; t++) {
+		chunks[t].start = split;
+		split = t == threads - 1 ? data + size : data + size * (t + 1) / threads;
+		if(split < chunks[t].start) {
+			split = chunks[t].start;
+		}
+		while(split < data + size && split[-1] != '\n') {
+			split++;
+		}
+		chunks[t].end = split;
+	}
+
+	for(t = 1; t < threads; t++) {
+		pthread_create(&tids[t], NULL, obj_parse_chunk, &chunks[t]);
+	}
+	obj_parse_chunk(&chunks[0]);
+	for(t = 1; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	// Concatenate per chunk attributes, remembering where each chunk starts
+
+	total[0] = total[1] = total[2] = 0;
+	corners = 0;
+	for(t = 0; t < threads; t++) {
+		prefix[t][0] = total[0];
+		prefix[t][1] = total[1];
+		prefix[t][2] = total[2];
+		total[0] += chunks[t].position_count;
+		total[1] += chunks[t].texcoord_count;
+		total[2] += chunks[t].normal_count;
+		corners += chunks[t].corner_count;
+	}
+
+	positions = (float*)malloc(sizeof(float) * 3 * (total[0] + 1));
+	texcoords = (float*)malloc(sizeof(float) * 2 * (total[1] + 1));
+	normals = (float*)malloc(sizeof(float) * 3 * (total[2] + 1));
+	for(t = 0; t < threads; t++) {
+		memcpy(positions + prefix[t][0] * 3, chunks[t].positions, sizeof(float) * 3 * chunks[t].position_count);
+		memcpy(texcoords + prefix[t][1] * 2, chunks[t].texcoords, sizeof(float) * 2 * chunks[t].texcoord_count);
+		memcpy(normals + prefix[t][2] * 3, chunks[t].normals, sizeof(float) * 3 * chunks[t].normal_count);
+	}
+
+	mesh_layout(mesh, total[1] > 0, total[2] > 0, 0);
+	mesh->indices = (uint32_t*)malloc(sizeof(uint32_t) * corners);
+	mesh->vertices = (float*)malloc(sizeof(float) * mesh->stride * corners);
+	mesh->index_count = 0;
+	mesh->vertex_count = 0;
+
+	weld_init(&table, corners, 3);
+	next = 0;
+
+	for(t = 0; t < threads; t++) {
+		for(j = 0; j + 3 <= chunks[t].corner_count; j += 3) {
+
+			// A triangle with any unresolved position is dropped as a whole
+			// so the index stream stays aligned to triangles
+
+			valid = 1;
+			for(v = 0; v < 3; v++) {
+				for(c = 0; c < 3; c++) {
+					keys[v][c] = obj_global(chunks[t].corners[(j + v) * 3 + c], prefix[t][c], total[c]);
+				}
+				valid = valid && keys[v][0] >= 0;
+			}
+			if(!valid) {
+				continue;
+			}
+
+			for(v = 0; v < 3; v++) {
+				key = keys[v];
+				index = weld_insert(&table, (uint32_t*)key, next);
+				if(index == next) {
+					dst = mesh->vertices + next * mesh->stride;
+					memcpy(dst, positions + key[0] * 3, sizeof(float) * 3);
+					if(mesh->texcoord >= 0) {
+						dst[mesh->texcoord] = key[1] >= 0 ? texcoords[key[1] * 2] : 0.0f;
+						dst[mesh->texcoord + 1] = key[1] >= 0 ? texcoords[key[1] * 2 + 1] : 0.0f;
+					}
+					if(mesh->normal >= 0) {
+						for(i = 0; i < 3; i++) {
+							dst[mesh->normal + i] = key[2] >= 0 ? normals[key[2] * 3 + i] : 0.0f;
+						}
+					}
+					next++;
+				}
+				mesh->indices[mesh->index_count++] = index;
+			}
+
+		}
+	}
+
+	mesh->vertex_count = next;
+	mesh->vertices = (float*)realloc(mesh->vertices, sizeof(float) * mesh->stride * (next ? next : 1));
+
+	weld_free(&table);
+	free(positions);
+	free(texcoords);
+	free(normals);
+	for(t = 0; t < threads; t++) {
+		free(chunks[t].positions);
+		free(chunks[t].texcoords);
+		free(chunks[t].normals);
+		free(chunks[t].corners);
+	}
+
+	return 1;
+
+}
+
+enum {
+	PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+	PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64
+};
+
+typedef struct {
+	char name[32];
+	int type;
+	int is_list;
+	int count_type;
+} ply_property;
+
+typedef struct {
+	char name[32];
+	size_t count;
+	int property_count;
+	ply_property properties[32];
+} ply_element;
+
+typedef struct {
+	const unsigned char *data;
+	size_t stride;
+	int big_endian;
+	int offsets[13];
+	int types[13];
+	dash_mesh_data *mesh;
+	size_t start;
+	size_t end;
+} ply_job;
+
+static const int ply_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+static int ply_type(const char *name) {
+
+	int i;
+	static const char *names[][2] = {
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" },
+		{ "ushort", "uint16" }, { "int", "int32" }, { "uint", "uint32" },
+		{ "float", "float32" }, { "double", "float64" }
+	};
+
+	for(i = 0; i < 8; i++) {
+		if(strcmp(name, names[i][0]) == 0 || strcmp(name, names[i][1]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+
+}
+
+static double ply_read(const unsigned char *p, int type, int big_endian) {
+
+	int i, n;
+	unsigned char b[8];
+	float f;
+	double d;
+
+	n = ply_sizes[type];
+	for(i = 0; i < n; i++) {
+		b[i] = big_endian ? p[n - 1 - i] : p[i];
+	}
+
+	switch(type) {
+		case PLY_INT8:
+			return (int8_t)b[0];
+		case PLY_UINT8:
+			return b[0];
+		case PLY_INT16:
+			return (int16_t)(b[0] | (b[1] << 8));
+		case PLY_UINT16:
+			return (uint16_t)(b[0] | (b[1] << 8));
+		case PLY_INT32:
+			return (int32_t)(b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24));
+		case PLY_UINT32:
+			return (uint32_t)(b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24));
+		case PLY_FLOAT32:
+			memcpy(&f, b, 4);
+			return f;
+		default:
+			memcpy(&d, b, 8);
+			return d;
+	}
+
+}
+
+static void *ply_convert(void *arg) {
+
+	int k;
+	size_t i;
+	float *dst;
+	const unsigned char *src;
+	ply_job *job = (ply_job*)arg;
+	dash_mesh_data *mesh = job->mesh;
+
+	// Slots 0-2 position, 3-4 texcoord, 5-7 normal, 8-11 color
+
+	for(i = job->start; i < job->end; i++) {
+		src = job->data + i * job->stride;
+		dst = mesh->vertices + i * mesh->stride;
+		for(k = 0; k < 3; k++) {
+			dst[k] = job->offsets[k] >= 0 ? ply_read(src + job->offsets[k], job->types[k], job->big_endian) : 0.0f;
+		}
+		for(k = 0; k < 2 && mesh->texcoord >= 0; k++) {
+			dst[mesh->texcoord + k] = ply_read(src + job->offsets[3 + k], job->types[3 + k], job->big_endian);
+		}
+		for(k = 0; k < 3 && mesh->normal >= 0; k++) {
+			dst[mesh->normal + k] = ply_read(src + job->offsets[5 + k], job->types[5 + k], job->big_endian);
+		}
+		for(k = 0; k < 4 && mesh->color >= 0; k++) {
+			if(job->offsets[8 + k] < 0) {
+				dst[mesh->color + k] = 1.0f;
+			} else {
+				dst[mesh->color + k] = ply_read(src + job->offsets[8 + k], job->types[8 + k], job->big_endian);
+				if(job->types[8 + k] == PLY_UINT8) {
+					dst[mesh->color + k] /= 255.0f;
+				}
+			}
+		}
+	}
+
+	return NULL;
+
+}
+
+static int ply_slot(const char *name) {
+
+	int i;
+	static const char *names[][3] = {
+		{ "x", "x", "x" }, { "y", "y", "y" }, { "z", "z", "z" },
+		{ "u", "s", "texture_u" }, { "v", "t", "texture_v" },
+		{ "nx", "nx", "nx" }, { "ny", "ny", "ny" }, { "nz", "nz", "nz" },
+		{ "red", "r", "diffuse_red" }, { "green", "g", "diffuse_green" },
+		{ "blue", "b", "diffuse_blue" }, { "alpha", "a", "diffuse_alpha" }
+	};
+
+	for(i = 0; i < 12; i++) {
+		if(strcmp(name, names[i][0]) == 0 || strcmp(name, names[i][1]) == 0 ||
+			strcmp(name, names[i][2]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+
+}
+
+static int mesh_load_ply(const char *filename, const unsigned char *data, size_t size, dash_mesh_data *mesh) {
+
+	int e, k, t, slot, threads, big_endian, element_count, n, count;
+	size_t i, j, stride, offset, face_corners;
+	char line[256], word[3][32];
+	const unsigned char *p, *end, *header_end;
+	ply_element elements[8], *el;
+	ply_property *prop;
+	ply_job jobs[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	uint32_t *remap, *indices, first, prev, idx;
+	weld_table table;
+	float *welded;
+
+	header_end = (const unsigned char*)memmem(data, size, "end_header\n", 11);
+	if(header_end == NULL) {
+		fprintf(stderr, "%s: missing ply header\n", filename);
+		return 0;
+	}
+	p = data;
+	end = data + size;
+	header_end += 11;
+
+	// Parse the ascii header into elements and properties
+
+	big_endian = -1;
+	element_count = 0;
+	while(p < header_end) {
+		n = 0;
+		while(p < header_end && *p != '\n' && n < 255) {
+			line[n++] = *p++;
+		}
+		line[n] = '\0';
+		p++;
+		word[0][0] = word[1][0] = word[2][0] = '\0';
+		count = sscanf(line, "%31s %31s %31s", word[0], word[1], word[2]);
+		if(count >= 2 && strcmp(word[0], "format") == 0) {
+			if(strcmp(word[1], "binary_little_endian") == 0) {
+				big_endian = 0;
+			} else if(strcmp(word[1], "binary_big_endian") == 0) {
+				big_endian = 1;
+			}
+		} else if(count == 3 && strcmp(word[0], "element") == 0) {
+
+			// Dropping an element or property would misalign the binary body
+
+			if(element_count == 8) {
+				fprintf(stderr, "%s: too many ply elements\n", filename);
+				return 0;
+			}
+			el = &elements[element_count++];
+			strcpy(el->name, word[1]);
+			el->count = strtoull(word[2], NULL, 10);
+			el->property_count = 0;
+		} else if(count >= 3 && strcmp(word[0], "property") == 0 && element_count > 0) {
+			el = &elements[element_count - 1];
+			if(el->property_count == 32) {
+				fprintf(stderr, "%s: too many ply properties\n", filename);
+				return 0;
+			}
+			prop = &el->properties[el->property_count++];
+			if(strcmp(word[1], "list") == 0) {
+				prop->is_list = 1;
+				prop->count_type = ply_type(word[2]);
+				sscanf(line, "%*s %*s %*s %31s %31s", word[1], word[2]);
+				prop->type = ply_type(word[1]);
+				strcpy(prop->name, word[2]);
+			} else {
+				prop->is_list = 0;
+				prop->type = ply_type(word[1]);
+				strcpy(prop->name, word[2]);
+			}
+			if(prop->type < 0 || (prop->is_list && prop->count_type < 0)) {
+				fprintf(stderr, "%s: unknown ply property type\n", filename);
+				return 0;
+			}
+		}
+	}
+
+	if(big_endian < 0) {
+		fprintf(stderr, "%s: only binary ply files are supported\n", filename);
+		return 0;
+	}
+
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->vertex_count = 0;
+	mesh->index_count = 0;
+	mesh_layout(mesh, 0, 0, 0);
+
+	p = header_end;
+	face_corners = 0;
+	for(e = 0; e < element_count; e++) {
+
+		el = &elements[e];
+
+		if(strcmp(el->name, "vertex") == 0) {
+
+			memset(jobs[0].offsets, 0xff, sizeof(jobs[0].offsets));
+			stride = 0;
+			for(k = 0; k < el->property_count; k++) {
+				prop = &el->properties[k];
+				if(prop->is_list) {
+					fprintf(stderr, "%s: list properties on vertices are not supported\n", filename);
+					return 0;
+				}
+				slot = ply_slot(prop->name);
+				if(slot >= 0) {
+					jobs[0].offsets[slot] = stride;
+					jobs[0].types[slot] = prop->type;
+				}
+				stride += ply_sizes[prop->type];
+			}
+
+			if(stride > 0 && el->count > (size_t)(end - p) / stride) {
+				fprintf(stderr, "%s is truncated\n", filename);
+				free(mesh->indices);
+				return 0;
+			}
+
+			mesh_layout(mesh,
+				jobs[0].offsets[3] >= 0 && jobs[0].offsets[4] >= 0,
+				jobs[0].offsets[5] >= 0 && jobs[0].offsets[6] >= 0 && jobs[0].offsets[7] >= 0,
+				jobs[0].offsets[8] >= 0 && jobs[0].offsets[9] >= 0 && jobs[0].offsets[10] >= 0);
+			mesh->vertex_count = el->count;
+			mesh->vertices = (float*)malloc(sizeof(float) * mesh->stride * (el->count + 1));
+
+			// Fixed size records, so every thread converts its own range
+
+			threads = el->count < 65536 ? 1 : thread_count();
+			for(t = 0; t < threads; t++) {
+				jobs[t] = jobs[0];
+				jobs[t].data = p;
+				jobs[t].stride = stride;
+				jobs[t].big_endian = big_endian;
+				jobs[t].mesh = mesh;
+				jobs[t].start = el->count * t / threads;
+				jobs[t].end = el->count * (t + 1) / threads;
+			}
+			for(t = 1; t < threads; t++) {
+				pthread_create(&tids[t], NULL, ply_convert, &jobs[t]);
+			}
+			ply_convert(&jobs[0]);
+			for(t = 1; t < threads; t++) {
+				pthread_join(tids[t], NULL);
+			}
+
+			p += stride * el->count;
+			continue;
+
+		}
+
+		for(i = 0; i < el->count; i++) {
+			for(k = 0; k < el->property_count; k++) {
+				prop = &el->properties[k];
+				if(!prop->is_list && ply_sizes[prop->type] <= end - p) {
+					p += ply_sizes[prop->type];
+					continue;
+				}
+				if(!prop->is_list || ply_sizes[prop->count_type] > end - p) {
+					fprintf(stderr, "%s is truncated\n", filename);
+					free(mesh->vertices);
+					free(mesh->indices);
+					return 0;
+				}
+				n = (int)ply_read(p, prop->count_type, big_endian);
+				p += ply_sizes[prop->count_type];
+				if(n < 0) {
+					fprintf(stderr, "%s has a negative list count\n", filename);
+					free(mesh->vertices);
+					free(mesh->indices);
+					return 0;
+				}
+				if((size_t)n * ply_sizes[prop->type] > (size_t)(end - p)) {
+					fprintf(stderr, "%s is truncated\n", filename);
+					free(mesh->vertices);
+					free(mesh->indices);
+					return 0;
+				}
+				if(strcmp(el->name, "face") == 0 && strncmp(prop->name, "vertex_ind", 10) == 0 && n >= 3) {
+					mesh->indices = (uint32_t*)grow(mesh->indices, &face_corners,
+						mesh->index_count + (n - 2) * 3, sizeof(uint32_t));
+					first = (uint32_t)ply_read(p, prop->type, big_endian);
+					prev = (uint32_t)ply_read(p + ply_sizes[prop->type], prop->type, big_endian);
+					for(j = 2; j < n; j++) {
+						idx = (uint32_t)ply_read(p + j * ply_sizes[prop->type], prop->type, big_endian);
+						mesh->indices[mesh->index_count++] = first;
+						mesh->indices[mesh->index_count++] = prev;
+						mesh->indices[mesh->index_count++] = idx;
+						prev = idx;
+					}
+				}
+				p += (size_t)n * ply_sizes[prop->type];
+			}
+		}
+
+	}
+
+	if(mesh->vertices == NULL) {
+		fprintf(stderr, "%s has no vertex element\n", filename);
+		free(mesh->indices);
+		return 0;
+	}
+
+	// Weld vertices with identical attributes and drop out of range faces
+
+	remap = (uint32_t*)malloc(sizeof(uint32_t) * (mesh->vertex_count + 1));
+	welded = (float*)malloc(sizeof(float) * mesh->stride * (mesh->vertex_count + 1));
+	weld_init(&table, mesh->vertex_count, mesh->stride);
+	offset = 0;
+	for(i = 0; i < mesh->vertex_count; i++) {
+		remap[i] = weld_insert(&table, (uint32_t*)(mesh->vertices + i * mesh->stride), offset);
+		if(remap[i] == offset) {
+			memcpy(welded + offset * mesh->stride, mesh->vertices + i * mesh->stride, sizeof(float) * mesh->stride);
+			offset++;
+		}
+	}
+	weld_free(&table);
+
+	indices = mesh->indices;
+	j = 0;
+	for(i = 0; i + 2 < mesh->index_count; i += 3) {
+		if(indices[i] >= mesh->vertex_count || indices[i + 1] >= mesh->vertex_count ||
+			indices[i + 2] >= mesh->vertex_count) {
+			continue;
+		}
+		indices[j++] = remap[indices[i]];
+		indices[j++] = remap[indices[i + 1]];
+		indices[j++] = remap[indices[i + 2]];
+	}
+
+	free(mesh->vertices);
+	free(remap);
+	mesh->vertices = welded;
+	mesh->vertex_count = offset;
+	mesh->index_count = j;
+
+	return 1;
+
+}
+
+int dash_mesh_load(const char *filename, dash_mesh_data *mesh) {
+
+	int fd, ok;
+	struct stat st;
+	char *map;
+
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->vertex_count = 0;
+	mesh->index_count = 0;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open %s for reading\n", filename);
+		return 0;
+	}
+
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		fprintf(stderr, "%s is empty\n", filename);
+		close(fd);
+		return 0;
+	}
+
+	map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", filename);
+		return 0;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	if(st.st_size > 4 && memcmp(map, "ply", 3) == 0) {
+		ok = mesh_load_ply(filename, (const unsigned char*)map, st.st_size, mesh);
+	} else {
+		ok = mesh_load_obj(map, st.st_size, mesh);
+	}
+
+	munmap(map, st.st_size);
+	return ok;
+
+}
+
+void dash_mesh_data_free(dash_mesh_data *mesh) {
+
+	free(mesh->vertices);
+	free(mesh->indices);
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+
+}
+
+/******************************************************************************/
+/** Mesh Optimization                                                        **/
+/******************************************************************************/
+
+/*
+	Triangles are reordered with Tipsify (Sander, Nehab and Barczak 2007) for
+	the post-transform vertex cache. Its output falls into clusters wherever it
+	had to jump to a vertex outside the cache, and those clusters are then
+	sorted so the ones facing away from the mesh center come first, which
+	cuts overdraw without touching the order inside a cluster. Finally the
+	vertices are renumbered in first use order so fetches walk the vertex
+	buffer forwards.
+*/
+
+typedef struct {
+	size_t start;
+	size_t count;
+	float sort_key;
+} mesh_cluster;
+
+void dash_mesh_analyze(const uint32_t *indices, size_t index_count, size_t vertex_count, int cache_size, dash_cache_stats *stats) {
+
+	size_t i, misses, head;
+	int k, hit;
+	uint32_t *fifo;
+
+	fifo = (uint32_t*)malloc(sizeof(uint32_t) * cache_size);
+	memset(fifo, 0xff, sizeof(uint32_t) * cache_size);
+	misses = 0;
+	head = 0;
+
+	for(i = 0; i < index_count; i++) {
+		hit = 0;
+		for(k = 0; k < cache_size; k++) {
+			if(fifo[k] == indices[i]) {
+				hit = 1;
+				break;
+			}
+		}
+		if(!hit) {
+			fifo[head] = indices[i];
+			head = (head + 1) % cache_size;
+			misses++;
+		}
+	}
+
+	stats->acmr = index_count ? (float)misses / (index_count / 3) : 0.0f;
+	stats->atvr = vertex_count ? (float)misses / vertex_count : 0.0f;
+	free(fifo);
+
+}
+
+static size_t tipsify(const uint32_t *indices, size_t index_count, size_t vertex_count, int cache_size,
+	uint32_t *out, size_t *boundaries, size_t *boundary_count) {
+
+	size_t i, t, v, tri_count, emitted_count, cursor, dead_top, cand_count;
+	long f, best, p, best_p;
+	uint32_t *offsets, *adjacency, *live, *cache_time, *dead, *cand;
+	unsigned char *emitted;
+	uint32_t stamp;
+
+	tri_count = index_count / 3;
+	offsets = (uint32_t*)calloc(vertex_count + 1, sizeof(uint32_t));
+	live = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	cache_time = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	adjacency = (uint32_t*)malloc(sizeof(uint32_t) * (tri_count * 3 + 1));
+	dead = (uint32_t*)malloc(sizeof(uint32_t) * (tri_count * 3 + 1));
+	cand = (uint32_t*)malloc(sizeof(uint32_t) * (tri_count * 3 + 1));
+	emitted = (unsigned char*)calloc(tri_count + 1, 1);
+
+	// Triangle adjacency per vertex as a compressed list
+
+	for(i = 0; i < tri_count * 3; i++) {
+		live[indices[i]]++;
+	}
+	for(v = 0; v < vertex_count; v++) {
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	for(v = 0; v < vertex_count; v++) {
+		live[v] = 0;
+	}
+	for(i = 0; i < tri_count * 3; i++) {
+		v = indices[i];
+		adjacency[offsets[v] + live[v]++] = i / 3;
+	}
+
+	stamp = cache_size + 1;
+	cursor = 0;
+	dead_top = 0;
+	emitted_count = 0;
+	*boundary_count = 0;
+	f = tri_count ? indices[0] : -1;
+
+	while(f >= 0) {
+
+		cand_count = 0;
+		for(i = offsets[f]; i < offsets[f + 1]; i++) {
+			t = adjacency[i];
+			if(emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			for(v = 0; v < 3; v++) {
+				uint32_t vert = indices[t * 3 + v];
+				out[emitted_count * 3 + v] = vert;
+				dead[dead_top++] = vert;
+				cand[cand_count++] = vert;
+				live[vert]--;
+				if(stamp - cache_time[vert] > (uint32_t)cache_size) {
+					cache_time[vert] = stamp++;
+				}
+			}
+			emitted_count++;
+		}
+
+		// Prefer a candidate that will still be in the cache after its fan
+
+		best = -1;
+		best_p = -1;
+		for(i = 0; i < cand_count; i++) {
+			v = cand[i];
+			if(live[v] == 0) {
+				continue;
+			}
+			p = 0;
+			if(stamp - cache_time[v] + 2 * live[v] <= (uint32_t)cache_size) {
+				p = stamp - cache_time[v];
+			}
+			if(p > best_p) {
+				best_p = p;
+				best = v;
+			}
+		}
+
+		if(best < 0) {
+			while(dead_top > 0 && best < 0) {
+				v = dead[--dead_top];
+				if(live[v] > 0) {
+					best = v;
+				}
+			}
+			while(best < 0 && cursor < vertex_count) {
+				if(live[cursor] > 0) {
+					best = cursor;
+				}
+				cursor++;
+			}
+			if(best >= 0 && emitted_count < tri_count) {
+				boundaries[(*boundary_count)++] = emitted_count;
+			}
+		}
+
+		f = best;
+
+	}
+
+	free(offsets);
+	free(live);
+	free(cache_time);
+	free(adjacency);
+	free(dead);
+	free(cand);
+	free(emitted);
+
+	return emitted_count * 3;
+
+}
+
+static int cluster_compare(const void *a, const void *b) {
+
+	const mesh_cluster *ca = (const mesh_cluster*)a;
+	const mesh_cluster *cb = (const mesh_cluster*)b;
+
+	if(ca->sort_key != cb->sort_key) {
+		return ca->sort_key < cb->sort_key ? 1 : -1;
+	}
+	return ca->start < cb->start ? -1 : 1;
+
+}
+
+static void sort_clusters(dash_mesh_data *mesh, uint32_t *indices, size_t index_count,
+	size_t *boundaries, size_t boundary_count) {
+
+	size_t i, j, k, n, tri_count;
+	float center[3], cc[3], normal[3], e1[3], e2[3], *p0, *p1, *p2, len;
+	mesh_cluster *clusters;
+	uint32_t *sorted;
+
+	tri_count = index_count / 3;
+	n = boundary_count + 1;
+	clusters = (mesh_cluster*)malloc(sizeof(mesh_cluster) * n);
+	for(i = 0; i < n; i++) {
+		clusters[i].start = i == 0 ? 0 : boundaries[i - 1];
+		clusters[i].count = (i == n - 1 ? tri_count : boundaries[i]) - clusters[i].start;
+	}
+
+	center[0] = center[1] = center[2] = 0.0f;
+	for(i = 0; i < mesh->vertex_count; i++) {
+		for(k = 0; k < 3; k++) {
+			center[k] += mesh->vertices[i * mesh->stride + k] / mesh->vertex_count;
+		}
+	}
+
+	for(i = 0; i < n; i++) {
+
+		cc[0] = cc[1] = cc[2] = 0.0f;
+		normal[0] = normal[1] = normal[2] = 0.0f;
+
+		for(j = clusters[i].start; j < clusters[i].start + clusters[i].count; j++) {
+			p0 = mesh->vertices + indices[j * 3] * mesh->stride;
+			p1 = mesh->vertices + indices[j * 3 + 1] * mesh->stride;
+			p2 = mesh->vertices + indices[j * 3 + 2] * mesh->stride;
+			for(k = 0; k < 3; k++) {
+				cc[k] += (p0[k] + p1[k] + p2[k]) / 3.0f;
+				e1[k] = p1[k] - p0[k];
+				e2[k] = p2[k] - p0[k];
+			}
+			normal[0] += e1[1] * e2[2] - e1[2] * e2[1];
+			normal[1] += e1[2] * e2[0] - e1[0] * e2[2];
+			normal[2] += e1[0] * e2[1] - e1[1] * e2[0];
+		}
+
+		len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		len = len > 0.0f ? len : 1.0f;
+		clusters[i].sort_key = 0.0f;
+		for(k = 0; k < 3; k++) {
+			cc[k] /= clusters[i].count;
+			clusters[i].sort_key += (cc[k] - center[k]) * normal[k] / len;
+		}
+
+	}
+
+	qsort(clusters, n, sizeof(mesh_cluster), cluster_compare);
+
+	sorted = (uint32_t*)malloc(sizeof(uint32_t) * index_count);
+	j = 0;
+	for(i = 0; i < n; i++) {
+		memcpy(sorted + j, indices + clusters[i].start * 3, sizeof(uint32_t) * clusters[i].count * 3);
+		j += clusters[i].count * 3;
+	}
+	memcpy(indices, sorted, sizeof(uint32_t) * index_count);
+
+	free(sorted);
+	free(clusters);
+
+}
+
+static void reorder_vertices(dash_mesh_data *mesh) {
+
+	size_t i, next;
+	uint32_t *remap;
+	float *vertices;
+
+	remap = (uint32_t*)malloc(sizeof(uint32_t) * (mesh->vertex_count + 1));
+	memset(remap, 0xff, sizeof(uint32_t) * (mesh->vertex_count + 1));
+	vertices = (float*)malloc(sizeof(float) * mesh->stride * (mesh->vertex_count + 1));
+
+	next = 0;
+	for(i = 0; i < mesh->index_count; i++) {
+		if(remap[mesh->indices[i]] == 0xffffffffu) {
+			remap[mesh->indices[i]] = next;
+			memcpy(vertices + next * mesh->stride, mesh->vertices + mesh->indices[i] * mesh->stride,
+				sizeof(float) * mesh->stride);
+			next++;
+		}
+		mesh->indices[i] = remap[mesh->indices[i]];
+	}
+
+	free(mesh->vertices);
+	free(remap);
+	mesh->vertices = vertices;
+	mesh->vertex_count = next;
+
+}
+
+void dash_mesh_optimize(dash_mesh_data *mesh, int cache_size) {
+
+	size_t boundary_count;
+	size_t *boundaries;
+	uint32_t *indices;
+
+	if(mesh->index_count < 3) {
+		return;
+	}
+
+	indices = (uint32_t*)malloc(sizeof(uint32_t) * mesh->index_count);
+	boundaries = (size_t*)malloc(sizeof(size_t) * (mesh->index_count / 3 + 1));
+
+	mesh->index_count = tipsify(mesh->indices, mesh->index_count, mesh->vertex_count,
+		cache_size, indices, boundaries, &boundary_count);
+	sort_clusters(mesh, indices, mesh->index_count, boundaries, boundary_count);
+
+	free(mesh->indices);
+	free(boundaries);
+	mesh->indices = indices;
+
+	reorder_vertices(mesh);
+
+}
+
+/******************************************************************************/
+/** Vertex Arrays                                                            **/
+/******************************************************************************/
+
+/*
+	A mesh records its attribute layout once into a vertex array object per
+	submesh, taken from GL 3.0 or ARB_vertex_array_object, APPLE on older
+	Macs, or OES_vertex_array_object on GLES2. Plain GL 2.0 gets a software
+	stand in that remembers which submesh was bound last and skips the
+	rebind when the same one is drawn again. Anything that binds an element
+	buffer or sets attribute pointers itself must call dash_mesh_unbind
+	first, or it would write into whichever array is still bound.
+*/
+
+#define VAO_NONE 0
+#define VAO_CORE 1
+#define VAO_APPLE 2
+#define VAO_OES 3
+
+static int vao_mode = -1;
+static GLuint vao_current;
+static dash_submesh *layout_current;
+static uint32_t layout_enabled;
+
+static int vao_support() {
+
+	if(vao_mode != -1) {
+		return vao_mode;
+	}
+
+	#ifdef GL_ES_VERSION_2_0
+	vao_mode = dash_has_extension("GL_OES_vertex_array_object") ? VAO_OES : VAO_NONE;
+	#else
+	if(GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) {
+		vao_mode = VAO_CORE;
+	} else if(GLEW_APPLE_vertex_array_object) {
+		vao_mode = VAO_APPLE;
+	} else {
+		vao_mode = VAO_NONE;
+	}
+	#endif
+
+	return vao_mode;
+
+}
+
+static void vao_gen(GLuint *vao) {
+
+	switch(vao_support()) {
+		#ifdef GL_ES_VERSION_2_0
+		case VAO_OES:
+			glGenVertexArraysOES(1, vao);
+		break;
+		#else
+		case VAO_CORE:
+			glGenVertexArrays(1, vao);
+		break;
+		case VAO_APPLE:
+			glGenVertexArraysAPPLE(1, vao);
+		break;
+		#endif
+		default:
+			*vao = 0;
+		break;
+	}
+
+}
+
+static void vao_bind(GLuint vao) {
+
+	switch(vao_support()) {
+		#ifdef GL_ES_VERSION_2_0
+		case VAO_OES:
+			glBindVertexArrayOES(vao);
+		break;
+		#else
+		case VAO_CORE:
+			glBindVertexArray(vao);
+		break;
+		case VAO_APPLE:
+			glBindVertexArrayAPPLE(vao);
+		break;
+		#endif
+	}
+
+	vao_current = vao;
+
+}
+
+static void vao_delete(GLuint *vao) {
+
+	switch(vao_support()) {
+		#ifdef GL_ES_VERSION_2_0
+		case VAO_OES:
+			glDeleteVertexArraysOES(1, vao);
+		break;
+		#else
+		case VAO_CORE:
+			glDeleteVertexArrays(1, vao);
+		break;
+		case VAO_APPLE:
+			glDeleteVertexArraysAPPLE(1, vao);
+		break;
+		#endif
+	}
+
+	*vao = 0;
+
+}
+
+void dash_mesh_unbind() {
+
+	int i;
+
+	if(vao_current != 0) {
+		vao_bind(0);
+	}
+
+	// The software layout leaves its arrays enabled on the default array,
+	// where they would still point into the last mesh's buffer
+
+	for(i = 0; i < 32 && layout_enabled != 0; i++) {
+		if(layout_enabled & (1u << i)) {
+			glDisableVertexAttribArray(i);
+			layout_enabled &= ~(1u << i);
+		}
+	}
+	layout_current = NULL;
+
+}
+
+/******************************************************************************/
+/** Mesh Buffers                                                             **/
+/******************************************************************************/
+
+/*
+	Index buffers use the narrowest type that can address every vertex, so a
+	cube draws from bytes and most models from shorts. 32 bit indices are core
+	on desktop GL but optional on GLES2, and without OES_element_index_uint a
+	large mesh is split into submeshes of at most 65536 vertices each. GLES2
+	has no base vertex either, so every submesh gets its own copy of the
+	vertices it touches and draws with attribute pointers offset to its range.
+*/
+
+#define SUBMESH_VERTICES 65536
+
+static int index_uint_supported() {
+
+	#ifdef GL_ES_VERSION_2_0
+	return dash_has_extension("GL_OES_element_index_uint");
+	#else
+	return 1;
+	#endif
+
+}
+
+static size_t index_size(GLenum type) {
+
+	switch(type) {
+		case GL_UNSIGNED_BYTE:
+			return 1;
+		case GL_UNSIGNED_SHORT:
+			return 2;
+	}
+	return 4;
+
+}
+
+GLenum dash_index_type(size_t vertex_count) {
+
+	if(vertex_count <= 256) {
+		return GL_UNSIGNED_BYTE;
+	} else if(vertex_count <= 65536) {
+		return GL_UNSIGNED_SHORT;
+	}
+	return GL_UNSIGNED_INT;
+
+}
+
+static void *narrow_indices(const uint32_t *indices, size_t count, GLenum type) {
+
+	size_t i;
+	uint8_t *bytes;
+	uint16_t *shorts;
+
+	if(type == GL_UNSIGNED_BYTE) {
+		bytes = (uint8_t*)malloc(count + 1);
+		for(i = 0; i < count; i++) {
+			bytes[i] = (uint8_t)indices[i];
+		}
+		return bytes;
+	}
+
+	shorts = (uint16_t*)malloc(count * sizeof(uint16_t) + 1);
+	for(i = 0; i < count; i++) {
+		shorts[i] = (uint16_t)indices[i];
+	}
+	return shorts;
+
+}
+
+static int mesh_split(const dash_mesh_data *data, dash_mesh *mesh) {
+
+	size_t i, j, tri_count, vertex_stride;
+	size_t order_count, local_count, sub_start, sub_indices, sub_cap;
+	uint32_t v, sub, *stamp, *remap, *order;
+	uint16_t *local;
+	float *vertices;
+
+	vertex_stride = data->stride * sizeof(float);
+	tri_count = data->index_count / 3;
+
+	stamp = (uint32_t*)calloc(data->vertex_count + 1, sizeof(uint32_t));
+	remap = (uint32_t*)malloc((data->vertex_count + 1) * sizeof(uint32_t));
+	order = (uint32_t*)malloc((data->index_count + 1) * sizeof(uint32_t));
+	local = (uint16_t*)malloc((data->index_count + 1) * sizeof(uint16_t));
+
+	sub_cap = 0;
+	mesh->submeshes = NULL;
+	mesh->submesh_count = 0;
+
+	// Triangles are taken in order and a new submesh starts whenever the
+	// next one could push the current past 16 bit range. Stamps hold the
+	// submesh number plus one so the remap never needs clearing
+
+	order_count = 0;
+	local_count = 0;
+	sub_start = 0;
+	sub_indices = 0;
+	sub = 1;
+
+	for(i = 0; i <= tri_count; i++) {
+
+		if(i == tri_count || local_count + 3 > SUBMESH_VERTICES) {
+			if(sub_indices > 0) {
+				mesh->submeshes = (dash_submesh*)grow(mesh->submeshes, &sub_cap,
+					mesh->submesh_count + 1, sizeof(dash_submesh));
+				mesh->submeshes[mesh->submesh_count].index_count = sub_indices;
+				mesh->submeshes[mesh->submesh_count].index_offset = (i * 3 - sub_indices) * sizeof(uint16_t);
+				mesh->submeshes[mesh->submesh_count].vertex_offset = sub_start * vertex_stride;
+				mesh->submeshes[mesh->submesh_count].vao = 0;
+				mesh->submesh_count++;
+			}
+			if(i == tri_count) {
+				break;
+			}
+			sub_start = order_count;
+			local_count = 0;
+			sub_indices = 0;
+			sub++;
+		}
+
+		for(j = 0; j < 3; j++) {
+			v = data->indices[i * 3 + j];
+			if(stamp[v] != sub) {
+				stamp[v] = sub;
+				remap[v] = local_count++;
+				order[order_count++] = v;
+			}
+			local[i * 3 + j] = (uint16_t)remap[v];
+		}
+		sub_indices += 3;
+
+	}
+
+	vertices = (float*)malloc(order_count * vertex_stride + 1);
+	for(i = 0; i < order_count; i++) {
+		memcpy(vertices + i * data->stride, data->vertices + (size_t)order[i] * data->stride, vertex_stride);
+	}
+
+	mesh->index_type = GL_UNSIGNED_SHORT;
+	mesh->index_count = tri_count * 3;
+	mesh->vertex_count = order_count;
+
+	glGenBuffers(1, &mesh->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBufferData(GL_ARRAY_BUFFER, order_count * vertex_stride, vertices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &mesh->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, tri_count * 3 * sizeof(uint16_t), local, GL_STATIC_DRAW);
+
+	free(vertices);
+	free(local);
+	free(order);
+	free(remap);
+	free(stamp);
+
+	return 1;
+
+}
+
+int dash_mesh_upload(const dash_mesh_data *data, dash_mesh *mesh) {
+
+	GLenum type;
+	void *indices;
+
+	dash_mesh_unbind();
+	mesh->stride = data->stride;
+	mesh->texcoord = data->texcoord;
+	mesh->normal = data->normal;
+	mesh->color = data->color;
+
+	type = dash_index_type(data->vertex_count);
+	if(type == GL_UNSIGNED_INT && !index_uint_supported()) {
+		return mesh_split(data, mesh);
+	}
+
+	mesh->index_type = type;
+	mesh->index_count = data->index_count;
+	mesh->vertex_count = data->vertex_count;
+	mesh->submesh_count = 1;
+	mesh->submeshes = (dash_submesh*)calloc(1, sizeof(dash_submesh));
+	mesh->submeshes[0].index_count = data->index_count;
+
+	glGenBuffers(1, &mesh->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBufferData(GL_ARRAY_BUFFER, data->vertex_count * data->stride * sizeof(float), data->vertices, GL_STATIC_DRAW);
+
+	indices = (void*)data->indices;
+	if(type != GL_UNSIGNED_INT) {
+		indices = narrow_indices(data->indices, data->index_count, type);
+	}
+
+	glGenBuffers(1, &mesh->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->index_count * index_size(type), indices, GL_STATIC_DRAW);
+
+	if(indices != (void*)data->indices) {
+		free(indices);
+	}
+
+	return 1;
+
+}
+
+static void mesh_attrib_toggle(dash_mesh *mesh, GLint *locations, int enable) {
+
+	int i;
+	int present[DASH_SEMANTIC_COUNT];
+
+	present[DASH_POSITION] = 1;
+	present[DASH_TEXCOORD] = mesh->texcoord >= 0;
+	present[DASH_COLOR] = mesh->color >= 0;
+
+	for(i = 0; i < DASH_SEMANTIC_COUNT; i++) {
+		if(!present[i] || locations[i] < 0) {
+			continue;
+		}
+		if(enable) {
+			glEnableVertexAttribArray(locations[i]);
+		} else {
+			glDisableVertexAttribArray(locations[i]);
+		}
+	}
+
+}
+
+static void mesh_attrib_pointers(dash_mesh *mesh, GLint *locations, size_t base) {
+
+	GLsizei stride = mesh->stride * sizeof(float);
+
+	if(locations[DASH_POSITION] >= 0) {
+		glVertexAttribPointer(locations[DASH_POSITION], 3, GL_FLOAT, GL_FALSE,
+			stride, (void*)base);
+	}
+	if(mesh->texcoord >= 0 && locations[DASH_TEXCOORD] >= 0) {
+		glVertexAttribPointer(locations[DASH_TEXCOORD], 2, GL_FLOAT, GL_FALSE,
+			stride, (void*)(base + mesh->texcoord * sizeof(float)));
+	}
+	if(mesh->color >= 0 && locations[DASH_COLOR] >= 0) {
+		glVertexAttribPointer(locations[DASH_COLOR], 4, GL_FLOAT, GL_FALSE,
+			stride, (void*)(base + mesh->color * sizeof(float)));
+	}
+
+}
+
+void dash_mesh_draw(dash_mesh *mesh, GLint *locations) {
+
+	int i;
+	dash_submesh *sub;
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	mesh_attrib_toggle(mesh, locations, 1);
+
+	for(i = 0; i < mesh->submesh_count; i++) {
+		sub = &mesh->submeshes[i];
+		mesh_attrib_pointers(mesh, locations, sub->vertex_offset);
+		glDrawElements(GL_TRIANGLES, sub->index_count, mesh->index_type, (void*)sub->index_offset);
+	}
+
+	mesh_attrib_toggle(mesh, locations, 0);
+
+}
+
+static void layout_apply(dash_mesh *mesh, dash_submesh *sub) {
+
+	int i;
+	uint32_t enabled;
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	mesh_attrib_toggle(mesh, mesh->locations, 1);
+	mesh_attrib_pointers(mesh, mesh->locations, sub->vertex_offset);
+
+	if(sub->vao != 0) {
+		return;
+	}
+
+	// Without a real vertex array, attributes the last layout enabled and
+	// this one does not use have to be switched off by hand
+
+	enabled = 0;
+	for(i = 0; i < DASH_SEMANTIC_COUNT; i++) {
+		if(mesh->locations[i] >= 0 && mesh->locations[i] < 32) {
+			enabled |= 1u << mesh->locations[i];
+		}
+	}
+	for(i = 0; i < 32; i++) {
+		if((layout_enabled & ~enabled) & (1u << i)) {
+			glDisableVertexAttribArray(i);
+		}
+	}
+	layout_enabled = enabled;
+
+}
+
+void dash_mesh_layout(dash_mesh *mesh, GLint *locations) {
+
+	int i;
+	dash_submesh *sub;
+
+	dash_mesh_unbind();
+	memcpy(mesh->locations, locations, sizeof(GLint) * DASH_SEMANTIC_COUNT);
+
+	for(i = 0; i < mesh->submesh_count; i++) {
+		sub = &mesh->submeshes[i];
+		if(sub->vao != 0) {
+			vao_delete(&sub->vao);
+		}
+		vao_gen(&sub->vao);
+		if(sub->vao == 0) {
+			continue;
+		}
+		vao_bind(sub->vao);
+		layout_apply(mesh, sub);
+	}
+
+	dash_mesh_unbind();
+
+}
+
+static void layout_bind(dash_mesh *mesh, dash_submesh *sub) {
+
+	if(sub == layout_current) {
+		return;
+	}
+
+	if(sub->vao != 0) {
+		vao_bind(sub->vao);
+	} else {
+		if(vao_current != 0) {
+			vao_bind(0);
+		}
+		layout_apply(mesh, sub);
+	}
+	layout_current = sub;
+
+}
+
+void dash_mesh_bind(dash_mesh *mesh) {
+
+	layout_bind(mesh, &mesh->submeshes[0]);
+
+}
+
+void dash_mesh_render(dash_mesh *mesh) {
+
+	int i;
+	dash_submesh *sub;
+
+	for(i = 0; i < mesh->submesh_count; i++) {
+		sub = &mesh->submeshes[i];
+		layout_bind(mesh, sub);
+		glDrawElements(GL_TRIANGLES, sub->index_count, mesh->index_type, (void*)sub->index_offset);
+	}
+
+}
+
+void dash_mesh_free(dash_mesh *mesh) {
+
+	int i;
+
+	dash_mesh_unbind();
+	for(i = 0; i < mesh->submesh_count; i++) {
+		if(mesh->submeshes[i].vao != 0) {
+			vao_delete(&mesh->submeshes[i].vao);
+		}
+	}
+
+	glDeleteBuffers(1, &mesh->vbo);
+	glDeleteBuffers(1, &mesh->ibo);
+	free(mesh->submeshes);
+	mesh->submeshes = NULL;
+	mesh->submesh_count = 0;
+
+}
+
+/******************************************************************************/
+/** Mesh LOD                                                                 **/
+/******************************************************************************/
+
+/*
+	Levels of detail are built by edge collapse under the quadric error metric
+	(Garland and Heckbert 1997). Every vertex carries the sum of the planes of
+	the triangles around it and a collapse moves it onto a neighbour, so no
+	new vertices are created and all levels index the one vertex buffer.
+	Vertices on open borders or on attribute seams, where one position is
+	shared by several vertices, are locked so the silhouette and the texture
+	layout hold. Each level records the largest distance any collapse moved
+	the surface, which the selector projects to pixels.
+*/
+
+typedef struct {
+	double q[10];
+} quadric;
+
+typedef struct {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+} lod_collapse;
+
+static void quadric_add_plane(quadric *q, double a, double b, double c, double d) {
+
+	q->q[0] += a * a;
+	q->q[1] += a * b;
+	q->q[2] += a * c;
+	q->q[3] += a * d;
+	q->q[4] += b * b;
+	q->q[5] += b * c;
+	q->q[6] += b * d;
+	q->q[7] += c * c;
+	q->q[8] += c * d;
+	q->q[9] += d * d;
+
+}
+
+static double quadric_error(const quadric *a, const quadric *b, const float *p) {
+
+	int i;
+	double q[10], x, y, z, e;
+
+	for(i = 0; i < 10; i++) {
+		q[i] = a->q[i] + b->q[i];
+	}
+
+	x = p[0];
+	y = p[1];
+	z = p[2];
+
+	e = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+		+ q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+		+ q[7]*z*z + 2*q[8]*z + q[9];
+
+	return e < 0.0 ? 0.0 : e;
+
+}
+
+static void triangle_normal(const float *a, const float *b, const float *c, double *n) {
+
+	double e1[3], e2[3];
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		e1[i] = b[i] - a[i];
+		e2[i] = c[i] - a[i];
+	}
+
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+}
+
+static int collapse_compare(const void *a, const void *b) {
+
+	double ca = ((const lod_collapse*)a)->cost;
+	double cb = ((const lod_collapse*)b)->cost;
+
+	return (ca > cb) - (ca < cb);
+
+}
+
+static int collapse_flips(const dash_mesh_data *mesh, const uint32_t *indices,
+	const uint32_t *adjacency, const uint32_t *offsets, uint32_t from, uint32_t to) {
+
+	uint32_t i, k, t;
+	const float *p[3], *pos;
+	double before[3], after[3];
+
+	pos = mesh->vertices + (size_t)to * mesh->stride;
+
+	for(i = offsets[from]; i < offsets[from + 1]; i++) {
+
+		t = adjacency[i];
+		if(indices[t * 3] == to || indices[t * 3 + 1] == to || indices[t * 3 + 2] == to) {
+			continue;
+		}
+
+		for(k = 0; k < 3; k++) {
+			p[k] = mesh->vertices + (size_t)indices[t * 3 + k] * mesh->stride;
+		}
+		triangle_normal(p[0], p[1], p[2], before);
+
+		for(k = 0; k < 3; k++) {
+			if(indices[t * 3 + k] == from) {
+				p[k] = pos;
+			}
+		}
+		triangle_normal(p[0], p[1], p[2], after);
+
+		if(before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) {
+			return 1;
+		}
+
+	}
+
+	return 0;
+
+}
+
+size_t dash_mesh_simplify(const dash_mesh_data *mesh, const uint32_t *indices, size_t index_count,
+	size_t target_index_count, float *error, uint32_t *out) {
+
+	size_t i, j, k, tri_count, target_tris, cand_count, limit, collapsed, n;
+	uint32_t v, u, w, edge[2], canon_count, *canon, *wedges, *offsets, *adjacency, *remap;
+	unsigned char *locked, *touched;
+	const float *p[3];
+	double normal[3], len, max_error;
+	quadric *quadrics;
+	lod_collapse *cands;
+	weld_table table;
+
+	n = mesh->vertex_count;
+	memcpy(out, indices, index_count * sizeof(uint32_t));
+	tri_count = index_count / 3;
+	target_tris = target_index_count / 3;
+	max_error = 0.0;
+
+	// Vertices are grouped by position; groups with more than one member
+	// sit on a seam and are locked
+
+	canon = (uint32_t*)malloc(sizeof(uint32_t) * (n + 1));
+	wedges = (uint32_t*)calloc(n + 1, sizeof(uint32_t));
+	weld_init(&table, n, 3);
+	canon_count = 0;
+	for(i = 0; i < n; i++) {
+		canon[i] = weld_insert(&table, (const uint32_t*)(mesh->vertices + i * mesh->stride), canon_count);
+		if(canon[i] == canon_count) {
+			canon_count++;
+		}
+		wedges[canon[i]]++;
+	}
+	weld_free(&table);
+
+	locked = (unsigned char*)calloc(canon_count + 1, 1);
+	for(i = 0; i < canon_count; i++) {
+		locked[i] = wedges[i] > 1;
+	}
+
+	// An edge is on a border when its reverse is missing. Every directed
+	// edge goes in with value 1, then looking up the reverse either finds
+	// it or leaves a 0 behind, which only ever answers the same question
+
+	weld_init(&table, tri_count * 6, 2);
+	for(i = 0; i < tri_count * 3; i++) {
+		edge[0] = canon[out[i]];
+		edge[1] = canon[out[i - i % 3 + (i + 1) % 3]];
+		weld_insert(&table, edge, 1);
+	}
+	for(i = 0; i < tri_count * 3; i++) {
+		edge[1] = canon[out[i]];
+		edge[0] = canon[out[i - i % 3 + (i + 1) % 3]];
+		if(weld_insert(&table, edge, 0) == 0) {
+			locked[edge[0]] = 1;
+			locked[edge[1]] = 1;
+		}
+	}
+	weld_free(&table);
+
+	quadrics = (quadric*)calloc(canon_count + 1, sizeof(quadric));
+	for(i = 0; i < tri_count; i++) {
+		for(k = 0; k < 3; k++) {
+			p[k] = mesh->vertices + (size_t)out[i * 3 + k] * mesh->stride;
+		}
+		triangle_normal(p[0], p[1], p[2], normal);
+		len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if(len == 0.0) {
+			continue;
+		}
+		normal[0] /= len;
+		normal[1] /= len;
+		normal[2] /= len;
+		for(k = 0; k < 3; k++) {
+			quadric_add_plane(&quadrics[canon[out[i * 3 + k]]], normal[0], normal[1], normal[2],
+				-(normal[0] * p[0][0] + normal[1] * p[0][1] + normal[2] * p[0][2]));
+		}
+	}
+
+	offsets = (uint32_t*)malloc(sizeof(uint32_t) * (n + 1));
+	adjacency = (uint32_t*)malloc(sizeof(uint32_t) * (index_count + 1));
+	remap = (uint32_t*)malloc(sizeof(uint32_t) * (n + 1));
+	touched = (unsigned char*)malloc(n + 1);
+	cands = (lod_collapse*)malloc(sizeof(lod_collapse) * (index_count * 2 + 1));
+
+	// Each pass sorts every candidate collapse by cost and takes the cheapest
+	// ones that do not share a neighbourhood, so the adjacency built at the
+	// start of the pass stays valid for every collapse it makes
+
+	while(tri_count > target_tris) {
+
+		memset(offsets, 0, sizeof(uint32_t) * (n + 1));
+		for(i = 0; i < tri_count * 3; i++) {
+			offsets[out[i] + 1]++;
+		}
+		for(i = 0; i < n; i++) {
+			offsets[i + 1] += offsets[i];
+		}
+		for(i = 0; i < tri_count * 3; i++) {
+			adjacency[offsets[out[i]]++] = i / 3;
+		}
+		for(i = n; i > 0; i--) {
+			offsets[i] = offsets[i - 1];
+		}
+		offsets[0] = 0;
+
+		cand_count = 0;
+		for(i = 0; i < tri_count * 3; i++) {
+			u = out[i];
+			v = out[i - i % 3 + (i + 1) % 3];
+			for(j = 0; j < 2; j++) {
+				if(!locked[canon[u]] && canon[u] != canon[v]) {
+					cands[cand_count].from = u;
+					cands[cand_count].to = v;
+					cands[cand_count].cost = quadric_error(&quadrics[canon[u]], &quadrics[canon[v]],
+						mesh->vertices + (size_t)v * mesh->stride);
+					cand_count++;
+				}
+				w = u;
+				u = v;
+				v = w;
+			}
+		}
+		if(cand_count == 0) {
+			break;
+		}
+		qsort(cands, cand_count, sizeof(lod_collapse), collapse_compare);
+
+		for(i = 0; i < n; i++) {
+			remap[i] = i;
+		}
+		memset(touched, 0, n);
+		limit = (tri_count - target_tris) / 2 + 1;
+		collapsed = 0;
+
+		for(i = 0; i < cand_count && collapsed < limit; i++) {
+
+			u = cands[i].from;
+			v = cands[i].to;
+			if(touched[u] || touched[v]) {
+				continue;
+			}
+			if(collapse_flips(mesh, out, adjacency, offsets, u, v)) {
+				continue;
+			}
+
+			remap[u] = v;
+			for(j = 0; j < 10; j++) {
+				quadrics[canon[v]].q[j] += quadrics[canon[u]].q[j];
+			}
+			if(sqrt(cands[i].cost) > max_error) {
+				max_error = sqrt(cands[i].cost);
+			}
+
+			for(j = offsets[u]; j < offsets[u + 1]; j++) {
+				for(k = 0; k < 3; k++) {
+					touched[out[adjacency[j] * 3 + k]] = 1;
+				}
+			}
+			collapsed++;
+
+		}
+
+		if(collapsed == 0) {
+			break;
+		}
+
+		// Triangles that held both ends of a collapsed edge are now degenerate
+
+		j = 0;
+		for(i = 0; i < tri_count; i++) {
+			edge[0] = remap[out[i * 3]];
+			edge[1] = remap[out[i * 3 + 1]];
+			v = remap[out[i * 3 + 2]];
+			if(edge[0] == edge[1] || edge[1] == v || v == edge[0]) {
+				continue;
+			}
+			out[j * 3] = edge[0];
+			out[j * 3 + 1] = edge[1];
+			out[j * 3 + 2] = v;
+			j++;
+		}
+		tri_count = j;
+
+	}
+
+	free(cands);
+	free(touched);
+	free(remap);
+	free(adjacency);
+	free(offsets);
+	free(quadrics);
+	free(locked);
+	free(wedges);
+	free(canon);
+
+	if(error != NULL) {
+		*error = (float)max_error;
+	}
+	return tri_count * 3;
+
+}
+
+void dash_lod_build(const dash_mesh_data *mesh, int count, float ratio, dash_lod_chain *chain) {
+
+	int i;
+	size_t prev_offset, prev_count, target, result;
+	float error;
+	uint32_t *scratch;
+
+	if(count > DASH_LOD_MAX) {
+		count = DASH_LOD_MAX;
+	}
+
+	memset(chain, 0, sizeof(dash_lod_chain));
+	chain->indices = (uint32_t*)malloc(sizeof(uint32_t) * (mesh->index_count + 1));
+	memcpy(chain->indices, mesh->indices, sizeof(uint32_t) * mesh->index_count);
+	chain->index_count = mesh->index_count;
+	chain->levels[0].index_count = mesh->index_count;
+	chain->count = 1;
+
+	scratch = (uint32_t*)malloc(sizeof(uint32_t) * (mesh->index_count + 1));
+
+	// Each level simplifies the one before it, so errors only grow
+
+	for(i = 1; i < count; i++) {
+
+		prev_offset = chain->levels[i - 1].index_offset;
+		prev_count = chain->levels[i - 1].index_count;
+		target = (size_t)(prev_count / 3 * ratio) * 3;
+
+		result = dash_mesh_simplify(mesh, chain->indices + prev_offset, prev_count, target, &error, scratch);
+		if(result == 0 || result > prev_count - prev_count / 16) {
+			break;
+		}
+
+		chain->indices = (uint32_t*)realloc(chain->indices, sizeof(uint32_t) * (chain->index_count + result));
+		memcpy(chain->indices + chain->index_count, scratch, sizeof(uint32_t) * result);
+
+		chain->levels[i].index_offset = chain->index_count;
+		chain->levels[i].index_count = result;
+		chain->levels[i].error = error > chain->levels[i - 1].error ? error : chain->levels[i - 1].error;
+		chain->index_count += result;
+		chain->count++;
+
+	}
+
+	free(scratch);
+
+}
+
+int dash_lod_upload(dash_lod_chain *chain, dash_mesh *mesh) {
+
+	void *indices;
+
+	// Split meshes carry their own vertex copies per submesh, which the
+	// levels do not index
+
+	if(mesh->submesh_count != 1) {
+		return 0;
+	}
+
+	indices = chain->indices;
+	if(mesh->index_type != GL_UNSIGNED_INT) {
+		indices = narrow_indices(chain->indices, chain->index_count, mesh->index_type);
+	}
+
+	dash_mesh_unbind();
+	glGenBuffers(1, &chain->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chain->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, chain->index_count * index_size(mesh->index_type), indices, GL_STATIC_DRAW);
+
+	if(indices != chain->indices) {
+		free(indices);
+	}
+
+	return 1;
+
+}
+
+int dash_lod_select(dash_lod_chain *chain, mat4 projection, float viewport_height, float distance, float threshold) {
+
+	int i;
+	float scale;
+
+	// projection[5] is the cotangent of half the vertical field of view set
+	// by mat4_perspective, which turns a world size at a distance into a
+	// fraction of the viewport height
+
+	if(distance <= 0.0f) {
+		return 0;
+	}
+	scale = projection[5] * viewport_height * 0.5f / distance;
+
+	for(i = chain->count - 1; i > 0; i--) {
+		if(chain->levels[i].error * scale <= threshold) {
+			return i;
+		}
+	}
+
+	return 0;
+
+}
+
+void dash_lod_draw(dash_mesh *mesh, dash_lod_chain *chain, int level, GLint *locations) {
+
+	dash_lod *lod;
+
+	if(chain->ibo == 0) {
+		dash_mesh_draw(mesh, locations);
+		return;
+	}
+
+	lod = &chain->levels[level];
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chain->ibo);
+	mesh_attrib_toggle(mesh, locations, 1);
+	mesh_attrib_pointers(mesh, locations, 0);
+
+	glDrawElements(GL_TRIANGLES, lod->index_count, mesh->index_type,
+		(void*)(lod->index_offset * index_size(mesh->index_type)));
+
+	mesh_attrib_toggle(mesh, locations, 0);
+
+}
+
+void dash_lod_free(dash_lod_chain *chain) {
+
+	if(chain->ibo != 0) {
+		glDeleteBuffers(1, &chain->ibo);
+	}
+	free(chain->indices);
+	chain->indices = NULL;
+	chain->ibo = 0;
+	chain->count = 0;
+
+}
+
+/******************************************************************************/
+/** Mesh Instancing                                                          **/
+/******************************************************************************/
+
+/*
+	Instances are drawn from a buffer of column major model matrices bound
+	to a mat4 attribute, which takes four consecutive locations. With
+	ARB_instanced_arrays (core in 3.3) the columns advance once per instance
+	and the whole set goes out in one glDrawElementsInstanced per submesh.
+
+	Plain GL 2.0 falls back to pseudo instancing. The mesh is copied
+	DASH_PSEUDO_BATCH times into one buffer with an instance_id attribute
+	counting the copies, and up to that many matrices go into a uniform
+	mat4 array, so one glDrawElements covers a whole batch. The copies are
+	kept within 16 bit indices, and a mesh too large for even two copies is
+	drawn one instance at a time, setting the model attribute as a constant
+	with glVertexAttrib4fv.
+*/
+
+static int instancing_supported() {
+
+	#ifdef GL_ES_VERSION_2_0
+	return 0;
+	#else
+	// Divisors and instanced draws come from separate extensions
+
+	return (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays) &&
+		(GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced);
+	#endif
+
+}
+
+static void instance_divisor(GLuint index, GLuint divisor) {
+
+	#ifndef GL_ES_VERSION_2_0
+	if(GLEW_VERSION_3_3) {
+		glVertexAttribDivisor(index, divisor);
+	} else {
+		glVertexAttribDivisorARB(index, divisor);
+	}
+	#endif
+
+}
+
+static void instance_draw(GLsizei count, GLenum type, size_t offset, GLsizei instances) {
+
+	#ifndef GL_ES_VERSION_2_0
+	if(GLEW_VERSION_3_1) {
+		glDrawElementsInstanced(GL_TRIANGLES, count, type, (void*)offset, instances);
+	} else {
+		glDrawElementsInstancedARB(GL_TRIANGLES, count, type, (void*)offset, instances);
+	}
+	#endif
+
+}
+
+static int pseudo_batch_size(const dash_mesh_data *data) {
+
+	size_t size = SUBMESH_VERTICES / (data->vertex_count ? data->vertex_count : 1);
+
+	return size > DASH_PSEUDO_BATCH ? DASH_PSEUDO_BATCH : (int)size;
+
+}
+
+static void pseudo_build(dash_instances *inst, const dash_mesh_data *data) {
+
+	int k;
+	size_t i, stride;
+	float *vertices, *dst;
+	uint32_t *indices;
+	void *narrow;
+	dash_mesh *batch;
+
+	batch = &inst->batch;
+	stride = data->stride + 1;
+
+	vertices = (float*)malloc(sizeof(float) * stride * data->vertex_count * inst->batch_size);
+	indices = (uint32_t*)malloc(sizeof(uint32_t) * data->index_count * inst->batch_size);
+
+	// The instance id rides in a trailing float after the source layout
+
+	dst = vertices;
+	for(k = 0; k < inst->batch_size; k++) {
+		for(i = 0; i < data->vertex_count; i++) {
+			memcpy(dst, data->vertices + i * data->stride, sizeof(float) * data->stride);
+			dst[data->stride] = (float)k;
+			dst += stride;
+		}
+		for(i = 0; i < data->index_count; i++) {
+			indices[k * data->index_count + i] = data->indices[i] + k * data->vertex_count;
+		}
+	}
+
+	batch->stride = stride;
+	batch->texcoord = data->texcoord;
+	batch->normal = data->normal;
+	batch->color = data->color;
+	batch->vertex_count = data->vertex_count * inst->batch_size;
+	batch->index_count = data->index_count * inst->batch_size;
+	batch->index_type = dash_index_type(batch->vertex_count);
+	batch->submesh_count = 1;
+	batch->submeshes = (dash_submesh*)calloc(1, sizeof(dash_submesh));
+	batch->submeshes[0].index_count = data->index_count;
+
+	dash_mesh_unbind();
+	glGenBuffers(1, &batch->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * stride * batch->vertex_count, vertices, GL_STATIC_DRAW);
+
+	narrow = narrow_indices(indices, batch->index_count, batch->index_type);
+	glGenBuffers(1, &batch->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, batch->index_count * index_size(batch->index_type), narrow, GL_STATIC_DRAW);
+
+	free(narrow);
+	free(indices);
+	free(vertices);
+
+}
+
+int dash_instances_create(dash_instances *inst, const dash_mesh_data *data, int capacity, int mode) {
+
+	memset(inst, 0, sizeof(dash_instances));
+	inst->model_location = -1;
+	inst->instance_location = -1;
+	inst->batch_size = pseudo_batch_size(data);
+
+	if(mode == DASH_INSTANCE_AUTO) {
+		if(instancing_supported()) {
+			mode = DASH_INSTANCE_HARDWARE;
+		} else if(inst->batch_size > 1) {
+			mode = DASH_INSTANCE_PSEUDO;
+		} else {
+			mode = DASH_INSTANCE_DRAW;
+		}
+	} else if(mode == DASH_INSTANCE_HARDWARE && !instancing_supported()) {
+		return 0;
+	} else if(mode == DASH_INSTANCE_PSEUDO && inst->batch_size < 1) {
+		return 0;
+	}
+
+	inst->mode = mode;
+	inst->capacity = capacity;
+	inst->models = (float*)malloc(sizeof(float) * 16 * capacity);
+
+	if(mode == DASH_INSTANCE_HARDWARE) {
+		inst->ring = dash_ring_create(GL_ARRAY_BUFFER, sizeof(float) * 16 * capacity, 3);
+	} else if(mode == DASH_INSTANCE_PSEUDO) {
+		pseudo_build(inst, data);
+	}
+
+	return mode;
+
+}
+
+int dash_instances_program(dash_instances *inst, GLuint program) {
+
+	if(inst->mode == DASH_INSTANCE_PSEUDO) {
+		inst->model_location = glGetUniformLocation(program, "models");
+		inst->instance_location = glGetAttribLocation(program, "instance_id");
+		return inst->model_location != -1 && inst->instance_location != -1;
+	}
+
+	inst->model_location = glGetAttribLocation(program, "model");
+	return inst->model_location != -1;
+
+}
+
+void dash_instances_update(dash_instances *inst, const float *models, int count) {
+
+	if(count > inst->capacity) {
+		count = inst->capacity;
+	}
+	inst->count = count;
+	memcpy(inst->models, models, sizeof(float) * 16 * count);
+
+	// Each update is a frame of the ring, so matrices still being read by
+	// the last frames' draws are never overwritten
+
+	if(inst->mode == DASH_INSTANCE_HARDWARE) {
+		dash_ring_begin_frame(inst->ring);
+		memcpy(dash_ring_alloc(inst->ring, sizeof(float) * 16 * count, 16, &inst->offset),
+			models, sizeof(float) * 16 * count);
+		dash_ring_commit(inst->ring);
+	}
+
+}
+
+static void pseudo_draw(dash_instances *inst, GLint *locations) {
+
+	int i, n;
+	dash_mesh *batch;
+	GLsizei per_instance;
+
+	batch = &inst->batch;
+	per_instance = batch->submeshes[0].index_count;
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+	mesh_attrib_toggle(batch, locations, 1);
+	mesh_attrib_pointers(batch, locations, 0);
+
+	glEnableVertexAttribArray(inst->instance_location);
+	glVertexAttribPointer(inst->instance_location, 1, GL_FLOAT, GL_FALSE,
+		batch->stride * sizeof(float), (void*)((batch->stride - 1) * sizeof(float)));
+
+	// The copies are laid out in order, so a short final batch just draws
+	// a prefix of the index buffer
+
+	for(i = 0; i < inst->count; i += inst->batch_size) {
+		n = inst->count - i < inst->batch_size ? inst->count - i : inst->batch_size;
+		glUniformMatrix4fv(inst->model_location, n, GL_FALSE, inst->models + i * 16);
+		glDrawElements(GL_TRIANGLES, per_instance * n, batch->index_type, 0);
+	}
+
+	glDisableVertexAttribArray(inst->instance_location);
+	mesh_attrib_toggle(batch, locations, 0);
+
+}
+
+void dash_instances_draw(dash_instances *inst, dash_mesh *mesh, GLint *locations) {
+
+	int i, j, c;
+	dash_submesh *sub;
+
+	if(inst->count == 0 || inst->model_location == -1) {
+		return;
+	}
+
+	if(inst->mode == DASH_INSTANCE_PSEUDO) {
+		pseudo_draw(inst, locations);
+		return;
+	}
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+
+	if(inst->mode == DASH_INSTANCE_HARDWARE) {
+		glBindBuffer(GL_ARRAY_BUFFER, dash_ring_buffer(inst->ring));
+		for(c = 0; c < 4; c++) {
+			glEnableVertexAttribArray(inst->model_location + c);
+			glVertexAttribPointer(inst->model_location + c, 4, GL_FLOAT, GL_FALSE,
+				sizeof(float) * 16, (void*)(inst->offset + sizeof(float) * 4 * c));
+			instance_divisor(inst->model_location + c, 1);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	mesh_attrib_toggle(mesh, locations, 1);
+
+	for(i = 0; i < mesh->submesh_count; i++) {
+
+		sub = &mesh->submeshes[i];
+		mesh_attrib_pointers(mesh, locations, sub->vertex_offset);
+
+		if(inst->mode == DASH_INSTANCE_HARDWARE) {
+			instance_draw(sub->index_count, mesh->index_type, sub->index_offset, inst->count);
+			continue;
+		}
+
+		for(j = 0; j < inst->count; j++) {
+			for(c = 0; c < 4; c++) {
+				glVertexAttrib4fv(inst->model_location + c, inst->models + j * 16 + c * 4);
+			}
+			glDrawElements(GL_TRIANGLES, sub->index_count, mesh->index_type, (void*)sub->index_offset);
+		}
+
+	}
+
+	mesh_attrib_toggle(mesh, locations, 0);
+
+	if(inst->mode == DASH_INSTANCE_HARDWARE) {
+		for(c = 0; c < 4; c++) {
+			instance_divisor(inst->model_location + c, 0);
+			glDisableVertexAttribArray(inst->model_location + c);
+		}
+	}
+
+}
+
+void dash_instances_free(dash_instances *inst) {
+
+	if(inst->ring != NULL) {
+		dash_ring_destroy(inst->ring);
+	}
+	if(inst->batch.vbo != 0) {
+		dash_mesh_free(&inst->batch);
+	}
+	free(inst->models);
+	memset(inst, 0, sizeof(dash_instances));
+
+}
+
+/******************************************************************************/
+/** Cube Pulling                                                             **/
+/******************************************************************************/
+
+/*
+	Axis aligned cubes drawn from one 8 byte record each: x, y and z as 16
+	bit grid positions, then the edge length and a texture array layer
+	packed into the fourth 16 bit value, so a million cubes take 8 MB where
+	a mesh copy and matrix per cube would take hundreds. With texture
+	buffers, EXT_gpu_shader4 and ARB_draw_instanced, which the GLSL 1.20
+	shader needs for gl_InstanceIDARB, shader/vertex_pulled.glsl fetches the
+	record for each instance and builds the 36 corners and texture
+	coordinates of the cube from gl_VertexID, so no vertex data is stored
+	at all. Compatibility contexts only issue vertices while array 0 is
+	enabled, so a 36 byte buffer sits there unread.
+
+	Older contexts fall back to shader/vertex_cube.glsl, which scales and
+	places a unit cube mesh by the record given as an unsigned short vec4
+	attribute, advanced per instance with ARB_instanced_arrays, or set as a
+	constant for one draw per cube on plain GL 2.0.
+*/
+
+static GLfloat unit_cube_vertices[] = {
+	// front
+	0.0, 0.0, 1.0, 0.0, 0.0,
+	1.0, 0.0, 1.0, 1.0, 0.0,
+	1.0, 1.0, 1.0, 1.0, 1.0,
+	0.0, 1.0, 1.0, 0.0, 1.0,
+	// top
+	0.0, 1.0, 1.0, 0.0, 0.0,
+	1.0, 1.0, 1.0, 1.0, 0.0,
+	1.0, 1.0, 0.0, 1.0, 1.0,
+	0.0, 1.0, 0.0, 0.0, 1.0,
+	// back
+	1.0, 0.0, 0.0, 0.0, 0.0,
+	0.0, 0.0, 0.0, 1.0, 0.0,
+	0.0, 1.0, 0.0, 1.0, 1.0,
+	1.0, 1.0, 0.0, 0.0, 1.0,
+	// bottom
+	0.0, 0.0, 0.0, 0.0, 0.0,
+	1.0, 0.0, 0.0, 1.0, 0.0,
+	1.0, 0.0, 1.0, 1.0, 1.0,
+	0.0, 0.0, 1.0, 0.0, 1.0,
+	// left
+	0.0, 0.0, 0.0, 0.0, 0.0,
+	0.0, 0.0, 1.0, 1.0, 0.0,
+	0.0, 1.0, 1.0, 1.0, 1.0,
+	0.0, 1.0, 0.0, 0.0, 1.0,
+	// right
+	1.0, 0.0, 1.0, 0.0, 0.0,
+	1.0, 0.0, 0.0, 1.0, 0.0,
+	1.0, 1.0, 0.0, 1.0, 1.0,
+	1.0, 1.0, 1.0, 0.0, 1.0
+};
+
+static uint32_t unit_cube_indices[] = {
+	0,  1,  2,  2,  3,  0,
+	4,  5,  6,  6,  7,  4,
+	8,  9, 10, 10, 11,  8,
+	12, 13, 14, 14, 15, 12,
+	16, 17, 18, 18, 19, 16,
+	20, 21, 22, 22, 23, 20
+};
+
+static int pull_supported() {
+
+	#ifdef GL_ES_VERSION_2_0
+	return 0;
+	#else
+	if(!GLEW_EXT_gpu_shader4 || !GLEW_ARB_draw_instanced) {
+		return 0;
+	}
+	return GLEW_VERSION_3_1 || GLEW_ARB_texture_buffer_object ||
+		GLEW_EXT_texture_buffer_object;
+	#endif
+
+}
+
+int dash_cubes_create(dash_cubes *c, int capacity, int mode) {
+
+	int i;
+	uint8_t corners[36];
+	dash_mesh_data data = {
+		unit_cube_vertices, 24, 5, 3, -1, -1,
+		unit_cube_indices, sizeof(unit_cube_indices) / sizeof(uint32_t)
+	};
+
+	memset(c, 0, sizeof(dash_cubes));
+	c->cube_location = -1;
+	c->sampler_location = -1;
+
+	if(mode == DASH_CUBES_AUTO) {
+		if(pull_supported()) {
+			mode = DASH_CUBES_PULL;
+		} else if(instancing_supported()) {
+			mode = DASH_CUBES_INSTANCED;
+		} else {
+			mode = DASH_CUBES_DRAW;
+		}
+	} else if(mode == DASH_CUBES_PULL && !pull_supported()) {
+		return 0;
+	} else if(mode == DASH_CUBES_INSTANCED && !instancing_supported()) {
+		return 0;
+	}
+
+	c->mode = mode;
+	c->capacity = capacity;
+	c->packed = (uint16_t*)malloc(sizeof(uint16_t) * 4 * capacity);
+
+	if(mode != DASH_CUBES_PULL) {
+		dash_mesh_upload(&data, &c->cube);
+		if(mode == DASH_CUBES_INSTANCED) {
+			glGenBuffers(1, &c->buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, c->buffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(uint16_t) * 4 * capacity, NULL, GL_DYNAMIC_DRAW);
+		}
+		return mode;
+	}
+
+	#ifndef GL_ES_VERSION_2_0
+	glGenBuffers(1, &c->buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, c->buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(uint16_t) * 4 * capacity, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &c->texture);
+	glBindTexture(GL_TEXTURE_BUFFER, c->texture);
+	if(GLEW_VERSION_3_1) {
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16UI, c->buffer);
+	} else if(GLEW_ARB_texture_buffer_object) {
+		glTexBufferARB(GL_TEXTURE_BUFFER, GL_RGBA16UI, c->buffer);
+	} else {
+		glTexBufferEXT(GL_TEXTURE_BUFFER, GL_RGBA16UI, c->buffer);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	for(i = 0; i < 36; i++) {
+		corners[i] = i;
+	}
+	glGenBuffers(1, &c->corners);
+	glBindBuffer(GL_ARRAY_BUFFER, c->corners);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	#endif
+
+	return mode;
+
+}
+
+int dash_cubes_program(dash_cubes *c, GLuint program) {
+
+	if(c->mode == DASH_CUBES_PULL) {
+		c->sampler_location = glGetUniformLocation(program, "cubes");
+		return c->sampler_location != -1;
+	}
+
+	c->locations[DASH_POSITION] = glGetAttribLocation(program, "coord3d");
+	c->locations[DASH_TEXCOORD] = glGetAttribLocation(program, "texcoord");
+	c->locations[DASH_COLOR] = -1;
+	c->cube_location = glGetAttribLocation(program, "cube");
+	return c->locations[DASH_POSITION] != -1 && c->cube_location != -1;
+
+}
+
+void dash_cubes_update(dash_cubes *c, const dash_cube *cubes, int count) {
+
+	int i;
+	uint16_t *p;
+	GLenum target;
+
+	if(count > c->capacity) {
+		count = c->capacity;
+	}
+	c->count = count;
+
+	// Packed by hand, the struct's two trailing bytes would otherwise read
+	// as one 16 bit value in host byte order
+
+	p = c->packed;
+	for(i = 0; i < count; i++) {
+		p[0] = cubes[i].x;
+		p[1] = cubes[i].y;
+		p[2] = cubes[i].z;
+		p[3] = cubes[i].size | (cubes[i].layer << 8);
+		p += 4;
+	}
+
+	if(c->mode == DASH_CUBES_DRAW) {
+		return;
+	}
+
+	#ifndef GL_ES_VERSION_2_0
+	target = c->mode == DASH_CUBES_PULL ? GL_TEXTURE_BUFFER : GL_ARRAY_BUFFER;
+	glBindBuffer(target, c->buffer);
+	glBufferData(target, sizeof(uint16_t) * 4 * c->capacity, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(target, 0, sizeof(uint16_t) * 4 * count, c->packed);
+	glBindBuffer(target, 0);
+	#endif
+
+}
+
+static void pull_draw(dash_cubes *c) {
+
+	#ifndef GL_ES_VERSION_2_0
+	glActiveTexture(GL_TEXTURE0 + DASH_CUBES_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, c->texture);
+	glUniform1i(c->sampler_location, DASH_CUBES_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, c->corners);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+
+	if(GLEW_VERSION_3_1) {
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 36, c->count);
+	} else {
+		glDrawArraysInstancedARB(GL_TRIANGLES, 0, 36, c->count);
+	}
+
+	glDisableVertexAttribArray(0);
+	#endif
+
+}
+
+void dash_cubes_draw(dash_cubes *c) {
+
+	int i;
+	uint16_t *p;
+	dash_mesh *mesh;
+	dash_submesh *sub;
+
+	if(c->count == 0) {
+		return;
+	}
+
+	if(c->mode == DASH_CUBES_PULL) {
+		pull_draw(c);
+		return;
+	}
+
+	if(c->cube_location == -1) {
+		return;
+	}
+
+	mesh = &c->cube;
+	sub = &mesh->submeshes[0];
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+
+	if(c->mode == DASH_CUBES_INSTANCED) {
+		glBindBuffer(GL_ARRAY_BUFFER, c->buffer);
+		glEnableVertexAttribArray(c->cube_location);
+		glVertexAttribPointer(c->cube_location, 4, GL_UNSIGNED_SHORT, GL_FALSE, 0, 0);
+		instance_divisor(c->cube_location, 1);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	mesh_attrib_toggle(mesh, c->locations, 1);
+	mesh_attrib_pointers(mesh, c->locations, sub->vertex_offset);
+
+	if(c->mode == DASH_CUBES_INSTANCED) {
+		instance_draw(sub->index_count, mesh->index_type, sub->index_offset, c->count);
+		instance_divisor(c->cube_location, 0);
+		glDisableVertexAttribArray(c->cube_location);
+	} else {
+		p = c->packed;
+		for(i = 0; i < c->count; i++) {
+			glVertexAttrib4f(c->cube_location, p[0], p[1], p[2], p[3]);
+			glDrawElements(GL_TRIANGLES, sub->index_count, mesh->index_type, (void*)sub->index_offset);
+			p += 4;
+		}
+	}
+
+	mesh_attrib_toggle(mesh, c->locations, 0);
+
+}
+
+void dash_cubes_free(dash_cubes *c) {
+
+	if(c->buffer != 0) {
+		glDeleteBuffers(1, &c->buffer);
+	}
+	if(c->corners != 0) {
+		glDeleteBuffers(1, &c->corners);
+	}
+	if(c->texture != 0) {
+		glDeleteTextures(1, &c->texture);
+	}
+	if(c->cube.vbo != 0) {
+		dash_mesh_free(&c->cube);
+	}
+	free(c->packed);
+	memset(c, 0, sizeof(dash_cubes));
+
+}
+
+/******************************************************************************/
+/** Static Batching                                                          **/
+/******************************************************************************/
+
+/*
+	Objects that never move are baked into world space once, so each chunk
+	of them is one draw with only the view projection uniform. Items are
+	sorted along a Morton curve of their translations so each chunk covers
+	a compact region, then packed into chunks of up to
+	DASH_BATCH_CHUNK_VERTICES, which keeps indices in 16 bits and gives
+	culling something to work with. Worker threads transform the vertices,
+	positions by the full matrix with SSE where available and normals by
+	the inverse transpose of its upper 3x3, so non-uniform scale keeps them
+	perpendicular. The chunks are culled against the frustum at draw.
+*/
+
+typedef struct {
+	const dash_batch_item *item;
+	float *dst;
+	uint32_t *indices;
+	uint32_t vertex_base;
+	uint32_t morton;
+	int chunk;
+	float min[3];
+	float max[3];
+} batch_job;
+
+typedef struct {
+	batch_job *jobs;
+	int start;
+	int end;
+} batch_range;
+
+static uint32_t morton_spread(uint32_t v) {
+
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+
+}
+
+static int batch_job_compare(const void *a, const void *b) {
+
+	uint32_t ma = ((const batch_job*)a)->morton;
+	uint32_t mb = ((const batch_job*)b)->morton;
+
+	return (ma > mb) - (ma < mb);
+
+}
+
+static void batch_transform(const float *m, const float *src, float *dst, const dash_mesh_data *mesh) {
+
+	size_t i;
+	int stride;
+	float x, y, z, len, det, n[9];
+	#ifdef __SSE2__
+	__m128 c0, c1, c2, c3, p;
+	float out[4];
+	#endif
+
+	stride = mesh->stride;
+
+	// The cofactor matrix is the inverse transpose scaled by the
+	// determinant, only its sign matters once normals are renormalized
+
+	n[0] = m[M_11] * m[M_22] - m[M_21] * m[M_12];
+	n[1] = m[M_12] * m[M_20] - m[M_22] * m[M_10];
+	n[2] = m[M_10] * m[M_21] - m[M_20] * m[M_11];
+	n[3] = m[M_21] * m[M_02] - m[M_01] * m[M_22];
+	n[4] = m[M_22] * m[M_00] - m[M_02] * m[M_20];
+	n[5] = m[M_20] * m[M_01] - m[M_00] * m[M_21];
+	n[6] = m[M_01] * m[M_12] - m[M_11] * m[M_02];
+	n[7] = m[M_02] * m[M_10] - m[M_12] * m[M_00];
+	n[8] = m[M_00] * m[M_11] - m[M_10] * m[M_01];
+	det = m[M_00] * n[0] + m[M_01] * n[1] + m[M_02] * n[2];
+	for(i = 0; i < 9 && det < 0.0f; i++) {
+		n[i] = -n[i];
+	}
+
+	#ifdef __SSE2__
+	c0 = _mm_loadu_ps(m);
+	c1 = _mm_loadu_ps(m + 4);
+	c2 = _mm_loadu_ps(m + 8);
+	c3 = _mm_loadu_ps(m + 12);
+	#endif
+
+	for(i = 0; i < mesh->vertex_count; i++, src += stride, dst += stride) {
+
+		memcpy(dst, src, sizeof(float) * stride);
+
+		#ifdef __SSE2__
+		p = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src[0])), _mm_mul_ps(c1, _mm_set1_ps(src[1]))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(src[2])), c3));
+		_mm_storeu_ps(out, p);
+		dst[0] = out[0];
+		dst[1] = out[1];
+		dst[2] = out[2];
+		#else
+		x = src[0];
+		y = src[1];
+		z = src[2];
+		dst[0] = m[M_00] * x + m[M_01] * y + m[M_02] * z + m[M_03];
+		dst[1] = m[M_10] * x + m[M_11] * y + m[M_12] * z + m[M_13];
+		dst[2] = m[M_20] * x + m[M_21] * y + m[M_22] * z + m[M_23];
+		#endif
+
+		if(mesh->normal < 0) {
+			continue;
+		}
+
+		x = src[mesh->normal];
+		y = src[mesh->normal + 1];
+		z = src[mesh->normal + 2];
+		dst[mesh->normal] = n[0] * x + n[1] * y + n[2] * z;
+		dst[mesh->normal + 1] = n[3] * x + n[4] * y + n[5] * z;
+		dst[mesh->normal + 2] = n[6] * x + n[7] * y + n[8] * z;
+		len = sqrtf(dst[mesh->normal] * dst[mesh->normal] +
+			dst[mesh->normal + 1] * dst[mesh->normal + 1] +
+			dst[mesh->normal + 2] * dst[mesh->normal + 2]);
+		if(len > 0.0f) {
+			dst[mesh->normal] /= len;
+			dst[mesh->normal + 1] /= len;
+			dst[mesh->normal + 2] /= len;
+		}
+
+	}
+
+}
+
+static void *batch_worker(void *arg) {
+
+	int i, k;
+	size_t v;
+	batch_range *range;
+	batch_job *job;
+	const dash_mesh_data *mesh;
+	float *p;
+
+	range = (batch_range*)arg;
+
+	for(i = range->start; i < range->end; i++) {
+
+		job = &range->jobs[i];
+		mesh = job->item->mesh;
+		batch_transform(job->item->model, mesh->vertices, job->dst, mesh);
+
+		for(v = 0; v < mesh->index_count; v++) {
+			job->indices[v] = mesh->indices[v] + job->vertex_base;
+		}
+
+		for(k = 0; k < 3; k++) {
+			job->min[k] = 1e30f;
+			job->max[k] = -1e30f;
+		}
+		for(v = 0, p = job->dst; v < mesh->vertex_count; v++, p += mesh->stride) {
+			for(k = 0; k < 3; k++) {
+				job->min[k] = p[k] < job->min[k] ? p[k] : job->min[k];
+				job->max[k] = p[k] > job->max[k] ? p[k] : job->max[k];
+			}
+		}
+
+	}
+
+	return NULL;
+
+}
+
+int dash_batch_build(const dash_batch_item *items, int count, dash_batch *batch) {
+
+	int i, k, t, c, threads, first, ok;
+	float lo[3], hi[3], scale;
+	size_t vertices, indices;
+	uint32_t q[3];
+	batch_job *jobs;
+	batch_range ranges[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	dash_mesh_data *chunk_data;
+	const dash_mesh_data *layout;
+	dash_batch_chunk *chunk;
+
+	memset(batch, 0, sizeof(dash_batch));
+	if(count == 0) {
+		return 1;
+	}
+
+	layout = items[0].mesh;
+	for(i = 1; i < count; i++) {
+		if(items[i].mesh->stride != layout->stride || items[i].mesh->texcoord != layout->texcoord ||
+			items[i].mesh->normal != layout->normal || items[i].mesh->color != layout->color) {
+			fprintf(stderr, "Static batch items must share one vertex layout\n");
+			return 0;
+		}
+	}
+
+	// Order items along a Morton curve over the bounds of their origins
+
+	jobs = (batch_job*)calloc(count, sizeof(batch_job));
+	for(k = 0; k < 3; k++) {
+		lo[k] = 1e30f;
+		hi[k] = -1e30f;
+	}
+	for(i = 0; i < count; i++) {
+		for(k = 0; k < 3; k++) {
+			lo[k] = items[i].model[12 + k] < lo[k] ? items[i].model[12 + k] : lo[k];
+			hi[k] = items[i].model[12 + k] > hi[k] ? items[i].model[12 + k] : hi[k];
+		}
+	}
+	for(i = 0; i < count; i++) {
+		for(k = 0; k < 3; k++) {
+			scale = hi[k] > lo[k] ? 1023.0f / (hi[k] - lo[k]) : 0.0f;
+			q[k] = (uint32_t)((items[i].model[12 + k] - lo[k]) * scale);
+		}
+		jobs[i].item = &items[i];
+		jobs[i].morton = morton_spread(q[0]) | (morton_spread(q[1]) << 1) | (morton_spread(q[2]) << 2);
+	}
+	qsort(jobs, count, sizeof(batch_job), batch_job_compare);
+
+	// Fill chunks in curve order, an item too big for any chunk gets its own
+
+	batch->chunk_count = 0;
+	vertices = 0;
+	for(i = 0; i < count; i++) {
+		if(i == 0 || vertices + jobs[i].item->mesh->vertex_count > DASH_BATCH_CHUNK_VERTICES) {
+			batch->chunk_count++;
+			vertices = 0;
+		}
+		jobs[i].chunk = batch->chunk_count - 1;
+		vertices += jobs[i].item->mesh->vertex_count;
+	}
+
+	batch->chunks = (dash_batch_chunk*)calloc(batch->chunk_count, sizeof(dash_batch_chunk));
+	chunk_data = (dash_mesh_data*)calloc(batch->chunk_count, sizeof(dash_mesh_data));
+
+	for(i = 0; i < count; i++) {
+		chunk_data[jobs[i].chunk].vertex_count += jobs[i].item->mesh->vertex_count;
+		chunk_data[jobs[i].chunk].index_count += jobs[i].item->mesh->index_count;
+	}
+	for(c = 0; c < batch->chunk_count; c++) {
+		chunk_data[c].stride = layout->stride;
+		chunk_data[c].texcoord = layout->texcoord;
+		chunk_data[c].normal = layout->normal;
+		chunk_data[c].color = layout->color;
+		chunk_data[c].vertices = (float*)malloc(sizeof(float) * layout->stride * chunk_data[c].vertex_count + 1);
+		chunk_data[c].indices = (uint32_t*)malloc(sizeof(uint32_t) * chunk_data[c].index_count + 1);
+	}
+
+	vertices = 0;
+	indices = 0;
+	for(i = 0; i < count; i++) {
+		if(i > 0 && jobs[i].chunk != jobs[i - 1].chunk) {
+			vertices = 0;
+			indices = 0;
+		}
+		jobs[i].vertex_base = vertices;
+		jobs[i].dst = chunk_data[jobs[i].chunk].vertices + vertices * layout->stride;
+		jobs[i].indices = chunk_data[jobs[i].chunk].indices + indices;
+		vertices += jobs[i].item->mesh->vertex_count;
+		indices += jobs[i].item->mesh->index_count;
+	}
+
+	threads = thread_count();
+	if(threads > count) {
+		threads = count;
+	}
+	for(t = 0; t < threads; t++) {
+		ranges[t].jobs = jobs;
+		ranges[t].start = (int)((long)count * t / threads);
+		ranges[t].end = (int)((long)count * (t + 1) / threads);
+	}
+	for(t = 1; t < threads; t++) {
+		pthread_create(&tids[t], NULL, batch_worker, &ranges[t]);
+	}
+	batch_worker(&ranges[0]);
+	for(t = 1; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	// Chunk bounds are the union of their items, then everything uploads
+
+	for(i = 0; i < count; i++) {
+		chunk = &batch->chunks[jobs[i].chunk];
+		first = i == 0 || jobs[i].chunk != jobs[i - 1].chunk;
+		for(k = 0; k < 3; k++) {
+			chunk->min[k] = first || jobs[i].min[k] < chunk->min[k] ? jobs[i].min[k] : chunk->min[k];
+			chunk->max[k] = first || jobs[i].max[k] > chunk->max[k] ? jobs[i].max[k] : chunk->max[k];
+		}
+	}
+
+	ok = 1;
+	for(c = 0; c < batch->chunk_count; c++) {
+		ok = ok && dash_mesh_upload(&chunk_data[c], &batch->chunks[c].mesh);
+		dash_mesh_data_free(&chunk_data[c]);
+	}
+
+	free(chunk_data);
+	free(jobs);
+	if(!ok) {
+		fprintf(stderr, "Could not upload static batch chunks\n");
+		dash_batch_free(batch);
+	}
+	return ok;
+
+}
+
+void dash_batch_layout(dash_batch *batch, GLint *locations) {
+
+	int c;
+
+	for(c = 0; c < batch->chunk_count; c++) {
+		dash_mesh_layout(&batch->chunks[c].mesh, locations);
+	}
+
+}
+
+int dash_batch_draw(dash_batch *batch, mat4 view_projection) {
+
+	int c, drawn;
+	float planes[24];
+
+	mat4_frustum_planes(view_projection, planes);
+
+	drawn = 0;
+	for(c = 0; c < batch->chunk_count; c++) {
+		if(mat4_frustum_box(planes, batch->chunks[c].min, batch->chunks[c].max)) {
+			dash_mesh_render(&batch->chunks[c].mesh);
+			drawn++;
+		}
+	}
+
+	return drawn;
+
+}
+
+void dash_batch_free(dash_batch *batch) {
+
+	int c;
+
+	for(c = 0; c < batch->chunk_count; c++) {
+		dash_mesh_free(&batch->chunks[c].mesh);
+	}
+	free(batch->chunks);
+	batch->chunks = NULL;
+	batch->chunk_count = 0;
+
+}
+
+/******************************************************************************/
+/** Mesh Cache                                                               **/
+/******************************************************************************/
+
+/*
+	A baked mesh is a header with the vertex layout followed by the vertex and
+	index blobs, each starting on a 4 KiB boundary. Uncompressed blobs are
+	handed from the mapping straight to dash_mesh_upload, which narrows the
+	32 bit indices to fit the vertex count. Compressed blobs store
+	indices as zigzag deltas in varints and vertices as per byte lane deltas
+	with zero runs, in the spirit of the meshoptimizer codecs, and are decoded
+	into one buffer before upload. The header records the source file's size
+	and modification time so dash_mesh_load_cached can rebuild stale caches.
+*/
+
+#define MESH_MAGIC 0x48534d44
+#define MESH_VERSION 1
+#define MESH_ALIGN 4096
+#define MESH_COMPRESSED 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t index_size;
+	int64_t source_mtime;
+	uint64_t source_size;
+	uint64_t vertex_count;
+	uint64_t index_count;
+	int32_t stride;
+	int32_t texcoord;
+	int32_t normal;
+	int32_t color;
+	uint64_t vertex_offset;
+	uint64_t vertex_bytes;
+	uint64_t index_offset;
+	uint64_t index_bytes;
+} mesh_header;
+
+static size_t encode_indices(const uint32_t *indices, size_t count, unsigned char *out) {
+
+	size_t i, n;
+	uint32_t prev, zz;
+	int32_t delta;
+
+	n = 0;
+	prev = 0;
+	for(i = 0; i < count; i++) {
+		delta = (int32_t)(indices[i] - prev);
+		zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		while(zz >= 0x80) {
+			out[n++] = (zz & 0x7f) | 0x80;
+			zz >>= 7;
+		}
+		out[n++] = zz;
+		prev = indices[i];
+	}
+
+	return n;
+
+}
+
+static int decode_indices(const unsigned char *in, size_t size, uint32_t *indices, size_t count) {
+
+	size_t i, n;
+	int shift;
+	uint32_t prev, zz;
+
+	n = 0;
+	prev = 0;
+	for(i = 0; i < count; i++) {
+		zz = 0;
+		shift = 0;
+		do {
+			if(n >= size || shift > 28) {
+				return 0;
+			}
+			zz |= (uint32_t)(in[n] & 0x7f) << shift;
+			shift += 7;
+		} while(in[n++] & 0x80);
+		prev += (zz >> 1) ^ -(zz & 1);
+		indices[i] = prev;
+	}
+
+	return 1;
+
+}
+
+static size_t encode_vertices(const unsigned char *src, size_t count, size_t stride, unsigned char *out) {
+
+	size_t i, k, n, run;
+	unsigned char d;
+
+	// Byte lanes are coded one after another, zero deltas as (0, run length)
+
+	n = 0;
+	for(k = 0; k < stride; k++) {
+		run = 0;
+		for(i = 0; i < count; i++) {
+			d = src[i * stride + k] - (i ? src[(i - 1) * stride + k] : 0);
+			if(d == 0 && run < 255) {
+				run++;
+				continue;
+			}
+			if(run > 0) {
+				out[n++] = 0;
+				out[n++] = run;
+				run = 0;
+			}
+			if(d == 0) {
+				run = 1;
+			} else {
+				out[n++] = d;
+			}
+		}
+		if(run > 0) {
+			out[n++] = 0;
+			out[n++] = run;
+		}
+	}
+
+	return n;
+
+}
+
+static int decode_vertices(const unsigned char *in, size_t size, unsigned char *dst, size_t count, size_t stride) {
+
+	size_t i, k, n, run;
+	unsigned char prev;
+
+	n = 0;
+	for(k = 0; k < stride; k++) {
+		prev = 0;
+		for(i = 0; i < count; ) {
+			if(n >= size) {
+				return 0;
+			}
+			if(in[n] == 0) {
+				if(n + 1 >= size) {
+					return 0;
+				}
+				run = in[n + 1];
+				n += 2;
+				while(run-- > 0 && i < count) {
+					dst[i++ * stride + k] = prev;
+				}
+			} else {
+				prev += in[n++];
+				dst[i++ * stride + k] = prev;
+			}
+		}
+	}
+
+	return 1;
+
+}
+
+int dash_mesh_write(const char *src, dash_mesh_data *mesh, const char *dst, int flags) {
+
+	FILE *fp;
+	int compress;
+	struct stat st;
+	mesh_header header;
+	unsigned char *vertex_blob, *index_blob;
+	static const unsigned char zero[MESH_ALIGN];
+
+	// The source file stamps the cache so it can be checked for staleness
+
+	if(stat(src, &st) != 0) {
+		fprintf(stderr, "Could not open %s for reading\n", src);
+		return 0;
+	}
+	compress = flags & DASH_MESH_COMPRESS;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.flags = compress ? MESH_COMPRESSED : 0;
+	header.index_size = sizeof(uint32_t);
+	header.source_mtime = st.st_mtime;
+	header.source_size = st.st_size;
+	header.vertex_count = mesh->vertex_count;
+	header.index_count = mesh->index_count;
+	header.stride = mesh->stride;
+	header.texcoord = mesh->texcoord;
+	header.normal = mesh->normal;
+	header.color = mesh->color;
+
+	vertex_blob = (unsigned char*)mesh->vertices;
+	index_blob = (unsigned char*)mesh->indices;
+	header.vertex_bytes = mesh->vertex_count * mesh->stride * sizeof(float);
+	header.index_bytes = mesh->index_count * sizeof(uint32_t);
+
+	if(compress) {
+		vertex_blob = (unsigned char*)malloc(header.vertex_bytes * 2 + 16);
+		index_blob = (unsigned char*)malloc(mesh->index_count * 5 + 16);
+		header.vertex_bytes = encode_vertices((unsigned char*)mesh->vertices,
+			mesh->vertex_count, mesh->stride * sizeof(float), vertex_blob);
+		header.index_bytes = encode_indices(mesh->indices, mesh->index_count, index_blob);
+	}
+
+	header.vertex_offset = MESH_ALIGN;
+	header.index_offset = header.vertex_offset + ((header.vertex_bytes + MESH_ALIGN - 1) & ~(uint64_t)(MESH_ALIGN - 1));
+
+	fp = fopen(dst, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Could not open %s for writing\n", dst);
+	} else {
+		fwrite(&header, sizeof(header), 1, fp);
+		fwrite(zero, MESH_ALIGN - sizeof(header), 1, fp);
+		fwrite(vertex_blob, header.vertex_bytes, 1, fp);
+		fwrite(zero, header.index_offset - header.vertex_offset - header.vertex_bytes, 1, fp);
+		fwrite(index_blob, header.index_bytes, 1, fp);
+		fclose(fp);
+	}
+
+	if(compress) {
+		free(vertex_blob);
+		free(index_blob);
+	}
+
+	return fp != NULL;
+
+}
+
+int dash_mesh_bake(const char *src, const char *dst, int flags) {
+
+	int ok;
+	dash_mesh_data data;
+
+	if(!dash_mesh_load(src, &data)) {
+		return 0;
+	}
+
+	if(flags & DASH_MESH_OPTIMIZE) {
+		dash_mesh_optimize(&data, DASH_VERTEX_CACHE_SIZE);
+	}
+
+	ok = dash_mesh_write(src, &data, dst, flags);
+	dash_mesh_data_free(&data);
+
+	return ok;
+
+}
+
+static int mesh_attribute_valid(int32_t offset, int width, int32_t stride) {
+
+	return offset == -1 || (offset >= 3 && offset + width <= stride);
+
+}
+
+static int mesh_header_valid(const mesh_header *h, uint64_t size) {
+
+	uint64_t vertex_size;
+
+	if(h->magic != MESH_MAGIC || h->version != MESH_VERSION ||
+		h->index_size != sizeof(uint32_t) || h->stride < 3 || h->stride > 12) {
+		return 0;
+	}
+
+	if(!mesh_attribute_valid(h->texcoord, 2, h->stride) ||
+		!mesh_attribute_valid(h->normal, 3, h->stride) ||
+		!mesh_attribute_valid(h->color, 4, h->stride)) {
+		return 0;
+	}
+
+	if(h->vertex_offset > size || h->vertex_bytes > size - h->vertex_offset ||
+		h->index_offset > size || h->index_bytes > size - h->index_offset) {
+		return 0;
+	}
+
+	// Raw streams must hold every vertex and index the header promises,
+	// compressed ones are bounded by their decoders
+
+	vertex_size = h->stride * sizeof(float);
+	if(!(h->flags & MESH_COMPRESSED)) {
+		return h->vertex_bytes / vertex_size >= h->vertex_count &&
+			h->index_bytes / sizeof(uint32_t) >= h->index_count;
+	}
+
+	return h->vertex_count <= SIZE_MAX / vertex_size &&
+		h->index_count <= SIZE_MAX / sizeof(uint32_t);
+
+}
+
+static int mesh_indices_valid(const uint32_t *indices, uint64_t count, uint64_t vertex_count) {
+
+	uint64_t i;
+
+	for(i = 0; i < count; i++) {
+		if(indices[i] >= vertex_count) {
+			return 0;
+		}
+	}
+
+	return 1;
+
+}
+
+int dash_mesh_load_baked(const char *filename, dash_mesh *mesh) {
+
+	int fd, ok;
+	struct stat st;
+	unsigned char *map, *vertices, *indices;
+	mesh_header header;
+	dash_mesh_data data;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		return 0;
+	}
+
+	if(fstat(fd, &st) != 0 || st.st_size < MESH_ALIGN) {
+		close(fd);
+		return 0;
+	}
+
+	map = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return 0;
+	}
+
+	memcpy(&header, map, sizeof(header));
+	if(!mesh_header_valid(&header, st.st_size)) {
+		fprintf(stderr, "%s is not a valid baked mesh\n", filename);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	vertices = map + header.vertex_offset;
+	indices = map + header.index_offset;
+	ok = 1;
+
+	if(header.flags & MESH_COMPRESSED) {
+		vertices = (unsigned char*)malloc(header.vertex_count * header.stride * sizeof(float) + 1);
+		indices = (unsigned char*)malloc(header.index_count * sizeof(uint32_t) + 1);
+		ok = vertices != NULL && indices != NULL;
+		ok = ok && decode_vertices(map + header.vertex_offset, header.vertex_bytes, vertices,
+			header.vertex_count, header.stride * sizeof(float));
+		ok = ok && decode_indices(map + header.index_offset, header.index_bytes,
+			(uint32_t*)indices, header.index_count);
+		if(!ok) {
+			fprintf(stderr, "%s has corrupt mesh streams\n", filename);
+		}
+	}
+
+	if(ok && !mesh_indices_valid((uint32_t*)indices, header.index_count, header.vertex_count)) {
+		fprintf(stderr, "%s has indices past its vertices\n", filename);
+		ok = 0;
+	}
+
+	if(ok) {
+		data.vertices = (float*)vertices;
+		data.vertex_count = header.vertex_count;
+		data.stride = header.stride;
+		data.texcoord = header.texcoord;
+		data.normal = header.normal;
+		data.color = header.color;
+		data.indices = (uint32_t*)indices;
+		data.index_count = header.index_count;
+		ok = dash_mesh_upload(&data, mesh);
+	}
+
+	if(header.flags & MESH_COMPRESSED) {
+		free(vertices);
+		free(indices);
+	}
+
+	munmap(map, st.st_size);
+	return ok;
+
+}
+
+static int mesh_cache_fresh(const char *cache, struct stat *src) {
+
+	FILE *fp;
+	mesh_header header;
+	int fresh;
+
+	fp = fopen(cache, "rb");
+	if(fp == NULL) {
+		return 0;
+	}
+
+	fresh = fread(&header, sizeof(header), 1, fp) == 1 &&
+		header.magic == MESH_MAGIC && header.version == MESH_VERSION &&
+		header.source_mtime == src->st_mtime &&
+		header.source_size == (uint64_t)src->st_size;
+
+	fclose(fp);
+	return fresh;
+
+}
+
+int dash_mesh_load_cached(const char *filename, dash_mesh *mesh) {
+
+	char cache[1024];
+	struct stat st;
+
+	if(stat(filename, &st) != 0) {
+		fprintf(stderr, "Could not open %s for reading\n", filename);
+		return 0;
+	}
+
+	snprintf(cache, sizeof(cache), "%s.dmsh", filename);
+	if(mesh_cache_fresh(cache, &st) && dash_mesh_load_baked(cache, mesh)) {
+		return 1;
+	}
+
+	// A stale, truncated or corrupt cache is baked again from the source
+
+	if(!dash_mesh_bake(filename, cache, DASH_MESH_OPTIMIZE)) {
+		return 0;
+	}
+
+	return dash_mesh_load_baked(cache, mesh);
+
+}
+
+/******************************************************************************/
+/** End Program	                                                             **/
+/******************************************************************************/
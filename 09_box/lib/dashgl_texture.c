@@ -0,0 +1,1195 @@
+/*
+    This file is part of Dash Graphics Library
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <GL/glew.h>
+#include "dashgl.h"
+
+/******************************************************************************/
+/** Texture Cache                                                            **/
+/******************************************************************************/
+
+/*
+	Textures are keyed by path and modification time. Each acquire adds a
+	reference and each release drops one. With no budget set, a texture is
+	deleted as soon as its last reference is released. With a budget set,
+	released textures stay resident so a later acquire is free, and the least
+	recently bound of them are deleted once resident bytes exceed the budget.
+	Textures that are still referenced are never evicted.
+*/
+
+typedef struct {
+	char *path;
+	time_t mtime;
+	GLuint texture_id;
+	int refcount;
+	int stale;
+	size_t bytes;
+	unsigned long last_bind;
+} dash_texture_entry;
+
+static dash_texture_entry *cache_entries = NULL;
+static int cache_count = 0;
+static int cache_capacity = 0;
+static size_t cache_budget = 0;
+static size_t cache_resident = 0;
+static unsigned long cache_tick = 0;
+
+static dash_texture_entry *cache_find_id(GLuint texture_id) {
+
+	int i;
+
+	for(i = 0; i < cache_count; i++) {
+		if(cache_entries[i].texture_id == texture_id) {
+			return &cache_entries[i];
+		}
+	}
+
+	return NULL;
+
+}
+
+static void cache_evict(dash_texture_entry *entry) {
+
+	glDeleteTextures(1, &entry->texture_id);
+	cache_resident -= entry->bytes;
+	free(entry->path);
+
+	cache_count--;
+	*entry = cache_entries[cache_count];
+
+}
+
+static void cache_enforce_budget() {
+
+	int i;
+	dash_texture_entry *oldest;
+
+	while(cache_resident > cache_budget) {
+
+		oldest = NULL;
+		for(i = 0; i < cache_count; i++) {
+			if(cache_entries[i].refcount > 0) {
+				continue;
+			}
+			if(oldest == NULL || cache_entries[i].last_bind < oldest->last_bind) {
+				oldest = &cache_entries[i];
+			}
+		}
+
+		if(oldest == NULL) {
+			return;
+		}
+
+		cache_evict(oldest);
+
+	}
+
+}
+
+GLuint dash_texture_acquire(const char *filename) {
+
+	int i;
+	struct stat st;
+	dash_image img;
+	dash_texture_data data;
+	dash_texture_entry *entry;
+
+	if(stat(filename, &st) != 0) {
+		fprintf(stderr, "Could not open %s for reading\n", filename);
+		return 0;
+	}
+
+	for(i = 0; i < cache_count; i++) {
+
+		entry = &cache_entries[i];
+		if(entry->stale || strcmp(entry->path, filename) != 0) {
+			continue;
+		}
+
+		if(entry->mtime == st.st_mtime) {
+			entry->refcount++;
+			entry->last_bind = ++cache_tick;
+			return entry->texture_id;
+		}
+
+		// File changed on disk, old handles keep the old texture until released
+
+		if(entry->refcount == 0) {
+			cache_evict(entry);
+		} else {
+			entry->stale = 1;
+		}
+		break;
+
+	}
+
+	if(!dash_image_load(filename, &img)) {
+		return 0;
+	}
+
+	if(cache_count == cache_capacity) {
+		cache_capacity = cache_capacity ? cache_capacity * 2 : 16;
+		cache_entries = (dash_texture_entry*)realloc(cache_entries,
+			sizeof(dash_texture_entry) * cache_capacity);
+	}
+
+	entry = &cache_entries[cache_count++];
+	entry->path = strdup(filename);
+	entry->mtime = st.st_mtime;
+	dash_image_convert(&img, 0, &data);
+	entry->texture_id = dash_texture_create_data(&data);
+	entry->refcount = 1;
+	entry->stale = 0;
+	entry->bytes = (size_t)data.stride * data.height;
+	entry->last_bind = ++cache_tick;
+	cache_resident += entry->bytes;
+
+	free(data.data);
+	dash_image_free(&img);
+	cache_enforce_budget();
+
+	return entry->texture_id;
+
+}
+
+void dash_texture_release(GLuint texture_id) {
+
+	dash_texture_entry *entry;
+
+	entry = cache_find_id(texture_id);
+	if(entry == NULL || entry->refcount == 0) {
+		return;
+	}
+
+	entry->refcount--;
+	if(entry->refcount > 0) {
+		return;
+	}
+
+	if(cache_budget == 0 || entry->stale) {
+		cache_evict(entry);
+	} else {
+		cache_enforce_budget();
+	}
+
+}
+
+void dash_texture_bind(GLuint texture_id) {
+
+	dash_texture_entry *entry;
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+
+	entry = cache_find_id(texture_id);
+	if(entry != NULL) {
+		entry->last_bind = ++cache_tick;
+	}
+
+}
+
+void dash_texture_set_budget(size_t bytes) {
+
+	cache_budget = bytes;
+	cache_enforce_budget();
+
+}
+
+size_t dash_texture_resident_bytes() {
+
+	return cache_resident;
+
+}
+
+void dash_texture_cache_clear() {
+
+	while(cache_count > 0) {
+		cache_evict(&cache_entries[cache_count - 1]);
+	}
+
+	free(cache_entries);
+	cache_entries = NULL;
+	cache_capacity = 0;
+
+}
+
+/******************************************************************************/
+/** Baked Textures                                                           **/
+/******************************************************************************/
+
+/*
+	A baked texture is a header followed by mip level payloads already in the
+	layout glTexImage2D expects. Every payload starts on a 4 KiB boundary so the
+	file can be mapped and each level handed to GL straight from the mapping.
+*/
+
+#define BAKED_MAGIC 0x58455444
+#define BAKED_VERSION 1
+#define BAKED_ALIGN 4096
+#define BAKED_MAX_MIPS 16
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t width;
+	uint32_t height;
+} baked_mip;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t internal_format;
+	uint32_t format;
+	uint32_t type;
+	uint32_t mip_count;
+	baked_mip mips[BAKED_MAX_MIPS];
+} baked_header;
+
+static void baked_downsample(dash_image *src, dash_image *dst) {
+
+	int x, y, c, x0, x1, y0, y1, sum;
+	int n = src->channels;
+
+	dst->width = src->width > 1 ? src->width / 2 : 1;
+	dst->height = src->height > 1 ? src->height / 2 : 1;
+	dst->channels = n;
+	dst->data = (unsigned char*)malloc(dst->width * dst->height * n);
+
+	for(y = 0; y < dst->height; y++) {
+		y0 = y * 2 < src->height ? y * 2 : src->height - 1;
+		y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+		for(x = 0; x < dst->width; x++) {
+			x0 = x * 2 < src->width ? x * 2 : src->width - 1;
+			x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+			for(c = 0; c < n; c++) {
+				sum = src->data[(y0 * src->width + x0) * n + c];
+				sum += src->data[(y0 * src->width + x1) * n + c];
+				sum += src->data[(y1 * src->width + x0) * n + c];
+				sum += src->data[(y1 * src->width + x1) * n + c];
+				dst->data[(y * dst->width + x) * n + c] = (sum + 2) / 4;
+			}
+		}
+	}
+
+}
+
+int dash_texture_bake(const char *src, const char *dst, GLenum format, dash_compress_stats *stats) {
+
+	FILE *fp;
+	int i, ok;
+	uint32_t offset;
+	baked_header header;
+	dash_image levels[BAKED_MAX_MIPS];
+	unsigned char *blocks;
+	static const unsigned char zero[BAKED_ALIGN];
+
+	if(!dash_image_load(src, &levels[0])) {
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = BAKED_MAGIC;
+	header.version = BAKED_VERSION;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.format = levels[0].channels == 4 ? GL_RGBA : GL_RGB;
+	header.internal_format = header.format;
+	header.type = GL_UNSIGNED_BYTE;
+
+	// BC1 has no alpha worth keeping so rgba sources go to BC3, and there
+	// is no ETC2 alpha encoder at all
+
+	if(format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT && levels[0].channels == 4) {
+		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+	if(format == GL_COMPRESSED_RGB8_ETC2 && levels[0].channels == 4) {
+		fprintf(stderr, "%s has an alpha channel, ETC2 is only stored as rgb\n", src);
+		dash_image_free(&levels[0]);
+		return 0;
+	}
+
+	// Compressed payloads are flagged by a zero pixel format
+
+	if(format != 0) {
+		header.format = 0;
+		header.internal_format = format;
+		header.type = 0;
+	}
+	header.mip_count = 1;
+
+	while(header.mip_count < BAKED_MAX_MIPS) {
+		i = header.mip_count - 1;
+		if(levels[i].width == 1 && levels[i].height == 1) {
+			break;
+		}
+		baked_downsample(&levels[i], &levels[i + 1]);
+		header.mip_count++;
+	}
+
+	offset = BAKED_ALIGN;
+	for(i = 0; i < header.mip_count; i++) {
+		header.mips[i].offset = offset;
+		header.mips[i].size = levels[i].width * levels[i].height * levels[i].channels;
+		if(format != 0) {
+			header.mips[i].size = dash_compressed_size(format, levels[i].width, levels[i].height);
+		}
+		header.mips[i].width = levels[i].width;
+		header.mips[i].height = levels[i].height;
+		offset += (header.mips[i].size + BAKED_ALIGN - 1) & ~(BAKED_ALIGN - 1);
+	}
+
+	fp = fopen(dst, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Could not open %s for writing\n", dst);
+		for(i = 0; i < header.mip_count; i++) {
+			dash_image_free(&levels[i]);
+		}
+		return 0;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(zero, BAKED_ALIGN - sizeof(header), 1, fp);
+	ok = 1;
+	for(i = 0; i < header.mip_count; i++) {
+		if(format != 0) {
+			blocks = (unsigned char*)malloc(header.mips[i].size);
+			ok = ok && dash_image_compress(&levels[i], format, blocks, i == 0 ? stats : NULL);
+			fwrite(blocks, header.mips[i].size, 1, fp);
+			free(blocks);
+		} else {
+			fwrite(levels[i].data, header.mips[i].size, 1, fp);
+		}
+		fwrite(zero, (BAKED_ALIGN - header.mips[i].size % BAKED_ALIGN) % BAKED_ALIGN, 1, fp);
+		dash_image_free(&levels[i]);
+	}
+
+	fclose(fp);
+	return ok;
+
+}
+
+GLuint dash_texture_load_baked(const char *filename) {
+
+	int fd, i, bpp;
+	size_t expected;
+	struct stat st;
+	unsigned char *map;
+	baked_header *header;
+	baked_mip *mip;
+	GLuint texture_id;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open %s for reading\n", filename);
+		return 0;
+	}
+
+	if(fstat(fd, &st) != 0 || st.st_size < BAKED_ALIGN) {
+		fprintf(stderr, "%s is not a valid baked texture\n", filename);
+		close(fd);
+		return 0;
+	}
+
+	map = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", filename);
+		return 0;
+	}
+
+	header = (baked_header*)map;
+	if(header->magic != BAKED_MAGIC || header->version != BAKED_VERSION ||
+		header->mip_count == 0 || header->mip_count > BAKED_MAX_MIPS) {
+		fprintf(stderr, "%s is not a valid baked texture\n", filename);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	// Payload sizes are checked against what GL will read for each level so
+	// a truncated or corrupt file is rejected rather than read past the end
+
+	bpp = 0;
+	if(header->format != 0) {
+		bpp = header->format == GL_RGBA ? 4 : (header->format == GL_RGB ? 3 : 0);
+		if(header->type != GL_UNSIGNED_BYTE) {
+			bpp = 0;
+		}
+	} else if(!dash_compressed_supported(header->internal_format)) {
+		fprintf(stderr, "%s uses compressed format 0x%x which is not supported\n",
+			filename, header->internal_format);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	for(i = 0; i < header->mip_count; i++) {
+		mip = &header->mips[i];
+		expected = (size_t)mip->width * mip->height * bpp;
+		if(header->format == 0) {
+			expected = dash_compressed_size(header->internal_format, mip->width, mip->height);
+		}
+		if(mip->width == 0 || mip->height == 0 || expected == 0 || mip->size != expected) {
+			fprintf(stderr, "%s is not a valid baked texture\n", filename);
+			munmap(map, st.st_size);
+			return 0;
+		}
+		if((off_t)mip->offset + mip->size > st.st_size) {
+			fprintf(stderr, "%s is truncated\n", filename);
+			munmap(map, st.st_size);
+			return 0;
+		}
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for(i = 0; i < header->mip_count; i++) {
+		mip = &header->mips[i];
+		if(header->format == 0) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, header->internal_format,
+				mip->width, mip->height, 0, mip->size, map + mip->offset);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, i, header->internal_format,
+				mip->width, mip->height, 0, header->format, header->type,
+				map + mip->offset);
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		header->mip_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	#ifndef GL_ES_VERSION_2_0
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->mip_count - 1);
+	#endif
+
+	munmap(map, st.st_size);
+	return texture_id;
+
+}
+
+/******************************************************************************/
+/** Texture Atlas                                                            **/
+/******************************************************************************/
+
+/*
+	Sources are packed with a skyline bottom-left packer. Every source is
+	surrounded by copies of its own edge texels and placed on a 4 texel grid,
+	so bilinear filtering and the first mip levels never pull in a neighbour.
+	UV rectangles use the same convention as the lesson texcoords, where the
+	fragment shader flips v, so remapping is a plain scale and offset.
+*/
+
+#define ATLAS_GRID 4
+
+typedef struct {
+	int x;
+	int y;
+	int width;
+} atlas_segment;
+
+typedef struct {
+	int index;
+	int width;
+	int height;
+	int x;
+	int y;
+} atlas_item;
+
+static int atlas_grid(int v) {
+
+	return (v + ATLAS_GRID - 1) & ~(ATLAS_GRID - 1);
+
+}
+
+static int atlas_compare(const void *a, const void *b) {
+
+	const atlas_item *ia = (const atlas_item*)a;
+	const atlas_item *ib = (const atlas_item*)b;
+
+	if(ia->height != ib->height) {
+		return ib->height - ia->height;
+	}
+	return ib->width - ia->width;
+
+}
+
+static int atlas_pack(atlas_item *items, int count, int size) {
+
+	int i, j, k, x, y, top, best, best_x, best_y, span, seg_count;
+	atlas_segment *sky;
+
+	sky = (atlas_segment*)malloc(sizeof(atlas_segment) * (count * 2 + 2));
+	sky[0].x = 0;
+	sky[0].y = 0;
+	sky[0].width = size;
+	seg_count = 1;
+
+	for(i = 0; i < count; i++) {
+
+		best = -1;
+		best_x = 0;
+		best_y = size;
+
+		for(j = 0; j < seg_count; j++) {
+
+			x = sky[j].x;
+			if(x + items[i].width > size) {
+				break;
+			}
+
+			// Rest on the highest segment under the span
+
+			y = 0;
+			span = 0;
+			for(k = j; k < seg_count && span < items[i].width; k++) {
+				y = sky[k].y > y ? sky[k].y : y;
+				span += sky[k].width;
+			}
+
+			if(y + items[i].height <= size && y < best_y) {
+				best = j;
+				best_x = x;
+				best_y = y;
+			}
+
+		}
+
+		if(best == -1) {
+			free(sky);
+			return 0;
+		}
+
+		items[i].x = best_x;
+		items[i].y = best_y;
+		top = best_y + items[i].height;
+
+		// Replace the covered segments with one at the new height
+
+		span = items[i].width;
+		k = best;
+		while(k < seg_count && span > 0) {
+			if(sky[k].width <= span) {
+				span -= sky[k].width;
+				memmove(&sky[k], &sky[k + 1], sizeof(atlas_segment) * (seg_count - k - 1));
+				seg_count--;
+			} else {
+				sky[k].x += span;
+				sky[k].width -= span;
+				span = 0;
+			}
+		}
+
+		memmove(&sky[best + 1], &sky[best], sizeof(atlas_segment) * (seg_count - best));
+		sky[best].x = best_x;
+		sky[best].y = top;
+		sky[best].width = items[i].width;
+		seg_count++;
+
+		for(k = 0; k + 1 < seg_count; k++) {
+			if(sky[k].y == sky[k + 1].y) {
+				sky[k].width += sky[k + 1].width;
+				memmove(&sky[k + 1], &sky[k + 2], sizeof(atlas_segment) * (seg_count - k - 2));
+				seg_count--;
+				k--;
+			}
+		}
+
+	}
+
+	free(sky);
+	return 1;
+
+}
+
+static void atlas_blit(dash_image *atlas, dash_image *src, int dx, int dy, int padding) {
+
+	int x, y, c, sx, sy;
+	unsigned char *out;
+
+	for(y = -padding; y < src->height + padding; y++) {
+		sy = y < 0 ? 0 : (y >= src->height ? src->height - 1 : y);
+		for(x = -padding; x < src->width + padding; x++) {
+			sx = x < 0 ? 0 : (x >= src->width ? src->width - 1 : x);
+			out = atlas->data + ((dy + y) * atlas->width + dx + x) * 4;
+			for(c = 0; c < 3; c++) {
+				out[c] = src->data[(sy * src->width + sx) * src->channels + c];
+			}
+			out[3] = src->channels == 4 ? src->data[(sy * src->width + sx) * 4 + 3] : 255;
+		}
+	}
+
+}
+
+int dash_atlas_build(const char **filenames, int count, int max_size, int padding, dash_atlas *atlas) {
+
+	int i, size, ok;
+	dash_image *images;
+	dash_image page;
+	atlas_item *items;
+
+	atlas->texture_id = 0;
+	atlas->width = 0;
+	atlas->height = 0;
+	atlas->count = count;
+	atlas->rects = NULL;
+
+	images = (dash_image*)calloc(count, sizeof(dash_image));
+	items = (atlas_item*)malloc(sizeof(atlas_item) * count);
+
+	ok = 1;
+	for(i = 0; i < count && ok; i++) {
+		ok = dash_image_load(filenames[i], &images[i]);
+		items[i].index = i;
+		items[i].width = atlas_grid(images[i].width + padding * 2);
+		items[i].height = atlas_grid(images[i].height + padding * 2);
+	}
+
+	if(ok) {
+		qsort(items, count, sizeof(atlas_item), atlas_compare);
+		for(size = 256; size < max_size && !atlas_pack(items, count, size); size *= 2);
+		ok = size <= max_size && atlas_pack(items, count, size);
+		if(!ok) {
+			fprintf(stderr, "Atlas does not fit in %dx%d\n", max_size, max_size);
+		}
+	}
+
+	if(ok) {
+
+		page.width = size;
+		page.height = size;
+		page.channels = 4;
+		page.data = (unsigned char*)calloc(size * size, 4);
+
+		atlas->width = size;
+		atlas->height = size;
+		atlas->rects = (dash_uv_rect*)malloc(sizeof(dash_uv_rect) * count);
+
+		for(i = 0; i < count; i++) {
+			dash_image *src = &images[items[i].index];
+			dash_uv_rect *rect = &atlas->rects[items[i].index];
+			int x = items[i].x + padding;
+			int y = items[i].y + padding;
+			atlas_blit(&page, src, x, y, padding);
+			rect->u0 = (float)x / size;
+			rect->u1 = (float)(x + src->width) / size;
+			rect->v0 = 1.0f - (float)(y + src->height) / size;
+			rect->v1 = 1.0f - (float)y / size;
+		}
+
+		atlas->texture_id = dash_texture_create(&page);
+		if(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		}
+		dash_image_free(&page);
+
+	}
+
+	for(i = 0; i < count; i++) {
+		dash_image_free(&images[i]);
+	}
+	free(images);
+	free(items);
+
+	return ok;
+
+}
+
+void dash_atlas_remap(dash_atlas *atlas, int index, float *vertices, int vertex_count, int stride, int uv_offset) {
+
+	int i;
+	float *uv;
+	dash_uv_rect *rect = &atlas->rects[index];
+
+	for(i = 0; i < vertex_count; i++) {
+		uv = vertices + i * stride + uv_offset;
+		uv[0] = rect->u0 + uv[0] * (rect->u1 - rect->u0);
+		uv[1] = rect->v0 + uv[1] * (rect->v1 - rect->v0);
+	}
+
+}
+
+void dash_atlas_free(dash_atlas *atlas) {
+
+	glDeleteTextures(1, &atlas->texture_id);
+	free(atlas->rects);
+	atlas->rects = NULL;
+	atlas->texture_id = 0;
+
+}
+
+/******************************************************************************/
+/** Texture Arrays                                                           **/
+/******************************************************************************/
+
+/*
+	Loads same sized images as the layers of one GL_TEXTURE_2D_ARRAY. Pair it
+	with shader/vertex_array.glsl and shader/fragment_array.glsl, where the
+	layer attribute can be per vertex or, with glVertexAttribDivisor, per
+	instance, so cubes with different skins share one texture binding.
+*/
+
+GLuint dash_texture_array_load(const char **filenames, int count) {
+
+	int i, width, height;
+	GLuint texture_id;
+	dash_image img;
+
+	#ifdef GL_ES_VERSION_2_0
+	fprintf(stderr, "Texture arrays are not available on OpenGL ES 2.0\n");
+	return 0;
+	#else
+	if(!GLEW_VERSION_3_0 && !GLEW_EXT_texture_array) {
+		fprintf(stderr, "Error your gpu does not support texture arrays\n");
+		return 0;
+	}
+
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// Storage is sized from the first layer, every layer must match it
+
+	width = 0;
+	height = 0;
+
+	for(i = 0; i < count; i++) {
+
+		if(!dash_image_load(filenames[i], &img)) {
+			glDeleteTextures(1, &texture_id);
+			texture_id = 0;
+			break;
+		}
+
+		if(i == 0) {
+			width = img.width;
+			height = img.height;
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, count,
+				0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		} else if(img.width != width || img.height != height) {
+			fprintf(stderr, "%s is %dx%d, texture array layers are %dx%d\n",
+				filenames[i], img.width, img.height, width, height);
+			dash_image_free(&img);
+			glDeleteTextures(1, &texture_id);
+			texture_id = 0;
+			break;
+		}
+
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1,
+			img.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, img.data);
+		dash_image_free(&img);
+
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return texture_id;
+	#endif
+
+}
+
+/******************************************************************************/
+/** Texture Streams                                                          **/
+/******************************************************************************/
+
+/*
+	Plays a numbered PNG or QOI sequence into one fixed texture. A decode
+	thread fills a ring of slots ahead of playback and the GL thread uploads
+	the due frame with glTexSubImage2D from a pixel buffer object. With
+	ARB_buffer_storage the ring lives in one persistently mapped PBO that the
+	decode thread writes into directly, and a fence per slot keeps it from
+	being refilled while the upload may still be reading it. Otherwise every
+	slot owns a PBO that the GL thread orphans and maps while the slot is
+	empty, the decode thread writes into that mapping and the GL thread
+	unmaps it just before the upload. Frames that fail to decode are dropped
+	and their slot is refilled with the next one.
+*/
+
+enum {
+	STREAM_EMPTY,
+	STREAM_READY,
+	STREAM_IN_FLIGHT
+};
+
+typedef struct {
+	int state;
+	long seq;
+	double ready_time;
+	unsigned char *pixels;
+	GLuint pbo;
+	GLsync fence;
+} stream_slot;
+
+struct dash_stream {
+	char *pattern;
+	int frame_count;
+	float fps;
+	int width;
+	int height;
+	int channels;
+	size_t frame_bytes;
+	GLuint texture_id;
+	GLuint pbo;
+	int persistent;
+	unsigned char *mapping;
+	int ring_size;
+	stream_slot *slots;
+	int decode_slot;
+	long decode_seq;
+	long target_seq;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	dash_stream_stats stats;
+	double latency_sum;
+	long shown_seq;
+	long late_seq;
+};
+
+static double stream_now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+static void stream_map_slot(dash_stream *s, stream_slot *slot) {
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, s->frame_bytes, NULL, GL_STREAM_DRAW);
+	slot->pixels = (unsigned char*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+}
+
+static void *stream_decode(void *arg) {
+
+	char filename[1024];
+	int ok;
+	long seq;
+	stream_slot *slot;
+	dash_image img;
+	dash_stream *s = (dash_stream*)arg;
+
+	pthread_mutex_lock(&s->lock);
+
+	while(s->running) {
+
+		slot = &s->slots[s->decode_slot];
+		if(slot->state != STREAM_EMPTY || slot->pixels == NULL) {
+			pthread_cond_wait(&s->wake, &s->lock);
+			continue;
+		}
+
+		// Skip frames that are already behind playback
+
+		if(s->decode_seq < s->target_seq) {
+			s->stats.frames_dropped += s->target_seq - s->decode_seq;
+			s->decode_seq = s->target_seq;
+		}
+
+		seq = s->decode_seq++;
+		pthread_mutex_unlock(&s->lock);
+
+		snprintf(filename, sizeof(filename), s->pattern, (int)(seq % s->frame_count));
+		ok = dash_image_load(filename, &img);
+		if(ok) {
+			ok = img.width == s->width && img.height == s->height && img.channels == s->channels;
+			if(ok) {
+				memcpy(slot->pixels, img.data, s->frame_bytes);
+			} else {
+				fprintf(stderr, "%s does not match the first frame size\n", filename);
+			}
+			dash_image_free(&img);
+		}
+
+		// A frame that could not be decoded is dropped, the slot stays empty
+		// so the previous pixels are never shown again as a new frame
+
+		pthread_mutex_lock(&s->lock);
+		if(!ok) {
+			s->stats.frames_dropped++;
+			continue;
+		}
+		slot->seq = seq;
+		slot->ready_time = stream_now();
+		slot->state = STREAM_READY;
+		s->decode_slot = (s->decode_slot + 1) % s->ring_size;
+
+	}
+
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+
+}
+
+dash_stream *dash_stream_open(const char *pattern, int frame_count, float fps, int ring_size) {
+
+	int i;
+	char filename[1024];
+	dash_image img;
+	dash_stream *s;
+	GLenum format;
+
+	snprintf(filename, sizeof(filename), pattern, 0);
+	if(!dash_image_load(filename, &img)) {
+		return NULL;
+	}
+
+	s = (dash_stream*)calloc(1, sizeof(dash_stream));
+	s->pattern = strdup(pattern);
+	s->frame_count = frame_count;
+	s->fps = fps;
+	s->width = img.width;
+	s->height = img.height;
+	s->channels = img.channels;
+	s->frame_bytes = (size_t)img.width * img.height * img.channels;
+	s->ring_size = ring_size < 2 ? 2 : ring_size;
+	s->slots = (stream_slot*)calloc(s->ring_size, sizeof(stream_slot));
+	s->target_seq = 0;
+	s->decode_seq = 0;
+	s->shown_seq = 0;
+	s->late_seq = -1;
+
+	format = img.channels == 4 ? GL_RGBA : GL_RGB;
+	glGenTextures(1, &s->texture_id);
+	glBindTexture(GL_TEXTURE_2D, s->texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, img.width, img.height, 0, format, GL_UNSIGNED_BYTE, img.data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	dash_image_free(&img);
+
+	glGenBuffers(1, &s->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+
+	s->persistent = GLEW_ARB_buffer_storage && GLEW_ARB_sync;
+	if(s->persistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, s->frame_bytes * s->ring_size, NULL, flags);
+		s->mapping = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+			s->frame_bytes * s->ring_size, flags);
+		s->persistent = s->mapping != NULL;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	for(i = 0; i < s->ring_size; i++) {
+		if(s->persistent) {
+			s->slots[i].pixels = s->mapping + s->frame_bytes * i;
+		} else {
+			glGenBuffers(1, &s->slots[i].pbo);
+			stream_map_slot(s, &s->slots[i]);
+		}
+	}
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	s->running = 1;
+	pthread_create(&s->thread, NULL, stream_decode, s);
+
+	return s;
+
+}
+
+GLuint dash_stream_texture(dash_stream *s) {
+
+	return s->texture_id;
+
+}
+
+void dash_stream_update(dash_stream *s, double seconds) {
+
+	int i, freed;
+	double latency;
+	stream_slot *slot, *due;
+
+	pthread_mutex_lock(&s->lock);
+
+	// Return slots whose upload has finished reading the mapping
+
+	freed = 0;
+	for(i = 0; i < s->ring_size; i++) {
+		slot = &s->slots[i];
+		if(slot->state != STREAM_IN_FLIGHT) {
+			continue;
+		}
+		if(slot->fence != NULL) {
+			if(glClientWaitSync(slot->fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+				continue;
+			}
+			glDeleteSync(slot->fence);
+			slot->fence = NULL;
+		}
+		slot->state = STREAM_EMPTY;
+		freed = 1;
+	}
+
+	// Without persistent mapping empty slots get a freshly orphaned mapping
+
+	for(i = 0; i < s->ring_size && !s->persistent; i++) {
+		slot = &s->slots[i];
+		if(slot->state == STREAM_EMPTY && slot->pixels == NULL) {
+			stream_map_slot(s, slot);
+			freed = 1;
+		}
+	}
+
+	// Pick the newest ready frame that is due, older ready frames are dropped
+
+	s->target_seq = (long)(seconds * s->fps);
+	due = NULL;
+	for(i = 0; i < s->ring_size; i++) {
+		slot = &s->slots[i];
+		if(slot->state != STREAM_READY || slot->seq > s->target_seq) {
+			continue;
+		}
+		if(due != NULL && due->seq < slot->seq) {
+			due->state = STREAM_EMPTY;
+			s->stats.frames_dropped++;
+			freed = 1;
+		} else if(due != NULL) {
+			slot->state = STREAM_EMPTY;
+			s->stats.frames_dropped++;
+			freed = 1;
+			continue;
+		}
+		due = slot;
+	}
+
+	if(due == NULL) {
+		if(s->target_seq > s->shown_seq && s->target_seq != s->late_seq) {
+			s->stats.frames_late++;
+			s->late_seq = s->target_seq;
+		}
+		if(freed) {
+			pthread_cond_signal(&s->wake);
+		}
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+
+	due->state = STREAM_IN_FLIGHT;
+	pthread_mutex_unlock(&s->lock);
+
+	glBindTexture(GL_TEXTURE_2D, s->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if(s->persistent) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s->width, s->height,
+			s->channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE,
+			(void*)(due->pixels - s->mapping));
+		due->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	} else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, due->pbo);
+		if(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s->width, s->height,
+				s->channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, 0);
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	latency = (stream_now() - due->ready_time) * 1000.0;
+
+	pthread_mutex_lock(&s->lock);
+	if(!s->persistent) {
+		due->pixels = NULL;
+	}
+	s->stats.frames_shown++;
+	s->shown_seq = due->seq;
+	s->latency_sum += latency;
+	s->stats.avg_latency_ms = s->latency_sum / s->stats.frames_shown;
+	if(latency > s->stats.max_latency_ms) {
+		s->stats.max_latency_ms = latency;
+	}
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+
+}
+
+void dash_stream_get_stats(dash_stream *s, dash_stream_stats *stats) {
+
+	pthread_mutex_lock(&s->lock);
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->lock);
+
+}
+
+void dash_stream_close(dash_stream *s) {
+
+	int i;
+
+	pthread_mutex_lock(&s->lock);
+	s->running = 0;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+
+	for(i = 0; i < s->ring_size; i++) {
+		if(s->slots[i].fence != NULL) {
+			glDeleteSync(s->slots[i].fence);
+		}
+		if(!s->persistent && s->slots[i].pbo != 0) {
+			if(s->slots[i].pixels != NULL) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->slots[i].pbo);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+			glDeleteBuffers(1, &s->slots[i].pbo);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if(s->persistent) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	glDeleteBuffers(1, &s->pbo);
+	glDeleteTextures(1, &s->texture_id);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->wake);
+	free(s->slots);
+	free(s->pattern);
+	free(s);
+
+}
+
+/******************************************************************************/
+/** End Program	                                                             **/
+/******************************************************************************/
@@ -0,0 +1,1769 @@
+/*
+    This file is part of Dash Graphics Library
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <GL/glew.h>
+#include "dashgl.h"
+
+#define MAX_THREADS 64
+
+/******************************************************************************/
+/** Voxel Storage                                                            **/
+/******************************************************************************/
+
+/*
+	A chunk stores its voxels as indices into a palette of the types it
+	uses, packed 1, 2, 4 or 8 bits to a voxel so an index never straddles
+	a byte. A chunk of one type needs no indices at all, which makes
+	air and solid rock almost free. Setting a type the palette has no room
+	for doubles the index width. When a chunk is compacted and its runs of
+	equal voxels, in x, y, z order, take less than half the packed size, it
+	is kept as runs instead, found by binary search on random access and
+	expanded back to a palette on the first write.
+
+	Bulk reads always decode a whole chunk into a dense array, which is
+	what the mesher iterates over. Packed chunks decode a byte at a time
+	through a lookup table of the indices each byte holds, and run chunks
+	with one memset per run.
+*/
+
+#define STORE_PALETTE 0
+#define STORE_RUNS 1
+
+typedef struct {
+	int mode;
+	int bits;
+	int count;
+	uint8_t palette[256];
+	uint8_t *packed;
+	uint16_t *run_end;
+	uint8_t *run_type;
+} voxel_store;
+
+static void store_free(voxel_store *s) {
+
+	free(s->packed);
+	free(s->run_end);
+	s->packed = NULL;
+	s->run_end = NULL;
+	s->run_type = NULL;
+
+}
+
+static void store_init(voxel_store *s, uint8_t type) {
+
+	store_free(s);
+	s->mode = STORE_PALETTE;
+	s->bits = 0;
+	s->count = 1;
+	s->palette[0] = type;
+
+}
+
+static size_t store_bytes(voxel_store *s) {
+
+	size_t bytes = sizeof(voxel_store);
+
+	if(s->mode == STORE_RUNS) {
+		return bytes + s->count * (sizeof(uint16_t) + sizeof(uint8_t));
+	}
+
+	return bytes + DASH_CHUNK_VOXELS / 8 * s->bits;
+
+}
+
+static uint8_t store_get(voxel_store *s, int i) {
+
+	int lo, hi, mid, bit;
+
+	if(s->mode == STORE_RUNS) {
+		lo = 0;
+		hi = s->count - 1;
+		while(lo < hi) {
+			mid = (lo + hi) / 2;
+			if(s->run_end[mid] > i) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		return s->run_type[lo];
+	}
+
+	if(s->bits == 0) {
+		return s->palette[0];
+	}
+
+	bit = i * s->bits;
+	return s->palette[(s->packed[bit >> 3] >> (bit & 7)) & ((1u << s->bits) - 1)];
+
+}
+
+static void store_decode(voxel_store *s, uint8_t *out) {
+
+	int i, k, start, per, bytes;
+	uint32_t mask;
+	uint8_t table[256][8];
+
+	if(s->mode == STORE_RUNS) {
+		start = 0;
+		for(i = 0; i < s->count; i++) {
+			memset(out + start, s->run_type[i], s->run_end[i] - start);
+			start = s->run_end[i];
+		}
+		return;
+	}
+
+	if(s->bits == 0) {
+		memset(out, s->palette[0], DASH_CHUNK_VOXELS);
+		return;
+	}
+
+	// Expand a packed byte at a time through a table of the voxels every
+	// byte value decodes to
+
+	per = 8 / s->bits;
+	mask = (1u << s->bits) - 1;
+	for(i = 0; i < 256; i++) {
+		for(k = 0; k < per; k++) {
+			table[i][k] = s->palette[(i >> (k * s->bits)) & mask];
+		}
+	}
+
+	bytes = DASH_CHUNK_VOXELS / per;
+	switch(per) {
+		case 8:
+			for(i = 0; i < bytes; i++, out += 8) {
+				memcpy(out, table[s->packed[i]], 8);
+			}
+			break;
+		case 4:
+			for(i = 0; i < bytes; i++, out += 4) {
+				memcpy(out, table[s->packed[i]], 4);
+			}
+			break;
+		case 2:
+			for(i = 0; i < bytes; i++, out += 2) {
+				memcpy(out, table[s->packed[i]], 2);
+			}
+			break;
+		default:
+			for(i = 0; i < bytes; i++) {
+				out[i] = table[s->packed[i]][0];
+			}
+			break;
+	}
+
+}
+
+static void store_encode(voxel_store *s, const uint8_t *in, int allow_runs) {
+
+	int i, bit, bits, count, runs;
+	size_t packed_bytes;
+	uint8_t palette[256];
+	int slot[256];
+
+	// Count palette entries and runs in one pass
+
+	memset(slot, -1, sizeof(slot));
+	count = 0;
+	runs = 1;
+	for(i = 0; i < DASH_CHUNK_VOXELS; i++) {
+		if(slot[in[i]] < 0) {
+			slot[in[i]] = count;
+			palette[count++] = in[i];
+		}
+		if(i > 0 && in[i] != in[i - 1]) {
+			runs++;
+		}
+	}
+
+	store_init(s, in[0]);
+	if(count == 1) {
+		return;
+	}
+
+	for(bits = 1; (1 << bits) < count; bits *= 2);
+	packed_bytes = DASH_CHUNK_VOXELS / 8 * bits;
+
+	if(allow_runs && runs * (sizeof(uint16_t) + sizeof(uint8_t)) * 2 < packed_bytes) {
+		s->mode = STORE_RUNS;
+		s->count = runs;
+		s->run_end = (uint16_t*)malloc(runs * (sizeof(uint16_t) + sizeof(uint8_t)));
+		s->run_type = (uint8_t*)(s->run_end + runs);
+		runs = 0;
+		for(i = 1; i <= DASH_CHUNK_VOXELS; i++) {
+			if(i == DASH_CHUNK_VOXELS || in[i] != in[i - 1]) {
+				s->run_end[runs] = i;
+				s->run_type[runs++] = in[i - 1];
+			}
+		}
+		return;
+	}
+
+	s->bits = bits;
+	s->count = count;
+	memcpy(s->palette, palette, count);
+	s->packed = (uint8_t*)calloc(packed_bytes, 1);
+	for(i = 0; i < DASH_CHUNK_VOXELS; i++) {
+		bit = i * bits;
+		s->packed[bit >> 3] |= slot[in[i]] << (bit & 7);
+	}
+
+}
+
+static void store_widen(voxel_store *s, int bits) {
+
+	int i, bit;
+	uint8_t *packed, index;
+
+	packed = (uint8_t*)calloc(DASH_CHUNK_VOXELS / 8 * bits, 1);
+
+	for(i = 0; s->bits > 0 && i < DASH_CHUNK_VOXELS; i++) {
+		bit = i * s->bits;
+		index = (s->packed[bit >> 3] >> (bit & 7)) & ((1u << s->bits) - 1);
+		bit = i * bits;
+		packed[bit >> 3] |= index << (bit & 7);
+	}
+
+	free(s->packed);
+	s->packed = packed;
+	s->bits = bits;
+
+}
+
+static void store_set(voxel_store *s, int i, uint8_t type) {
+
+	int index, bit;
+	uint8_t *dense;
+
+	if(store_get(s, i) == type) {
+		return;
+	}
+
+	if(s->mode == STORE_RUNS) {
+		dense = (uint8_t*)malloc(DASH_CHUNK_VOXELS);
+		store_decode(s, dense);
+		store_encode(s, dense, 0);
+		free(dense);
+	}
+
+	for(index = 0; index < s->count && s->palette[index] != type; index++);
+	if(index == s->count) {
+		if(s->count == 1 << s->bits) {
+			store_widen(s, s->bits ? s->bits * 2 : 1);
+		}
+		s->palette[s->count++] = type;
+	}
+
+	bit = i * s->bits;
+	s->packed[bit >> 3] &= ~(((1u << s->bits) - 1) << (bit & 7));
+	s->packed[bit >> 3] |= index << (bit & 7);
+
+}
+
+/******************************************************************************/
+/** Voxel Meshing                                                            **/
+/******************************************************************************/
+
+/*
+	A voxel world is a grid of DASH_CHUNK_SIZE cubed chunks of voxel types,
+	zero for air and otherwise a type whose layer in a texture array is
+	type - 1, so chunks draw with shader/vertex_array.glsl. Each
+	chunk owns the faces of its own voxels, so a face on a chunk border is
+	emitted exactly once and a neighbour is only read, never written.
+
+	Meshing follows Lysenko's greedy mesher: every slice between two layers
+	of voxels along each axis gets a mask of visible faces, signed by the
+	direction they face, and runs of equal mask values are grown into the
+	largest rectangles that fit. Texture coordinates span the rectangle in
+	voxels so a repeating texture tiles once per voxel. Dirty chunks are
+	shared among worker threads, then uploaded on the GL thread. Quads all
+	use the same six indices, so one 16 bit index buffer serves every
+	chunk, drawn in runs of DASH_VOXEL_QUAD_RUN quads. Once every dirty
+	chunk is meshed the workers compact their storage, which cannot overlap
+	meshing since meshing reads the borders of neighbouring chunks.
+*/
+
+#define VOXEL_STRIDE 6
+#define PAD (DASH_CHUNK_SIZE + 2)
+
+typedef struct {
+	float *vertices;
+	int count;
+	int capacity;
+} voxel_quads;
+
+typedef struct {
+	voxel_store store;
+	int dirty;
+	GLuint vbo;
+	int quad_count;
+	voxel_quads quads;
+} voxel_chunk;
+
+struct dash_voxel_world {
+	int size[3];
+	int chunks[3];
+	voxel_chunk *chunk;
+	GLuint quad_ibo;
+	dash_voxel_stats stats;
+	int *queue;
+	int queue_count;
+	int queue_next;
+	int compact;
+	pthread_mutex_t lock;
+};
+
+static double voxel_now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+static int voxel_threads() {
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : (int)n);
+
+}
+
+dash_voxel_world *dash_voxel_create(int chunks_x, int chunks_y, int chunks_z) {
+
+	int i, count;
+	dash_voxel_world *w;
+
+	w = (dash_voxel_world*)calloc(1, sizeof(dash_voxel_world));
+	w->chunks[0] = chunks_x;
+	w->chunks[1] = chunks_y;
+	w->chunks[2] = chunks_z;
+	for(i = 0; i < 3; i++) {
+		w->size[i] = w->chunks[i] * DASH_CHUNK_SIZE;
+	}
+
+	count = chunks_x * chunks_y * chunks_z;
+	w->chunk = (voxel_chunk*)calloc(count, sizeof(voxel_chunk));
+	w->queue = (int*)malloc(sizeof(int) * count);
+	for(i = 0; i < count; i++) {
+		store_init(&w->chunk[i].store, 0);
+	}
+	pthread_mutex_init(&w->lock, NULL);
+
+	return w;
+
+}
+
+static int chunk_index(dash_voxel_world *w, int cx, int cy, int cz) {
+
+	return (cz * w->chunks[1] + cy) * w->chunks[0] + cx;
+
+}
+
+uint8_t dash_voxel_get(dash_voxel_world *w, int x, int y, int z) {
+
+	voxel_chunk *c;
+
+	if(x < 0 || y < 0 || z < 0 || x >= w->size[0] || y >= w->size[1] || z >= w->size[2]) {
+		return 0;
+	}
+
+	c = &w->chunk[chunk_index(w, x / DASH_CHUNK_SIZE, y / DASH_CHUNK_SIZE, z / DASH_CHUNK_SIZE)];
+	x %= DASH_CHUNK_SIZE;
+	y %= DASH_CHUNK_SIZE;
+	z %= DASH_CHUNK_SIZE;
+
+	return store_get(&c->store, (z * DASH_CHUNK_SIZE + y) * DASH_CHUNK_SIZE + x);
+
+}
+
+static void mark_dirty(dash_voxel_world *w, int x, int y, int z) {
+
+	if(x < 0 || y < 0 || z < 0 || x >= w->size[0] || y >= w->size[1] || z >= w->size[2]) {
+		return;
+	}
+	w->chunk[chunk_index(w, x / DASH_CHUNK_SIZE, y / DASH_CHUNK_SIZE, z / DASH_CHUNK_SIZE)].dirty = 1;
+
+}
+
+void dash_voxel_set(dash_voxel_world *w, int x, int y, int z, uint8_t type) {
+
+	int i, p[3];
+	voxel_chunk *c;
+
+	if(x < 0 || y < 0 || z < 0 || x >= w->size[0] || y >= w->size[1] || z >= w->size[2]) {
+		return;
+	}
+
+	c = &w->chunk[chunk_index(w, x / DASH_CHUNK_SIZE, y / DASH_CHUNK_SIZE, z / DASH_CHUNK_SIZE)];
+	store_set(&c->store, ((z % DASH_CHUNK_SIZE) * DASH_CHUNK_SIZE + y % DASH_CHUNK_SIZE) * DASH_CHUNK_SIZE + x % DASH_CHUNK_SIZE, type);
+	c->dirty = 1;
+
+	// A voxel on a chunk border changes which faces the neighbour shows
+
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+	for(i = 0; i < 3; i++) {
+		if(p[i] % DASH_CHUNK_SIZE == 0) {
+			p[i]--;
+			mark_dirty(w, p[0], p[1], p[2]);
+			p[i]++;
+		} else if(p[i] % DASH_CHUNK_SIZE == DASH_CHUNK_SIZE - 1) {
+			p[i]++;
+			mark_dirty(w, p[0], p[1], p[2]);
+			p[i]--;
+		}
+	}
+
+}
+
+void dash_voxel_read_chunk(dash_voxel_world *w, int cx, int cy, int cz, uint8_t *voxels) {
+
+	store_decode(&w->chunk[chunk_index(w, cx, cy, cz)].store, voxels);
+
+}
+
+void dash_voxel_write_chunk(dash_voxel_world *w, int cx, int cy, int cz, const uint8_t *voxels) {
+
+	int i, x, y, z;
+
+	store_encode(&w->chunk[chunk_index(w, cx, cy, cz)].store, voxels, 1);
+
+	// Dirty the chunk and all six neighbours, which see its border voxels
+
+	x = cx * DASH_CHUNK_SIZE;
+	y = cy * DASH_CHUNK_SIZE;
+	z = cz * DASH_CHUNK_SIZE;
+	mark_dirty(w, x, y, z);
+	for(i = -1; i <= 1; i += 2) {
+		mark_dirty(w, x + i * DASH_CHUNK_SIZE, y, z);
+		mark_dirty(w, x, y + i * DASH_CHUNK_SIZE, z);
+		mark_dirty(w, x, y, z + i * DASH_CHUNK_SIZE);
+	}
+
+}
+
+static void emit_quad(voxel_quads *out, int d, int *p, int du, int dv, int type, int back) {
+
+	int k, u, v;
+	float *q, corner[4][3], uv[4][2];
+
+	if(out->count == out->capacity) {
+		out->capacity = out->capacity ? out->capacity * 2 : 256;
+		out->vertices = (float*)realloc(out->vertices, sizeof(float) * VOXEL_STRIDE * 4 * out->capacity);
+	}
+
+	u = (d + 1) % 3;
+	v = (d + 2) % 3;
+
+	for(k = 0; k < 4; k++) {
+		corner[k][0] = p[0];
+		corner[k][1] = p[1];
+		corner[k][2] = p[2];
+	}
+	corner[1][u] += du;
+	corner[2][u] += du;
+	corner[2][v] += dv;
+	corner[3][v] += dv;
+
+	uv[0][0] = 0.0f;
+	uv[0][1] = 0.0f;
+	uv[1][0] = du;
+	uv[1][1] = 0.0f;
+	uv[2][0] = du;
+	uv[2][1] = dv;
+	uv[3][0] = 0.0f;
+	uv[3][1] = dv;
+
+	// Corners run counter clockwise around +d, a face looking down -d
+	// walks them backwards
+
+	q = out->vertices + out->count * 4 * VOXEL_STRIDE;
+	for(k = 0; k < 4; k++) {
+		int src = back ? (4 - k) % 4 : k;
+		q[0] = corner[src][0];
+		q[1] = corner[src][1];
+		q[2] = corner[src][2];
+		q[3] = uv[src][0];
+		q[4] = uv[src][1];
+		q[5] = (float)(type - 1);
+		q += VOXEL_STRIDE;
+	}
+
+	out->count++;
+
+}
+
+static void pad_chunk(dash_voxel_world *w, int *origin, uint8_t *dense, uint8_t *pad) {
+
+	int x, y, z;
+	uint8_t *row;
+	voxel_chunk *c;
+
+	// Copy the chunk with a one voxel border borrowed from its neighbours,
+	// so the mask loops below never need bounds checks
+
+	c = &w->chunk[chunk_index(w, origin[0] / DASH_CHUNK_SIZE,
+		origin[1] / DASH_CHUNK_SIZE, origin[2] / DASH_CHUNK_SIZE)];
+	store_decode(&c->store, dense);
+
+	for(z = 0; z < PAD; z++) {
+		for(y = 0; y < PAD; y++) {
+			row = pad + (z * PAD + y) * PAD;
+			if(z == 0 || y == 0 || z == PAD - 1 || y == PAD - 1) {
+				for(x = 0; x < PAD; x++) {
+					row[x] = dash_voxel_get(w, origin[0] + x - 1, origin[1] + y - 1, origin[2] + z - 1);
+				}
+				continue;
+			}
+			row[0] = dash_voxel_get(w, origin[0] - 1, origin[1] + y - 1, origin[2] + z - 1);
+			memcpy(row + 1, dense + ((z - 1) * DASH_CHUNK_SIZE + y - 1) * DASH_CHUNK_SIZE, DASH_CHUNK_SIZE);
+			row[PAD - 1] = dash_voxel_get(w, origin[0] + DASH_CHUNK_SIZE, origin[1] + y - 1, origin[2] + z - 1);
+		}
+	}
+
+}
+
+static void mesh_padded(const uint8_t *pad, const int *origin, int *mask, voxel_quads *out) {
+
+	int d, u, v, i, j, k, l, width, height, value, a, b, step;
+	int x[3], p[3], stride[3];
+	const uint8_t *cell;
+
+	out->count = 0;
+	stride[0] = 1;
+	stride[1] = PAD;
+	stride[2] = PAD * PAD;
+
+	for(d = 0; d < 3; d++) {
+
+		u = (d + 1) % 3;
+		v = (d + 2) % 3;
+		step = stride[d];
+
+		// Slice x[d] sits between layers x[d] and x[d] + 1. Only faces of
+		// voxels inside this chunk are kept: +d faces need layer x[d]
+		// inside, -d faces need layer x[d] + 1 inside
+
+		for(x[d] = -1; x[d] < DASH_CHUNK_SIZE; x[d]++) {
+
+			for(x[v] = 0; x[v] < DASH_CHUNK_SIZE; x[v]++) {
+				for(x[u] = 0; x[u] < DASH_CHUNK_SIZE; x[u]++) {
+					cell = pad + (x[2] + 1) * stride[2] + (x[1] + 1) * stride[1] + x[0] + 1;
+					a = cell[0];
+					b = cell[step];
+					value = 0;
+					if(a != 0 && b == 0 && x[d] >= 0) {
+						value = a;
+					} else if(b != 0 && a == 0 && x[d] < DASH_CHUNK_SIZE - 1) {
+						value = -b;
+					}
+					mask[x[v] * DASH_CHUNK_SIZE + x[u]] = value;
+				}
+			}
+
+			for(j = 0; j < DASH_CHUNK_SIZE; j++) {
+				for(i = 0; i < DASH_CHUNK_SIZE; ) {
+
+					value = mask[j * DASH_CHUNK_SIZE + i];
+					if(value == 0) {
+						i++;
+						continue;
+					}
+
+					for(width = 1; i + width < DASH_CHUNK_SIZE &&
+						mask[j * DASH_CHUNK_SIZE + i + width] == value; width++);
+
+					for(height = 1; j + height < DASH_CHUNK_SIZE; height++) {
+						for(k = 0; k < width; k++) {
+							if(mask[(j + height) * DASH_CHUNK_SIZE + i + k] != value) {
+								break;
+							}
+						}
+						if(k < width) {
+							break;
+						}
+					}
+
+					p[d] = origin[d] + x[d] + 1;
+					p[u] = origin[u] + i;
+					p[v] = origin[v] + j;
+					emit_quad(out, d, p, width, height, value > 0 ? value : -value, value < 0);
+
+					for(l = 0; l < height; l++) {
+						for(k = 0; k < width; k++) {
+							mask[(j + l) * DASH_CHUNK_SIZE + i + k] = 0;
+						}
+					}
+					i += width;
+
+				}
+			}
+
+		}
+
+	}
+
+}
+
+static void mesh_chunk(dash_voxel_world *w, int index, int *mask, uint8_t *dense, uint8_t *pad) {
+
+	int origin[3];
+
+	origin[0] = index % w->chunks[0] * DASH_CHUNK_SIZE;
+	origin[1] = index / w->chunks[0] % w->chunks[1] * DASH_CHUNK_SIZE;
+	origin[2] = index / (w->chunks[0] * w->chunks[1]) * DASH_CHUNK_SIZE;
+
+	pad_chunk(w, origin, dense, pad);
+	mesh_padded(pad, origin, mask, &w->chunk[index].quads);
+
+}
+
+static void *voxel_worker(void *arg) {
+
+	int index, *mask;
+	uint8_t *dense, *pad;
+	voxel_store *store;
+	dash_voxel_world *w;
+
+	w = (dash_voxel_world*)arg;
+	mask = (int*)malloc(sizeof(int) * DASH_CHUNK_SIZE * DASH_CHUNK_SIZE);
+	dense = (uint8_t*)malloc(DASH_CHUNK_VOXELS);
+	pad = (uint8_t*)malloc(PAD * PAD * PAD);
+
+	for(;;) {
+		pthread_mutex_lock(&w->lock);
+		index = w->queue_next < w->queue_count ? w->queue[w->queue_next++] : -1;
+		pthread_mutex_unlock(&w->lock);
+		if(index < 0) {
+			break;
+		}
+		if(!w->compact) {
+			mesh_chunk(w, index, mask, dense, pad);
+			continue;
+		}
+		store = &w->chunk[index].store;
+		store_decode(store, dense);
+		store_encode(store, dense, 1);
+	}
+
+	free(pad);
+	free(dense);
+	free(mask);
+	return NULL;
+
+}
+
+static GLuint build_quad_ibo() {
+
+	int i;
+	GLuint ibo;
+	uint16_t *indices;
+
+	indices = (uint16_t*)malloc(sizeof(uint16_t) * 6 * DASH_VOXEL_QUAD_RUN);
+	for(i = 0; i < DASH_VOXEL_QUAD_RUN; i++) {
+		indices[i * 6 + 0] = i * 4 + 0;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4 + 2;
+		indices[i * 6 + 4] = i * 4 + 3;
+		indices[i * 6 + 5] = i * 4 + 0;
+	}
+
+	dash_mesh_unbind();
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * 6 * DASH_VOXEL_QUAD_RUN, indices, GL_STATIC_DRAW);
+	free(indices);
+
+	return ibo;
+
+}
+
+int dash_voxel_mesh(dash_voxel_world *w) {
+
+	int i, t, threads, count;
+	double start;
+	pthread_t tids[MAX_THREADS];
+	voxel_chunk *c;
+
+	start = voxel_now();
+	count = w->chunks[0] * w->chunks[1] * w->chunks[2];
+
+	w->queue_count = 0;
+	w->queue_next = 0;
+	for(i = 0; i < count; i++) {
+		if(w->chunk[i].dirty) {
+			w->queue[w->queue_count++] = i;
+		}
+	}
+	if(w->queue_count == 0) {
+		return 0;
+	}
+
+	threads = voxel_threads();
+	if(threads > w->queue_count) {
+		threads = w->queue_count;
+	}
+	for(w->compact = 0; w->compact < 2; w->compact++) {
+		w->queue_next = 0;
+		for(t = 1; t < threads; t++) {
+			pthread_create(&tids[t], NULL, voxel_worker, w);
+		}
+		voxel_worker(w);
+		for(t = 1; t < threads; t++) {
+			pthread_join(tids[t], NULL);
+		}
+	}
+
+	if(w->quad_ibo == 0) {
+		w->quad_ibo = build_quad_ibo();
+	}
+
+	// Uploads stay on the calling thread, which owns the GL context
+
+	for(i = 0; i < w->queue_count; i++) {
+
+		c = &w->chunk[w->queue[i]];
+		w->stats.quads += c->quads.count - c->quad_count;
+
+		if(c->vbo == 0 && c->quads.count > 0) {
+			glGenBuffers(1, &c->vbo);
+		}
+		if(c->vbo != 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, c->vbo);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * VOXEL_STRIDE * 4 * c->quads.count,
+				c->quads.vertices, GL_STATIC_DRAW);
+		}
+
+		c->quad_count = c->quads.count;
+		c->dirty = 0;
+		free(c->quads.vertices);
+		memset(&c->quads, 0, sizeof(voxel_quads));
+
+	}
+
+	w->stats.chunks_meshed += w->queue_count;
+	w->stats.mesh_ms = (voxel_now() - start) * 1000.0;
+	return w->queue_count;
+
+}
+
+static void voxel_attribs(GLint *locations, GLint layer_location, int enable) {
+
+	int i;
+	GLint attribs[3];
+
+	attribs[0] = locations[DASH_POSITION];
+	attribs[1] = locations[DASH_TEXCOORD];
+	attribs[2] = layer_location;
+
+	for(i = 0; i < 3; i++) {
+		if(attribs[i] < 0) {
+			continue;
+		}
+		if(enable) {
+			glEnableVertexAttribArray(attribs[i]);
+		} else {
+			glDisableVertexAttribArray(attribs[i]);
+		}
+	}
+
+}
+
+static void voxel_draw_quads(GLuint vbo, int quad_count, GLint *locations, GLint layer_location) {
+
+	int run, n;
+	size_t base;
+	GLsizei stride;
+
+	stride = sizeof(float) * VOXEL_STRIDE;
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	for(run = 0; run < quad_count; run += DASH_VOXEL_QUAD_RUN) {
+
+		n = quad_count - run < DASH_VOXEL_QUAD_RUN ? quad_count - run : DASH_VOXEL_QUAD_RUN;
+		base = (size_t)run * 4 * stride;
+
+		glVertexAttribPointer(locations[DASH_POSITION], 3, GL_FLOAT, GL_FALSE, stride, (void*)base);
+		if(locations[DASH_TEXCOORD] >= 0) {
+			glVertexAttribPointer(locations[DASH_TEXCOORD], 2, GL_FLOAT, GL_FALSE, stride,
+				(void*)(base + sizeof(float) * 3));
+		}
+		if(layer_location >= 0) {
+			glVertexAttribPointer(layer_location, 1, GL_FLOAT, GL_FALSE, stride,
+				(void*)(base + sizeof(float) * 5));
+		}
+		glDrawElements(GL_TRIANGLES, n * 6, GL_UNSIGNED_SHORT, 0);
+
+	}
+
+}
+
+int dash_voxel_draw(dash_voxel_world *w, mat4 view_projection, GLint *locations, GLint layer_location) {
+
+	int i, count, drawn;
+	float planes[24];
+	vec3 min, max;
+	voxel_chunk *c;
+
+	if(w->quad_ibo == 0) {
+		return 0;
+	}
+
+	mat4_frustum_planes(view_projection, planes);
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, w->quad_ibo);
+	voxel_attribs(locations, layer_location, 1);
+
+	count = w->chunks[0] * w->chunks[1] * w->chunks[2];
+	drawn = 0;
+
+	for(i = 0; i < count; i++) {
+
+		c = &w->chunk[i];
+		if(c->quad_count == 0) {
+			continue;
+		}
+
+		min[0] = i % w->chunks[0] * DASH_CHUNK_SIZE;
+		min[1] = i / w->chunks[0] % w->chunks[1] * DASH_CHUNK_SIZE;
+		min[2] = i / (w->chunks[0] * w->chunks[1]) * DASH_CHUNK_SIZE;
+		max[0] = min[0] + DASH_CHUNK_SIZE;
+		max[1] = min[1] + DASH_CHUNK_SIZE;
+		max[2] = min[2] + DASH_CHUNK_SIZE;
+		if(!mat4_frustum_box(planes, min, max)) {
+			continue;
+		}
+
+		voxel_draw_quads(c->vbo, c->quad_count, locations, layer_location);
+		drawn++;
+
+	}
+
+	voxel_attribs(locations, layer_location, 0);
+	return drawn;
+
+}
+
+void dash_voxel_get_stats(dash_voxel_world *w, dash_voxel_stats *stats) {
+
+	int i, count;
+	voxel_store *s;
+
+	w->stats.storage_bytes = sizeof(dash_voxel_world);
+	w->stats.uniform_chunks = 0;
+	w->stats.run_chunks = 0;
+
+	count = w->chunks[0] * w->chunks[1] * w->chunks[2];
+	for(i = 0; i < count; i++) {
+		s = &w->chunk[i].store;
+		w->stats.storage_bytes += store_bytes(s) + sizeof(voxel_chunk) - sizeof(voxel_store);
+		if(s->mode == STORE_RUNS) {
+			w->stats.run_chunks++;
+		} else if(s->bits == 0) {
+			w->stats.uniform_chunks++;
+		}
+	}
+
+	*stats = w->stats;
+
+}
+
+void dash_voxel_destroy(dash_voxel_world *w) {
+
+	int i, count;
+
+	count = w->chunks[0] * w->chunks[1] * w->chunks[2];
+	for(i = 0; i < count; i++) {
+		if(w->chunk[i].vbo != 0) {
+			glDeleteBuffers(1, &w->chunk[i].vbo);
+		}
+		free(w->chunk[i].quads.vertices);
+		store_free(&w->chunk[i].store);
+	}
+	if(w->quad_ibo != 0) {
+		glDeleteBuffers(1, &w->quad_ibo);
+	}
+
+	pthread_mutex_destroy(&w->lock);
+	free(w->queue);
+	free(w->chunk);
+	free(w);
+
+}
+
+/******************************************************************************/
+/** Region Files                                                             **/
+/******************************************************************************/
+
+/*
+	Chunks are saved in region files of DASH_REGION_SIZE cubed chunks, named
+	r.x.y.z.dvr after the region coordinates. A file starts with a magic
+	and an index of the offset and size of every chunk's blob, both zero
+	for chunks never written, which read back as air. A blob is the
+	chunk's runs of equal voxels in x, y, z order, three bytes each: the 16
+	bit little endian end of the run and its type. Rewriting a chunk
+	appends a new blob and repoints the index, leaving the old blob as
+	dead space.
+*/
+
+#define REGION_MAGIC "DVR1"
+#define REGION_CHUNKS (DASH_REGION_SIZE * DASH_REGION_SIZE * DASH_REGION_SIZE)
+#define REGION_HEADER (4 + REGION_CHUNKS * 8)
+#define BLOB_MAX (DASH_CHUNK_VOXELS * 3)
+
+static int floor_div(int a, int b) {
+
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+
+}
+
+static void region_locate(const char *dir, int cx, int cy, int cz, char *path, size_t len, int *slot) {
+
+	int r[3], c[3], i;
+
+	c[0] = cx;
+	c[1] = cy;
+	c[2] = cz;
+	for(i = 0; i < 3; i++) {
+		r[i] = floor_div(c[i], DASH_REGION_SIZE);
+		c[i] -= r[i] * DASH_REGION_SIZE;
+	}
+
+	if(path != NULL) {
+		snprintf(path, len, "%s/r.%d.%d.%d.dvr", dir, r[0], r[1], r[2]);
+	}
+	*slot = (c[2] * DASH_REGION_SIZE + c[1]) * DASH_REGION_SIZE + c[0];
+
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+}
+
+static int region_load(int fd, int slot, uint8_t *blob, uint8_t *voxels) {
+
+	int i, start, end;
+	uint8_t entry[8];
+	uint32_t offset, size;
+
+	memset(voxels, 0, DASH_CHUNK_VOXELS);
+	if(fd < 0) {
+		return 1;
+	}
+
+	if(pread(fd, entry, 8, 4 + slot * 8) != 8) {
+		return 0;
+	}
+	offset = get_u32(entry);
+	size = get_u32(entry + 4);
+	if(size == 0) {
+		return 1;
+	}
+	if(size % 3 != 0 || size > BLOB_MAX || pread(fd, blob, size, offset) != (ssize_t)size) {
+		return 0;
+	}
+
+	// Runs must cover the chunk exactly, anything else is corrupt
+
+	start = 0;
+	for(i = 0; i < (int)size; i += 3) {
+		end = blob[i] | (blob[i + 1] << 8);
+		if(end <= start || end > DASH_CHUNK_VOXELS) {
+			return 0;
+		}
+		memset(voxels + start, blob[i + 2], end - start);
+		start = end;
+	}
+
+	return start == DASH_CHUNK_VOXELS;
+
+}
+
+static int region_open(const char *path) {
+
+	int fd;
+	char magic[4];
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+
+	if(read(fd, magic, 4) != 4 || memcmp(magic, REGION_MAGIC, 4) != 0) {
+		fprintf(stderr, "%s is not a region file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+
+}
+
+int dash_region_write_chunk(const char *dir, int cx, int cy, int cz, const uint8_t *voxels) {
+
+	int i, fd, slot, size;
+	char path[1024];
+	uint8_t *blob, entry[8];
+	off_t offset;
+
+	region_locate(dir, cx, cy, cz, path, sizeof(path), &slot);
+	mkdir(dir, 0755);
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return 0;
+	}
+
+	offset = lseek(fd, 0, SEEK_END);
+	if(offset == 0) {
+		blob = (uint8_t*)calloc(REGION_HEADER, 1);
+		memcpy(blob, REGION_MAGIC, 4);
+		if(write(fd, blob, REGION_HEADER) != REGION_HEADER) {
+			free(blob);
+			close(fd);
+			return 0;
+		}
+		free(blob);
+		offset = REGION_HEADER;
+	}
+
+	// An all air chunk keeps a zero index entry and no blob
+
+	size = 0;
+	blob = (uint8_t*)malloc(BLOB_MAX);
+	for(i = 1; i <= DASH_CHUNK_VOXELS; i++) {
+		if(i == DASH_CHUNK_VOXELS || voxels[i] != voxels[i - 1]) {
+			blob[size++] = i & 0xff;
+			blob[size++] = (i >> 8) & 0xff;
+			blob[size++] = voxels[i - 1];
+		}
+	}
+	if(size == 3 && voxels[0] == 0) {
+		size = 0;
+	}
+
+	put_u32(entry, size ? (uint32_t)offset : 0);
+	put_u32(entry + 4, size);
+	if((size && pwrite(fd, blob, size, offset) != size) || pwrite(fd, entry, 8, 4 + slot * 8) != 8) {
+		fprintf(stderr, "Could not write chunk %d %d %d to %s\n", cx, cy, cz, path);
+		size = -1;
+	}
+
+	free(blob);
+	close(fd);
+	return size >= 0;
+
+}
+
+int dash_region_read_chunk(const char *dir, int cx, int cy, int cz, uint8_t *voxels) {
+
+	int fd, slot, ok;
+	char path[1024];
+	uint8_t *blob;
+
+	region_locate(dir, cx, cy, cz, path, sizeof(path), &slot);
+	fd = region_open(path);
+	blob = (uint8_t*)malloc(BLOB_MAX);
+	ok = region_load(fd, slot, blob, voxels);
+	free(blob);
+	if(fd >= 0) {
+		close(fd);
+	}
+
+	return ok;
+
+}
+
+/******************************************************************************/
+/** Voxel Streaming                                                          **/
+/******************************************************************************/
+
+/*
+	A stream keeps the chunks within a radius of the camera resident out of
+	region files too large to load whole. Each update queues the missing
+	chunks nearest first for persistent worker threads, which read the chunk
+	and its six neighbours with pread, decode them and mesh the chunk, so
+	meshing never waits on a neighbour being resident. Finished meshes are
+	uploaded on the GL thread, at most DASH_STREAM_UPLOADS per update so
+	frame time stays flat while flying, into whichever of the slot's two
+	vertex buffers was not drawn last, so a recycled slot never respecifies
+	a buffer the GPU may still be reading. While resident chunks, counting
+	their compact voxels and both vertex buffers, are over the memory budget
+	the least recently drawn chunk outside the radius is evicted.
+*/
+
+#define SLOT_FREE 0
+#define SLOT_QUEUED 1
+#define SLOT_LOADING 2
+#define SLOT_READY 3
+#define SLOT_RESIDENT 4
+#define REGION_HANDLES 16
+
+typedef struct {
+	int c[3];
+	int state;
+	int next;
+	voxel_store store;
+	voxel_quads quads;
+	GLuint vbo[2];
+	size_t vbo_bytes[2];
+	int front;
+	int quad_count;
+	long last_used;
+	size_t bytes;
+} stream_slot;
+
+typedef struct {
+	int r[3];
+	int fd;
+	int users;
+	long used;
+} region_handle;
+
+struct dash_voxel_stream {
+	char *dir;
+	int chunks_y;
+	int radius;
+	size_t budget;
+	int center[3];
+	long frame;
+	GLuint quad_ibo;
+	int *offsets;
+	int offset_count;
+	stream_slot *slots;
+	int slot_count;
+	int *buckets;
+	int bucket_mask;
+	int *free_slots;
+	int free_count;
+	int *queue;
+	int queue_head;
+	int queue_count;
+	int starved;
+	int *done;
+	int done_count;
+	region_handle regions[REGION_HANDLES];
+	long region_clock;
+	pthread_mutex_t region_lock;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t threads[MAX_THREADS];
+	int thread_count;
+	int quit;
+	dash_voxel_stream_stats stats;
+};
+
+static int compare_offsets(const void *a, const void *b) {
+
+	return ((const int*)a)[0] - ((const int*)b)[0];
+
+}
+
+static int slot_hash(dash_voxel_stream *s, const int *c) {
+
+	return ((unsigned)c[0] * 73856093u ^ (unsigned)c[1] * 19349663u ^ (unsigned)c[2] * 83492791u) & s->bucket_mask;
+
+}
+
+static int slot_find(dash_voxel_stream *s, const int *c) {
+
+	int i;
+
+	for(i = s->buckets[slot_hash(s, c)]; i >= 0; i = s->slots[i].next) {
+		if(s->slots[i].c[0] == c[0] && s->slots[i].c[1] == c[1] && s->slots[i].c[2] == c[2]) {
+			return i;
+		}
+	}
+
+	return -1;
+
+}
+
+static int slot_wanted(dash_voxel_stream *s, const int *c) {
+
+	int i;
+
+	if(c[1] < 0 || c[1] >= s->chunks_y) {
+		return 0;
+	}
+	for(i = 0; i < 3; i++) {
+		if(abs(c[i] - s->center[i]) > s->radius) {
+			return 0;
+		}
+	}
+
+	return 1;
+
+}
+
+static void slot_release(dash_voxel_stream *s, int index) {
+
+	int *link, i;
+	stream_slot *slot;
+
+	slot = &s->slots[index];
+	for(link = &s->buckets[slot_hash(s, slot->c)]; *link != index; link = &s->slots[*link].next);
+	*link = slot->next;
+
+	// Orphan both buffers so their memory goes back to the driver, the
+	// names are kept for the next chunk in this slot
+
+	for(i = 0; i < 2; i++) {
+		if(slot->vbo[i] != 0 && slot->vbo_bytes[i] != 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, slot->vbo[i]);
+			glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+		}
+		slot->vbo_bytes[i] = 0;
+	}
+
+	store_free(&slot->store);
+	free(slot->quads.vertices);
+	memset(&slot->quads, 0, sizeof(voxel_quads));
+	s->stats.bytes -= slot->bytes;
+	s->stats.quads -= slot->quad_count;
+	slot->bytes = 0;
+	slot->quad_count = 0;
+	slot->state = SLOT_FREE;
+	s->free_slots[s->free_count++] = index;
+
+}
+
+static int slot_evict(dash_voxel_stream *s) {
+
+	int i, oldest;
+	stream_slot *slot;
+
+	oldest = -1;
+	for(i = 0; i < s->slot_count; i++) {
+		slot = &s->slots[i];
+		if(slot->state != SLOT_RESIDENT || slot_wanted(s, slot->c)) {
+			continue;
+		}
+		if(oldest < 0 || slot->last_used < s->slots[oldest].last_used) {
+			oldest = i;
+		}
+	}
+
+	if(oldest >= 0) {
+		slot_release(s, oldest);
+		s->stats.evicted++;
+	}
+
+	return oldest;
+
+}
+
+static int region_acquire(dash_voxel_stream *s, const int *c, int *slot, int *handle) {
+
+	int i, r[3], fd, victim;
+	char path[1024];
+	region_handle *h;
+
+	region_locate(s->dir, c[0], c[1], c[2], path, sizeof(path), slot);
+	for(i = 0; i < 3; i++) {
+		r[i] = floor_div(c[i], DASH_REGION_SIZE);
+	}
+
+	pthread_mutex_lock(&s->region_lock);
+
+	victim = -1;
+	for(i = 0; i < REGION_HANDLES; i++) {
+		h = &s->regions[i];
+		if(h->used && h->r[0] == r[0] && h->r[1] == r[1] && h->r[2] == r[2]) {
+			h->users++;
+			h->used = ++s->region_clock;
+			*handle = i;
+			pthread_mutex_unlock(&s->region_lock);
+			return h->fd;
+		}
+		if(h->users == 0 && (victim < 0 || h->used < s->regions[victim].used)) {
+			victim = i;
+		}
+	}
+
+	// A missing file is cached as fd -1 so air regions are not reopened,
+	// and when every handle is busy the file is opened just for this read
+
+	fd = region_open(path);
+	*handle = victim;
+	if(victim >= 0) {
+		h = &s->regions[victim];
+		if(h->used && h->fd >= 0) {
+			close(h->fd);
+		}
+		memcpy(h->r, r, sizeof(r));
+		h->fd = fd;
+		h->users = 1;
+		h->used = ++s->region_clock;
+	}
+
+	pthread_mutex_unlock(&s->region_lock);
+	return fd;
+
+}
+
+static void region_release(dash_voxel_stream *s, int fd, int handle) {
+
+	if(handle < 0) {
+		if(fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&s->region_lock);
+	s->regions[handle].users--;
+	pthread_mutex_unlock(&s->region_lock);
+
+}
+
+static void stream_read(dash_voxel_stream *s, const int *c, uint8_t *blob, uint8_t *voxels) {
+
+	int fd, slot, handle;
+
+	if(c[1] < 0 || c[1] >= s->chunks_y) {
+		memset(voxels, 0, DASH_CHUNK_VOXELS);
+		return;
+	}
+
+	fd = region_acquire(s, c, &slot, &handle);
+	if(!region_load(fd, slot, blob, voxels)) {
+		fprintf(stderr, "Chunk %d %d %d is corrupt, loading it as air\n", c[0], c[1], c[2]);
+		memset(voxels, 0, DASH_CHUNK_VOXELS);
+	}
+	region_release(s, fd, handle);
+
+}
+
+static void stream_pad(uint8_t **chunks, uint8_t *pad) {
+
+	int a, b;
+	const int n = DASH_CHUNK_SIZE;
+
+	// Only the six faces of the border are read by the mesher, the edges
+	// and corners stay empty
+
+	memset(pad, 0, PAD * PAD * PAD);
+	for(a = 0; a < n; a++) {
+		for(b = 0; b < n; b++) {
+			memcpy(pad + ((a + 1) * PAD + b + 1) * PAD + 1, chunks[0] + (a * n + b) * n, n);
+			pad[((a + 1) * PAD + b + 1) * PAD] = chunks[1][(a * n + b) * n + n - 1];
+			pad[((a + 1) * PAD + b + 1) * PAD + PAD - 1] = chunks[2][(a * n + b) * n];
+			pad[((a + 1) * PAD) * PAD + b + 1] = chunks[3][(a * n + n - 1) * n + b];
+			pad[((a + 1) * PAD + PAD - 1) * PAD + b + 1] = chunks[4][(a * n) * n + b];
+			pad[(a + 1) * PAD + b + 1] = chunks[5][((n - 1) * n + a) * n + b];
+			pad[((PAD - 1) * PAD + a + 1) * PAD + b + 1] = chunks[6][a * n + b];
+		}
+	}
+
+}
+
+static void *stream_worker(void *arg) {
+
+	int i, index, c[3], n[3], origin[3], *mask;
+	uint8_t *blob, *pad, *chunks[7];
+	stream_slot *slot;
+	dash_voxel_stream *s;
+
+	s = (dash_voxel_stream*)arg;
+	mask = (int*)malloc(sizeof(int) * DASH_CHUNK_SIZE * DASH_CHUNK_SIZE);
+	blob = (uint8_t*)malloc(BLOB_MAX);
+	pad = (uint8_t*)malloc(PAD * PAD * PAD);
+	for(i = 0; i < 7; i++) {
+		chunks[i] = (uint8_t*)malloc(DASH_CHUNK_VOXELS);
+	}
+
+	for(;;) {
+
+		pthread_mutex_lock(&s->lock);
+		while(!s->quit && s->queue_head == s->queue_count) {
+			pthread_cond_wait(&s->wake, &s->lock);
+		}
+		if(s->quit) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		index = s->queue[s->queue_head++];
+		slot = &s->slots[index];
+		if(slot->state != SLOT_QUEUED) {
+			pthread_mutex_unlock(&s->lock);
+			continue;
+		}
+		slot->state = SLOT_LOADING;
+		memcpy(c, slot->c, sizeof(c));
+		pthread_mutex_unlock(&s->lock);
+
+		// The chunk itself, then its -x, +x, -y, +y, -z, +z neighbours
+
+		stream_read(s, c, blob, chunks[0]);
+		for(i = 0; i < 6; i++) {
+			memcpy(n, c, sizeof(n));
+			n[i / 2] += i % 2 ? 1 : -1;
+			stream_read(s, n, blob, chunks[i + 1]);
+		}
+
+		for(i = 0; i < 3; i++) {
+			origin[i] = c[i] * DASH_CHUNK_SIZE;
+		}
+		stream_pad(chunks, pad);
+		mesh_padded(pad, origin, mask, &slot->quads);
+		store_encode(&slot->store, chunks[0], 1);
+
+		pthread_mutex_lock(&s->lock);
+		slot->state = SLOT_READY;
+		s->done[s->done_count++] = index;
+		pthread_mutex_unlock(&s->lock);
+
+	}
+
+	for(i = 0; i < 7; i++) {
+		free(chunks[i]);
+	}
+	free(pad);
+	free(blob);
+	free(mask);
+	return NULL;
+
+}
+
+dash_voxel_stream *dash_voxel_stream_create(const char *dir, int chunks_y, int radius, size_t budget) {
+
+	int i, x, y, z, span, wanted, buckets;
+	dash_voxel_stream *s;
+
+	s = (dash_voxel_stream*)calloc(1, sizeof(dash_voxel_stream));
+	s->dir = strdup(dir);
+	s->chunks_y = chunks_y;
+	s->radius = radius;
+	s->budget = budget;
+
+	// Offsets within the radius, nearest first, are the load order
+
+	span = radius * 2 + 1;
+	s->offsets = (int*)malloc(sizeof(int) * 4 * span * span * span);
+	for(z = -radius; z <= radius; z++) {
+		for(y = -radius; y <= radius; y++) {
+			for(x = -radius; x <= radius; x++) {
+				i = s->offset_count++ * 4;
+				s->offsets[i + 0] = x * x + y * y + z * z;
+				s->offsets[i + 1] = x;
+				s->offsets[i + 2] = y;
+				s->offsets[i + 3] = z;
+			}
+		}
+	}
+	qsort(s->offsets, s->offset_count, sizeof(int) * 4, compare_offsets);
+
+	// Twice the chunks one view can want leaves room to keep chunks behind
+	// the camera when the budget allows
+
+	wanted = span * span * (chunks_y < span ? chunks_y : span);
+	s->slot_count = wanted * 2;
+	for(buckets = 1; buckets < s->slot_count * 2; buckets *= 2);
+	s->bucket_mask = buckets - 1;
+
+	s->slots = (stream_slot*)calloc(s->slot_count, sizeof(stream_slot));
+	s->buckets = (int*)malloc(sizeof(int) * buckets);
+	s->free_slots = (int*)malloc(sizeof(int) * s->slot_count);
+	s->queue = (int*)malloc(sizeof(int) * s->slot_count);
+	s->done = (int*)malloc(sizeof(int) * s->slot_count);
+	for(i = 0; i < buckets; i++) {
+		s->buckets[i] = -1;
+	}
+	for(i = s->slot_count - 1; i >= 0; i--) {
+		s->free_slots[s->free_count++] = i;
+	}
+	s->center[1] = -1 - radius * 2;
+
+	pthread_mutex_init(&s->region_lock, NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+
+	// The GL thread keeps one core to itself
+
+	s->thread_count = voxel_threads() - 1;
+	if(s->thread_count < 1) {
+		s->thread_count = 1;
+	}
+	for(i = 0; i < s->thread_count; i++) {
+		pthread_create(&s->threads[i], NULL, stream_worker, s);
+	}
+
+	return s;
+
+}
+
+static void stream_requeue(dash_voxel_stream *s) {
+
+	int i, index, c[3];
+	stream_slot *slot;
+
+	pthread_mutex_lock(&s->lock);
+	s->starved = 0;
+
+	// Queued chunks that fell out of range are dropped before a worker
+	// gets to them, chunks already loading are left to finish
+
+	for(i = s->queue_head; i < s->queue_count; i++) {
+		slot = &s->slots[s->queue[i]];
+		if(slot->state == SLOT_QUEUED && !slot_wanted(s, slot->c)) {
+			slot_release(s, s->queue[i]);
+		}
+	}
+	s->queue_head = 0;
+	s->queue_count = 0;
+
+	for(i = 0; i < s->offset_count; i++) {
+
+		c[0] = s->center[0] + s->offsets[i * 4 + 1];
+		c[1] = s->center[1] + s->offsets[i * 4 + 2];
+		c[2] = s->center[2] + s->offsets[i * 4 + 3];
+		if(c[1] < 0 || c[1] >= s->chunks_y) {
+			continue;
+		}
+
+		index = slot_find(s, c);
+		if(index >= 0) {
+			if(s->slots[index].state == SLOT_QUEUED) {
+				s->queue[s->queue_count++] = index;
+			}
+			continue;
+		}
+
+		// Once out of slots, keep going only to requeue chunks already
+		// waiting, the rest are picked up when slots free
+
+		if(s->starved || (s->free_count == 0 && slot_evict(s) < 0)) {
+			s->starved = 1;
+			continue;
+		}
+
+		index = s->free_slots[--s->free_count];
+		slot = &s->slots[index];
+		memcpy(slot->c, c, sizeof(c));
+		slot->state = SLOT_QUEUED;
+		slot->next = s->buckets[slot_hash(s, c)];
+		s->buckets[slot_hash(s, c)] = index;
+		s->queue[s->queue_count++] = index;
+
+	}
+
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+
+}
+
+void dash_voxel_stream_update(dash_voxel_stream *s, vec3 eye) {
+
+	int i, n, back, c[3], ready[DASH_STREAM_UPLOADS];
+	size_t bytes;
+	double start;
+	stream_slot *slot;
+
+	start = voxel_now();
+	s->frame++;
+	if(s->quad_ibo == 0) {
+		s->quad_ibo = build_quad_ibo();
+	}
+
+	for(i = 0; i < 3; i++) {
+		c[i] = (int)floorf(eye[i] / DASH_CHUNK_SIZE);
+	}
+	if(c[0] != s->center[0] || c[1] != s->center[1] || c[2] != s->center[2]) {
+		memcpy(s->center, c, sizeof(c));
+		stream_requeue(s);
+	} else if(s->starved && s->free_count > 0) {
+		stream_requeue(s);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	n = s->done_count < DASH_STREAM_UPLOADS ? s->done_count : DASH_STREAM_UPLOADS;
+	memcpy(ready, s->done, sizeof(int) * n);
+	memmove(s->done, s->done + n, sizeof(int) * (s->done_count - n));
+	s->done_count -= n;
+	pthread_mutex_unlock(&s->lock);
+
+	for(i = 0; i < n; i++) {
+
+		slot = &s->slots[ready[i]];
+		back = slot->front ^ 1;
+		bytes = sizeof(float) * VOXEL_STRIDE * 4 * slot->quads.count;
+
+		if(slot->vbo[back] == 0) {
+			glGenBuffers(1, &slot->vbo[back]);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, slot->vbo[back]);
+		glBufferData(GL_ARRAY_BUFFER, bytes, slot->quads.vertices, GL_STATIC_DRAW);
+
+		slot->vbo_bytes[back] = bytes;
+		slot->front = back;
+		s->stats.quads += slot->quads.count - slot->quad_count;
+		slot->quad_count = slot->quads.count;
+		free(slot->quads.vertices);
+		memset(&slot->quads, 0, sizeof(voxel_quads));
+
+		s->stats.bytes -= slot->bytes;
+		slot->bytes = sizeof(stream_slot) + store_bytes(&slot->store) + slot->vbo_bytes[0] + slot->vbo_bytes[1];
+		s->stats.bytes += slot->bytes;
+		slot->last_used = s->frame;
+		slot->state = SLOT_RESIDENT;
+		s->stats.loaded++;
+
+	}
+
+	while(s->stats.bytes > s->budget && slot_evict(s) >= 0);
+
+	s->stats.update_ms = (voxel_now() - start) * 1000.0;
+
+}
+
+int dash_voxel_stream_draw(dash_voxel_stream *s, mat4 view_projection, GLint *locations, GLint layer_location) {
+
+	int i, drawn;
+	float planes[24];
+	vec3 min, max;
+	stream_slot *slot;
+
+	if(s->quad_ibo == 0) {
+		return 0;
+	}
+
+	mat4_frustum_planes(view_projection, planes);
+
+	dash_mesh_unbind();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s->quad_ibo);
+	voxel_attribs(locations, layer_location, 1);
+
+	drawn = 0;
+	for(i = 0; i < s->slot_count; i++) {
+
+		slot = &s->slots[i];
+		if(slot->state != SLOT_RESIDENT || slot->quad_count == 0) {
+			continue;
+		}
+
+		min[0] = slot->c[0] * DASH_CHUNK_SIZE;
+		min[1] = slot->c[1] * DASH_CHUNK_SIZE;
+		min[2] = slot->c[2] * DASH_CHUNK_SIZE;
+		max[0] = min[0] + DASH_CHUNK_SIZE;
+		max[1] = min[1] + DASH_CHUNK_SIZE;
+		max[2] = min[2] + DASH_CHUNK_SIZE;
+		if(!mat4_frustum_box(planes, min, max)) {
+			continue;
+		}
+
+		voxel_draw_quads(slot->vbo[slot->front], slot->quad_count, locations, layer_location);
+		slot->last_used = s->frame;
+		drawn++;
+
+	}
+
+	voxel_attribs(locations, layer_location, 0);
+	return drawn;
+
+}
+
+void dash_voxel_stream_get_stats(dash_voxel_stream *s, dash_voxel_stream_stats *stats) {
+
+	int i;
+
+	pthread_mutex_lock(&s->lock);
+	s->stats.resident = 0;
+	for(i = 0; i < s->slot_count; i++) {
+		if(s->slots[i].state == SLOT_RESIDENT) {
+			s->stats.resident++;
+		}
+	}
+	s->stats.queued = s->queue_count - s->queue_head;
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->lock);
+
+}
+
+void dash_voxel_stream_destroy(dash_voxel_stream *s) {
+
+	int i;
+
+	pthread_mutex_lock(&s->lock);
+	s->quit = 1;
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	for(i = 0; i < s->thread_count; i++) {
+		pthread_join(s->threads[i], NULL);
+	}
+
+	for(i = 0; i < s->slot_count; i++) {
+		store_free(&s->slots[i].store);
+		free(s->slots[i].quads.vertices);
+		glDeleteBuffers(2, s->slots[i].vbo);
+	}
+	for(i = 0; i < REGION_HANDLES; i++) {
+		if(s->regions[i].used && s->regions[i].fd >= 0) {
+			close(s->regions[i].fd);
+		}
+	}
+	if(s->quad_ibo != 0) {
+		glDeleteBuffers(1, &s->quad_ibo);
+	}
+
+	pthread_cond_destroy(&s->wake);
+	pthread_mutex_destroy(&s->lock);
+	pthread_mutex_destroy(&s->region_lock);
+	free(s->done);
+	free(s->queue);
+	free(s->free_slots);
+	free(s->buckets);
+	free(s->slots);
+	free(s->offsets);
+	free(s->dir);
+	free(s);
+
+}
+
+/******************************************************************************/
+/** End Program	                                                             **/
+/******************************************************************************/
@@ -30,8 +30,7 @@
 #define WIDTH 640
 #define HEIGHT 480
 
-GLuint vbo_cube_vertices;
-GLuint ibo_cube_indices;
+dash_mesh cube;
 GLuint program, texture_id;
 GLint attribute_coord3d, attribute_texcoord;
 GLint uniform_mvp, uniform_mytexture;
@@ -114,11 +113,7 @@ int init_resources() {
 		 1.0,  1.0,  1.0, 0.0, 1.0
 	};
 	
-	glGenBuffers(1, &vbo_cube_vertices);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_vertices);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-	
-	GLushort cube_elements[] = {
+	uint32_t cube_elements[] = {
 		// front
 		0,  1,  2,
 		2,  3,  0,
@@ -139,13 +134,16 @@ int init_resources() {
 		22, 23, 20
 	};
 
-	glGenBuffers(1, &ibo_cube_indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_elements), cube_elements, GL_STATIC_DRAW);
+	dash_mesh_data cube_data = {
+		cube_vertices, 24, 5, 3, -1, -1,
+		cube_elements, sizeof(cube_elements) / sizeof(uint32_t)
+	};
+	dash_mesh_upload(&cube_data, &cube);
 
-	int width, height, depth;
-	unsigned char *data;
-	texture_id = dash_texture_load("texture.png");
+	texture_id = dash_texture_acquire("texture.png");
+	if(!texture_id) {
+		return 0;
+	}
 	
 	program = dash_create_program("shader/vertex.glsl", "shader/fragment.glsl");
 	if(!program) {
@@ -182,6 +180,12 @@ int init_resources() {
 		return 0;
 	}
 
+	GLint locations[DASH_SEMANTIC_COUNT];
+	locations[DASH_POSITION] = attribute_coord3d;
+	locations[DASH_TEXCOORD] = attribute_texcoord;
+	locations[DASH_COLOR] = -1;
+	dash_mesh_layout(&cube, locations);
+
 	return 1;
 
 }
@@ -192,38 +196,10 @@ void on_display() {
 	glUseProgram(program);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture_id);
+	dash_texture_bind(texture_id);
 	glUniform1i(uniform_mytexture, 0);
 
-	glEnableVertexAttribArray(attribute_coord3d);
-	glEnableVertexAttribArray(attribute_texcoord);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_vertices);
-	glVertexAttribPointer(
-		attribute_coord3d,
-		3,
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(float) * 5,
-		0
-	);
-
-	glVertexAttribPointer(
-		attribute_texcoord,
-		2,
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(float) * 5,
-		(void*)(sizeof(float) * 3)
-	);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_indices);
-	int size;
-	glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-	glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
-
-	glDisableVertexAttribArray(attribute_coord3d);
-	glDisableVertexAttribArray(attribute_texcoord);
+	dash_mesh_render(&cube);
 
 	glutSwapBuffers();
 
@@ -261,8 +237,7 @@ void on_idle() {
 void free_resources() {
 
 	glDeleteProgram(program);
-	glDeleteBuffers(1, &vbo_cube_vertices);
-	glDeleteBuffers(1, &ibo_cube_indices);
-	glDeleteTextures(1, &texture_id);
+	dash_mesh_free(&cube);
+	dash_texture_release(texture_id);
 
 }
@@ -0,0 +1,74 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Usage: meshbake [-z] input.obj|input.ply output.dmsh
+
+	Converts a mesh into the binary cache format read by dash_mesh_load_baked.
+	Triangles and vertices are reordered for the vertex cache first, and the
+	ACMR (cache misses per triangle) and ATVR (misses per vertex) before and
+	after are printed. With -z the vertex and index streams are delta coded,
+	which makes the file smaller at the cost of a decode pass on load.
+*/
+
+int main(int argc, char *argv[]) {
+
+	int flags;
+	const char *src, *dst;
+	dash_mesh_data mesh;
+	dash_cache_stats before, after;
+
+	flags = 0;
+	if(argc == 4 && strcmp(argv[1], "-z") == 0) {
+		flags |= DASH_MESH_COMPRESS;
+	} else if(argc != 3) {
+		fprintf(stderr, "Usage: %s [-z] input.obj output.dmsh\n", argv[0]);
+		return 1;
+	}
+
+	src = argv[argc - 2];
+	dst = argv[argc - 1];
+
+	if(!dash_mesh_load(src, &mesh)) {
+		return 1;
+	}
+
+	dash_mesh_analyze(mesh.indices, mesh.index_count, mesh.vertex_count, DASH_VERTEX_CACHE_SIZE, &before);
+	dash_mesh_optimize(&mesh, DASH_VERTEX_CACHE_SIZE);
+	dash_mesh_analyze(mesh.indices, mesh.index_count, mesh.vertex_count, DASH_VERTEX_CACHE_SIZE, &after);
+
+	printf("%s: %zu vertices, %zu triangles\n", src, mesh.vertex_count, mesh.index_count / 3);
+	printf("ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", before.acmr, after.acmr, before.atvr, after.atvr);
+
+	if(!dash_mesh_write(src, &mesh, dst, flags)) {
+		dash_mesh_data_free(&mesh);
+		return 1;
+	}
+
+	dash_mesh_data_free(&mesh);
+	return 0;
+
+}
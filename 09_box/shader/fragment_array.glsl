@@ -0,0 +1,10 @@
+#extension GL_EXT_texture_array : enable
+
+varying vec2 f_texcoord;
+varying float f_layer;
+uniform sampler2DArray mytexture;
+
+void main(void) {
+	vec2 flipped_texcoord = vec2(f_texcoord.x, 1.0 - f_texcoord.y);
+	gl_FragColor = texture2DArray(mytexture, vec3(flipped_texcoord, f_layer));
+}
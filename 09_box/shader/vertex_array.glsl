@@ -0,0 +1,12 @@
+attribute vec3 coord3d;
+attribute vec2 texcoord;
+attribute float layer;
+varying vec2 f_texcoord;
+varying float f_layer;
+uniform mat4 mvp;
+
+void main(void) {
+  gl_Position = mvp * vec4(coord3d, 1.0);
+  f_texcoord = texcoord;
+  f_layer = layer;
+}
@@ -0,0 +1,13 @@
+attribute vec3 coord3d;
+attribute vec2 texcoord;
+attribute vec4 cube;
+varying vec2 f_texcoord;
+varying float f_layer;
+uniform mat4 view_projection;
+
+void main(void) {
+  float size = mod(cube.w, 256.0);
+  gl_Position = view_projection * vec4(cube.xyz + coord3d * size, 1.0);
+  f_texcoord = texcoord;
+  f_layer = floor(cube.w / 256.0);
+}
@@ -0,0 +1,10 @@
+attribute vec3 coord3d;
+attribute vec2 texcoord;
+attribute mat4 model;
+varying vec2 f_texcoord;
+uniform mat4 view_projection;
+
+void main(void) {
+  gl_Position = view_projection * model * vec4(coord3d, 1.0);
+  f_texcoord = texcoord;
+}
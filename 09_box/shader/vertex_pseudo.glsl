@@ -0,0 +1,11 @@
+attribute vec3 coord3d;
+attribute vec2 texcoord;
+attribute float instance_id;
+varying vec2 f_texcoord;
+uniform mat4 view_projection;
+uniform mat4 models[24]; // DASH_PSEUDO_BATCH
+
+void main(void) {
+  gl_Position = view_projection * models[int(instance_id)] * vec4(coord3d, 1.0);
+  f_texcoord = texcoord;
+}
@@ -0,0 +1,34 @@
+#extension GL_EXT_gpu_shader4 : require
+#extension GL_ARB_draw_instanced : require
+
+uniform usamplerBuffer cubes;
+uniform mat4 view_projection;
+varying vec2 f_texcoord;
+varying float f_layer;
+
+void main(void) {
+  uvec4 cube = texelFetchBuffer(cubes, gl_InstanceIDARB);
+
+  // Six faces of two triangles, +x +y +z then -x -y -z. A face spans the
+  // two axes after its own, and the corners of a back face run in reverse
+  // so every face winds counter clockwise seen from outside.
+  int face = gl_VertexID / 6;
+  int corner = gl_VertexID % 6;
+  int axis = face % 3;
+  int quad = corner < 3 ? corner : (corner == 3 ? 2 : (corner == 4 ? 3 : 0));
+  if(face >= 3) {
+    quad = (4 - quad) % 4;
+  }
+
+  float u = (quad == 1 || quad == 2) ? 1.0 : 0.0;
+  float v = quad >= 2 ? 1.0 : 0.0;
+  vec3 normal = vec3(axis == 0, axis == 1, axis == 2);
+  vec3 tangent = vec3(axis == 2, axis == 0, axis == 1);
+  vec3 bitangent = vec3(axis == 1, axis == 2, axis == 0);
+  vec3 offset = (face < 3 ? normal : vec3(0.0)) + tangent * u + bitangent * v;
+
+  vec3 position = vec3(cube.xyz) + offset * float(cube.w & 255u);
+  gl_Position = view_projection * vec4(position, 1.0);
+  f_texcoord = vec2(u, v);
+  f_layer = float(cube.w >> 8u);
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Usage: texbake [-bc | -etc2] input.png output.dtex
+
+	Without a flag mip levels are stored raw. With -bc they are stored as BC1
+	(rgb) or BC3 (rgba) and with -etc2 as ETC2 rgb, which refuses rgba input.
+	Encode throughput and PSNR of the top level are printed so the quality can
+	be checked.
+*/
+
+int main(int argc, char *argv[]) {
+
+	GLenum format;
+	dash_compress_stats stats;
+	const char *src, *dst;
+
+	format = 0;
+	if(argc == 4 && strcmp(argv[1], "-bc") == 0) {
+		format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	} else if(argc == 4 && strcmp(argv[1], "-etc2") == 0) {
+		format = GL_COMPRESSED_RGB8_ETC2;
+	} else if(argc != 3) {
+		fprintf(stderr, "Usage: %s [-bc | -etc2] input.png output.dtex\n", argv[0]);
+		return 1;
+	}
+
+	src = argv[argc - 2];
+	dst = argv[argc - 1];
+
+	if(!dash_texture_bake(src, dst, format, &stats)) {
+		return 1;
+	}
+
+	// Stats come from encoding the top level inside the bake
+
+	if(format != 0) {
+		printf("%s: %.1f ms, %.1f Mpix/s, PSNR %.2f dB\n", src,
+			stats.seconds * 1000.0, stats.megapixels_per_second, stats.psnr);
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,351 @@
+/*
+    This file is part of DashGL.com OpenGL 2.0 Introduction
+
+    Copyright (C) 2017 Benjamin Collins
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include "lib/dashgl.h"
+
+/*
+	Voxel terrain of 256 x 64 x 256 voxels, about a million of them solid,
+	in 32 cubed chunks meshed with greedy quads. Press space to blast a
+	crater into the terrain and remesh only the chunks it touched; the
+	title shows quads, visible chunks and the last meshing time.
+
+	With -stream the camera flies across a 4096 x 128 x 4096 world instead,
+	two billion voxels written once to region files in regions/ and
+	streamed in around the camera under a 256 MB budget.
+*/
+
+#define WIDTH 640
+#define HEIGHT 480
+#define CHUNKS_X 8
+#define CHUNKS_Y 2
+#define CHUNKS_Z 8
+#define STREAM_CHUNKS 128
+#define STREAM_CHUNKS_Y 4
+#define STREAM_RADIUS 6
+#define STREAM_BUDGET (256 << 20)
+#define REGION_DIR "regions"
+
+dash_voxel_world *world;
+dash_voxel_stream *stream;
+GLuint program, texture_id;
+GLint locations[DASH_SEMANTIC_COUNT];
+GLint attribute_layer, uniform_mvp, uniform_mytexture;
+
+const char *layers[] = {
+	"texture.png",
+	"texture.png"
+};
+
+int init_resources(int streaming);
+int terrain_height(int x, int z);
+void generate_terrain();
+void write_regions();
+void blast(int cx, int cy, int cz, int radius);
+void on_display();
+void on_keyboard(unsigned char key, int x, int y);
+void on_idle();
+void free_resources();
+
+int main(int argc, char *argv[]) {
+
+	int i, streaming;
+
+	streaming = 0;
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-stream") == 0) {
+			streaming = 1;
+		}
+	}
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2, 0);
+	glutInitDisplayMode(GLUT_RGBA|GLUT_ALPHA|GLUT_DOUBLE|GLUT_DEPTH);
+	glutInitWindowSize(WIDTH, HEIGHT);
+	glutCreateWindow("Voxel Terrain");
+
+	GLenum glew_status = glewInit();
+	if(glew_status != GLEW_OK) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	if(!GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error your gpu does not support OpenGL 2.0\n");
+		return 1;
+	}
+
+	if(!init_resources(streaming)) {
+		free_resources();
+		return 1;
+	}
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
+	glutDisplayFunc(on_display);
+	glutKeyboardFunc(on_keyboard);
+	glutIdleFunc(on_idle);
+	glutMainLoop();
+
+	free_resources();
+	return 0;
+
+}
+
+int init_resources(int streaming) {
+
+	char path[256];
+	dash_voxel_stats stats;
+
+	glClearColor(0.6, 0.8, 1.0, 1.0);
+
+	texture_id = dash_texture_array_load(layers, 2);
+	if(!texture_id) {
+		return 0;
+	}
+
+	program = dash_create_program("shader/vertex_array.glsl", "shader/fragment_array.glsl");
+	if(!program) {
+		return 0;
+	}
+
+	locations[DASH_POSITION] = glGetAttribLocation(program, "coord3d");
+	locations[DASH_TEXCOORD] = glGetAttribLocation(program, "texcoord");
+	locations[DASH_COLOR] = -1;
+	attribute_layer = glGetAttribLocation(program, "layer");
+	uniform_mvp = glGetUniformLocation(program, "mvp");
+	uniform_mytexture = glGetUniformLocation(program, "mytexture");
+	if(locations[DASH_POSITION] == -1 || uniform_mvp == -1) {
+		fprintf(stderr, "Could not bind voxel shader\n");
+		return 0;
+	}
+
+	if(streaming) {
+		snprintf(path, sizeof(path), "%s/r.0.0.0.dvr", REGION_DIR);
+		if(access(path, R_OK) != 0) {
+			write_regions();
+		}
+		stream = dash_voxel_stream_create(REGION_DIR, STREAM_CHUNKS_Y, STREAM_RADIUS, STREAM_BUDGET);
+		return 1;
+	}
+
+	world = dash_voxel_create(CHUNKS_X, CHUNKS_Y, CHUNKS_Z);
+	generate_terrain();
+	dash_voxel_mesh(world);
+
+	dash_voxel_get_stats(world, &stats);
+	printf("%ld quads from %ld chunks in %.1f ms\n", stats.quads,
+		stats.chunks_meshed, stats.mesh_ms);
+	printf("voxel storage %.2f MB, %d uniform and %d run length chunks\n",
+		stats.storage_bytes / (1024.0 * 1024.0), stats.uniform_chunks, stats.run_chunks);
+
+	return 1;
+
+}
+
+int terrain_height(int x, int z) {
+
+	// Rolling hills, with mountains rising out of them over larger areas
+
+	return 16 + (int)(10.0f * sinf(x * 0.05f) * cosf(z * 0.04f) +
+		5.0f * sinf((x + z) * 0.11f) + 40.0f * fmaxf(0.0f, sinf(x * 0.004f) * sinf(z * 0.005f)));
+
+}
+
+void generate_terrain() {
+
+	int x, y, z, h;
+	long solid;
+
+	// Stone under a layer of grass
+
+	solid = 0;
+	for(z = 0; z < CHUNKS_Z * DASH_CHUNK_SIZE; z++) {
+		for(x = 0; x < CHUNKS_X * DASH_CHUNK_SIZE; x++) {
+			h = terrain_height(x, z);
+			for(y = 0; y < h; y++) {
+				dash_voxel_set(world, x, y, z, y < h - 1 ? 2 : 1);
+			}
+			solid += h;
+		}
+	}
+
+	printf("%ld solid voxels\n", solid);
+
+}
+
+void write_regions() {
+
+	int cx, cy, cz, x, y, z, h, wy;
+	uint8_t *voxels;
+
+	printf("Writing %d x %d x %d chunks to %s/\n", STREAM_CHUNKS, STREAM_CHUNKS_Y,
+		STREAM_CHUNKS, REGION_DIR);
+	voxels = (uint8_t*)malloc(DASH_CHUNK_VOXELS);
+
+	for(cz = 0; cz < STREAM_CHUNKS; cz++) {
+		for(cx = 0; cx < STREAM_CHUNKS; cx++) {
+			for(cy = 0; cy < STREAM_CHUNKS_Y; cy++) {
+
+				for(z = 0; z < DASH_CHUNK_SIZE; z++) {
+					for(x = 0; x < DASH_CHUNK_SIZE; x++) {
+						h = terrain_height(cx * DASH_CHUNK_SIZE + x, cz * DASH_CHUNK_SIZE + z);
+						for(y = 0; y < DASH_CHUNK_SIZE; y++) {
+							wy = cy * DASH_CHUNK_SIZE + y;
+							voxels[(z * DASH_CHUNK_SIZE + y) * DASH_CHUNK_SIZE + x] =
+								wy < h ? (wy < h - 1 ? 2 : 1) : 0;
+						}
+					}
+				}
+				dash_region_write_chunk(REGION_DIR, cx, cy, cz, voxels);
+
+			}
+		}
+		printf("\r%d%%", (cz + 1) * 100 / STREAM_CHUNKS);
+		fflush(stdout);
+	}
+
+	printf("\n");
+	free(voxels);
+
+}
+
+void blast(int cx, int cy, int cz, int radius) {
+
+	int x, y, z;
+
+	for(z = -radius; z <= radius; z++) {
+		for(y = -radius; y <= radius; y++) {
+			for(x = -radius; x <= radius; x++) {
+				if(x * x + y * y + z * z <= radius * radius) {
+					dash_voxel_set(world, cx + x, cy + y, cz + z, 0);
+				}
+			}
+		}
+	}
+
+}
+
+void on_display() {
+
+	int drawn;
+	char title[128];
+	float angle, distance;
+	mat4 mvp, projection, view;
+	vec3 eye, target = { 128.0f, 0.0f, 128.0f };
+	vec3 axis = { 0.0f, 1.0f, 0.0f };
+	dash_voxel_stats stats;
+	dash_voxel_stream_stats stream_stats;
+
+	if(stream != NULL) {
+
+		// Fly diagonally across the world and back at 40 voxels a second
+
+		distance = fmodf(glutGet(GLUT_ELAPSED_TIME) * 0.04f, STREAM_CHUNKS * DASH_CHUNK_SIZE * 2.0f);
+		if(distance > STREAM_CHUNKS * DASH_CHUNK_SIZE) {
+			distance = STREAM_CHUNKS * DASH_CHUNK_SIZE * 2.0f - distance;
+		}
+		eye[0] = distance;
+		eye[1] = 110.0f;
+		eye[2] = distance;
+		target[0] = eye[0] + 60.0f;
+		target[1] = 40.0f;
+		target[2] = eye[2] + 60.0f;
+		dash_voxel_stream_update(stream, eye);
+
+	} else {
+
+		angle = glutGet(GLUT_ELAPSED_TIME) / 8000.0f;
+		eye[0] = 128.0f + 200.0f * cosf(angle);
+		eye[1] = 90.0f;
+		eye[2] = 128.0f + 200.0f * sinf(angle);
+
+	}
+
+	mat4_perspective(45.0f, 1.0f*WIDTH/HEIGHT, 0.1f, 1000.0f, projection);
+	mat4_look_at(eye, target, axis, view);
+	mat4_multiply(projection, view, mvp);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, mvp);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+	glUniform1i(uniform_mytexture, 0);
+
+	if(stream != NULL) {
+		drawn = dash_voxel_stream_draw(stream, mvp, locations, attribute_layer);
+		glutSwapBuffers();
+
+		dash_voxel_stream_get_stats(stream, &stream_stats);
+		sprintf(title, "Voxel Stream - %d of %d chunks drawn, %d queued, %.0f MB, update %.2f ms",
+			drawn, stream_stats.resident, stream_stats.queued,
+			stream_stats.bytes / (1024.0 * 1024.0), stream_stats.update_ms);
+		glutSetWindowTitle(title);
+		return;
+	}
+
+	drawn = dash_voxel_draw(world, mvp, locations, attribute_layer);
+	glutSwapBuffers();
+
+	dash_voxel_get_stats(world, &stats);
+	sprintf(title, "Voxel Terrain - %ld quads, %d chunks, mesh %.2f ms",
+		stats.quads, drawn, stats.mesh_ms);
+	glutSetWindowTitle(title);
+
+}
+
+void on_keyboard(unsigned char key, int x, int y) {
+
+	if(key != ' ' || world == NULL) {
+		return;
+	}
+
+	blast(rand() % (CHUNKS_X * DASH_CHUNK_SIZE), 16, rand() % (CHUNKS_Z * DASH_CHUNK_SIZE), 8);
+	dash_voxel_mesh(world);
+
+}
+
+void on_idle() {
+
+	glutPostRedisplay();
+
+}
+
+void free_resources() {
+
+	glDeleteProgram(program);
+	glDeleteTextures(1, &texture_id);
+	if(world != NULL) {
+		dash_voxel_destroy(world);
+	}
+	if(stream != NULL) {
+		dash_voxel_stream_destroy(stream);
+	}
+
+}